@@ -0,0 +1,27 @@
+# Writes a SPIR-V binary to a header as a constexpr array of words.
+# Usage: cmake -DSPIRV=<file> -DHEADER=<file> -DNAME=<identifier>
+#        -DSOURCE=<shader> -P embed_spirv.cmake
+
+file(READ "${SPIRV}" hex HEX)
+string(LENGTH "${hex}" hex_length)
+math(EXPR word_count "${hex_length} / 8")
+
+# SPIR-V is written in little-endian words.
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1, " words "${hex}")
+# Six words per line.
+set(word "0x[0-9a-f]+, ")
+string(REGEX REPLACE "(${word}${word}${word}${word}${word}${word})" "\\1\n    "
+  words "${words}")
+string(REGEX REPLACE " \n" "\n" words "${words}")
+string(STRIP "${words}" words)
+
+file(WRITE "${HEADER}"
+  "// Generated from ${SOURCE} by cmake/embed_spirv.cmake. Do not edit.\n"
+  "#pragma once\n"
+  "\n"
+  "#include <array>\n"
+  "#include <cstdint>\n"
+  "\n"
+  "constexpr std::array<uint32_t, ${word_count}> ${NAME} = {\n"
+  "    ${words}\n"
+  "};\n")
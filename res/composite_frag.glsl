@@ -0,0 +1,16 @@
+#version 450 core
+
+layout(location = 0) in vec2 in_uv;
+
+// The crowd, drawn offscreen over a transparent clear.
+layout(set = 0, binding = 0) uniform sampler2D offscreen_color;
+
+layout(location = 0) out vec4 out_color;
+
+void main() {
+    vec4 color = texture(offscreen_color, in_uv);
+    if (color.a < 0.5) {
+        discard;
+    }
+    out_color = vec4(color.rgb, 1.0);
+}
@@ -0,0 +1,14 @@
+#version 450 core
+
+// One triangle covering the screen, with no vertex buffer.
+layout(location = 0) out vec2 out_uv;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+    vec2 pos = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    out_uv = pos;
+    gl_Position = vec4(pos * 2.0 - 1.0, 1.0, 1.0);
+}
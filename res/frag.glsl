@@ -1,4 +1,7 @@
 #version 450 core
+#ifndef PER_MATERIAL_TEXTURES
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
 layout(binding = 0) uniform Ubo_Global {
     mat4 view_proj;
@@ -6,13 +9,34 @@ layout(binding = 0) uniform Ubo_Global {
 }
 ubo_camera;
 
+#ifdef PER_MATERIAL_TEXTURES
+// Without descriptor indexing, each material binds a set of its own
+// textures, one per slot.
 layout(set = 1, binding = 0) uniform sampler2D texture_maps[4];
+#define TEXTURE_MAP(slot) texture_maps[slot]
+#else
+// Every texture of every material, sized by the set layout (see
+// bindless_texture_capacity() in materials.h).
+layout(set = 1, binding = 0) uniform sampler2D texture_maps[];
+#define TEXTURE_MAP(slot) \
+    texture_maps[nonuniformEXT(material.textures[slot])]
+#endif
+
+// Diffuse, emissive, normal, and specular indices into texture_maps.
+struct Material {
+    uint textures[4];
+};
+
+layout(set = 1, binding = 1) readonly buffer Ssbo_Materials {
+    Material materials[];
+};
 
 layout(location = 0) in vec4 in_col;
 layout(location = 1) in vec2 in_uv;
 layout(location = 2) in vec4 in_pos_vert;
 layout(location = 3) in vec4 in_pos_view;
 layout(location = 4) in vec3 in_norm;
+layout(location = 5) flat in uint in_material;
 
 layout(location = 0) out vec4 out_color;
 
@@ -20,19 +44,44 @@ layout(location = 0) out vec4 out_color;
 vec3 light_pos = vec3(0.5, -7, 5);
 vec3 ambience = vec3(0.25, 0.25, 0.25);
 
-// Material properties
-float shininess;
+// Set per pipeline by the shader permutation (see shader_permutations.h).
+layout(constant_id = 4) const bool normal_map = true;
+layout(constant_id = 5) const float light_intensity = 0.12;
+// Higher should be smaller highlight
+layout(constant_id = 6) const float shininess = 1.32;
+
+// Tangent frame from screen-space derivatives, since the mesh has no
+// tangents.
+mat3 cotangent_frame(vec3 normal, vec3 pos, vec2 uv) {
+    vec3 dp1 = dFdx(pos);
+    vec3 dp2 = dFdy(pos);
+    vec2 duv1 = dFdx(uv);
+    vec2 duv2 = dFdy(uv);
+    vec3 dp2_perp = cross(dp2, normal);
+    vec3 dp1_perp = cross(normal, dp1);
+    vec3 tangent = dp2_perp * duv1.x + dp1_perp * duv2.x;
+    vec3 bitangent = dp2_perp * duv1.y + dp1_perp * duv2.y;
+    float scale = inversesqrt(
+        max(max(dot(tangent, tangent), dot(bitangent, bitangent)), 1e-12));
+    return mat3(tangent * scale, bitangent * scale, normal);
+}
 
 void main() {
-    vec3 diffuse_color = texture(texture_maps[0], in_uv).rgb;
-    vec4 emissive_color = texture(texture_maps[1], in_uv).rgba;
-    vec3 normal_color = texture(texture_maps[2], in_uv).xyz;
-    vec3 specular_color = texture(texture_maps[3], in_uv).rgb;
-
-    vec3 normal = (in_norm.xyz);
-    float light_intensity = 0.12;
-    // Higher should be smaller highlight
-    shininess = 1.32*1;
+    // Instances in one draw may use different materials.
+    Material material = materials[in_material];
+    vec3 diffuse_color = texture(TEXTURE_MAP(0), in_uv).rgb;
+    vec4 emissive_color = texture(TEXTURE_MAP(1), in_uv);
+    vec3 specular_color = texture(TEXTURE_MAP(3), in_uv).rgb;
+
+    vec3 normal = normalize(in_norm.xyz);
+    if (normal_map) {
+        // Normal maps are baked to two channels, so rebuild z.
+        vec2 normal_xy = texture(TEXTURE_MAP(2), in_uv).xy * 2 - 1;
+        vec3 normal_color = vec3(normal_xy,
+                                 sqrt(max(1 - dot(normal_xy, normal_xy), 0)));
+        normal = normalize(cotangent_frame(normal, in_pos_vert.xyz, in_uv) *
+                           normal_color);
+    }
 
     vec3 light_dir = normalize(light_pos.xyz - in_pos_vert.xyz);
     float lambertian_intensity = max(dot(light_dir, normal), 0.0);
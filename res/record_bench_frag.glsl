@@ -0,0 +1,7 @@
+#version 450 core
+
+layout(location = 0) out vec4 out_color;
+
+void main() {
+    out_color = vec4(1, 1, 1, 1);
+}
@@ -0,0 +1,13 @@
+#version 450 core
+
+// Every draw is a small triangle placed by a push constant, so the
+// benchmark's draws need no buffers or descriptors.
+layout(push_constant) uniform Push_Draw {
+    vec2 offset;
+}
+push;
+
+void main() {
+    vec2 corner = vec2(gl_VertexIndex == 1, gl_VertexIndex == 2) * 0.02;
+    gl_Position = vec4(push.offset + corner, 0, 1);
+}
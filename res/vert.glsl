@@ -1,11 +1,5 @@
 #version 450 core
 
-struct Transform {
-    vec3 translation;
-    // From GLM: x, y, z, w
-    vec4 quaternion;
-};
-
 vec4 normalize_quaternion(vec4 in_quat) {
     vec4 out_quat;
     float norm = sqrt(in_quat.x * in_quat.x + in_quat.y * in_quat.y +
@@ -17,29 +11,44 @@ vec4 normalize_quaternion(vec4 in_quat) {
     return out_quat;
 }
 
-mat4 quaternion_to_matrix(vec4 quat) {
-    mat4 mat = mat4(0);
-
-    float x = quat.x, y = quat.y, z = quat.z, w = quat.w;
-    float x2 = x + x, y2 = y + y, z2 = z + z;
-    float xx = x * x2, xy = x * y2, xz = x * z2;
-    float yy = y * y2, yz = y * z2, zz = z * z2;
-    float wx = w * x2, wy = w * y2, wz = w * z2;
-
-    mat[0][0] = 1.0 - (yy + zz);
-    mat[0][1] = xy - wz;
-    mat[0][2] = xz + wy;
-    mat[1][0] = xy + wz;
-    mat[1][1] = 1.0 - (xx + zz);
-    mat[1][2] = yz - wx;
-    mat[2][0] = xz - wy;
-    mat[2][1] = yz + wx;
-    mat[2][2] = 1.0 - (xx + yy);
-    mat[3][3] = 1.0;
-
-    return mat;
+vec4 matrix_to_quaternion(mat3 m) {
+    float trace = m[0][0] + m[1][1] + m[2][2];
+    if (trace > 0) {
+        float s = 0.5 / sqrt(trace + 1.0);
+        return vec4((m[1][2] - m[2][1]) * s, (m[2][0] - m[0][2]) * s,
+                    (m[0][1] - m[1][0]) * s, 0.25 / s);
+    }
+    if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+        float s = 2.0 * sqrt(1.0 + m[0][0] - m[1][1] - m[2][2]);
+        return vec4(0.25 * s, (m[1][0] + m[0][1]) / s,
+                    (m[2][0] + m[0][2]) / s, (m[1][2] - m[2][1]) / s);
+    }
+    if (m[1][1] > m[2][2]) {
+        float s = 2.0 * sqrt(1.0 + m[1][1] - m[0][0] - m[2][2]);
+        return vec4((m[1][0] + m[0][1]) / s, 0.25 * s,
+                    (m[2][1] + m[1][2]) / s, (m[2][0] - m[0][2]) / s);
+    }
+    float s = 2.0 * sqrt(1.0 + m[2][2] - m[0][0] - m[1][1]);
+    return vec4((m[2][0] + m[0][2]) / s, (m[2][1] + m[1][2]) / s, 0.25 * s,
+                (m[0][1] - m[1][0]) / s);
+}
+
+vec4 quaternion_multiply(vec4 a, vec4 b) {
+    return vec4(a.w * b.xyz + b.w * a.xyz + cross(a.xyz, b.xyz),
+                a.w * b.w - dot(a.xyz, b.xyz));
 }
 
+vec3 quaternion_rotate(vec4 quat, vec3 v) {
+    return v + 2.0 * cross(quat.xyz, cross(quat.xyz, v) + quat.w * v);
+}
+
+// Set per pipeline by the shader permutation (see shader_permutations.h).
+layout(constant_id = 0) const bool skinned = true;
+// Joint influences blended per vertex: 1, 2 or 4.
+layout(constant_id = 1) const uint max_influences = 4u;
+layout(constant_id = 2) const bool dual_quaternion = false;
+layout(constant_id = 3) const bool flip_y = true;
+
 
 layout(location = 0) in vec3 in_pos;
 layout(location = 1) in vec4 in_col;
@@ -54,23 +63,49 @@ layout(set = 0, binding = 0) uniform Ubo_Global {
 }
 ubo_camera;
 
-layout(set = 2, binding = 0) uniform Ubo_Object {
+struct Instance {
     mat4 model;
-}
-ubo_obj;
+    uint material;
+    // Only read by instance culling.
+    vec4 pose_sphere;
+};
 
-// TODO: Rename Object to Animation
-layout(set = 3, binding = 0) readonly buffer Ssbo_Object_InvBind {
+layout(set = 2, binding = 0) readonly buffer Ssbo_Object_Instances {
+    Instance instances[];
+};
+
+layout(set = 3, binding = 0) readonly buffer Ssbo_Animation_InvBind {
     mat4 inverse_bind[];
 };
-layout(set = 3, binding = 1) readonly buffer Ssbo_Object_KeyframeTrans_Cur {
-    Transform global_keyframetrans_cur[];
+// Skinning matrices of every instance, one palette after another, written
+// by the CPU every frame (see characters.h).
+layout(set = 3, binding = 1) readonly buffer Ssbo_Animation_Palettes {
+    mat4 palettes[];
+};
+
+// Blend shape deltas, grouped per vertex (see blend_shapes.h).
+struct MorphRange {
+    uint first;
+    uint count;
+};
+
+struct MorphDelta {
+    vec3 position;
+    uint channel;
+    vec3 normal;
+    float padding;
+};
+
+layout(set = 3, binding = 2) readonly buffer Ssbo_Morph_Ranges {
+    MorphRange morph_ranges[];
 };
-layout(set = 3, binding = 2) readonly buffer Ssbo_Object_KeyframeTrans_Next {
-    Transform global_keyframetrans_next[];
+layout(set = 3, binding = 3) readonly buffer Ssbo_Morph_Deltas {
+    MorphDelta morph_deltas[];
 };
-layout(set = 3, binding = 3) readonly buffer Ssbo_Object_Keyframe {
-    float keyframe;
+// Channel weights of every instance, one set after another.
+layout(set = 3, binding = 4) readonly buffer Ssbo_Morph_Weights {
+    uint morph_channel_count;
+    float morph_weights[];
 };
 
 layout(location = 0) out vec4 out_col;
@@ -78,62 +113,100 @@ layout(location = 1) out vec2 out_uv;
 layout(location = 2) out vec4 out_pos_vert;
 layout(location = 3) out vec4 out_pos_view;
 layout(location = 4) out vec3 out_norm;
+layout(location = 5) flat out uint out_material;
 
 out gl_PerVertex {
     vec4 gl_Position;
 };
 
-void main() {
-    int idx = gl_VertexIndex;
+// Joint transform from the bind pose to the instance's current pose.
+mat4 joint_matrix(uint joint) {
+    return palettes[gl_InstanceIndex * inverse_bind.length() + joint];
+}
 
-    mat4 inverse_bind_cur;
-    for (int i = 0; i < inverse_bind.length(); i++) {
-        if (i == idx) {
-            inverse_bind_cur = inverse_bind[i];
-            break;
+void main() {
+    mat4 model = instances[gl_InstanceIndex].model;
+    vec4 position = vec4(in_pos, 1);
+    vec3 normal = in_norm;
+
+    // Blend shapes apply in bind space, before skinning. Channels at zero
+    // weight are skipped.
+    MorphRange morph_range = morph_ranges[gl_VertexIndex];
+    uint weights_base = gl_InstanceIndex * morph_channel_count;
+    for (uint i = 0; i < morph_range.count; i++) {
+        MorphDelta delta = morph_deltas[morph_range.first + i];
+        float weight = morph_weights[weights_base + delta.channel];
+        if (weight != 0) {
+            position.xyz += weight * delta.position;
+            normal += weight * delta.normal;
         }
     }
 
-    Transform global_transform_cur;
-    for (int i = 0; i < global_keyframetrans_cur.length(); i++) {
-        if (i == idx) {
-            global_transform_cur = global_keyframetrans_cur[i];
-            break;
+    if (skinned && !dual_quaternion) {
+        // Influences are sorted strongest first, so dropping the tail only
+        // needs the kept weights renormalized.
+        mat4 skin = mat4(0);
+        float total_weight = 0;
+        for (uint i = 0; i < max_influences; i++) {
+            float weight = in_bone_weights[i];
+            if (weight > 0) {
+                skin += weight * joint_matrix(in_weight_indices[i]);
+                total_weight += weight;
+            }
         }
-    }
-
-    Transform global_transform_next;
-    for (int i = 0; i < global_keyframetrans_next.length(); i++) {
-        if (i == idx) {
-            global_transform_next = global_keyframetrans_next[i];
-            break;
+        if (total_weight > 0) {
+            skin /= total_weight;
+            position = skin * position;
+            normal = mat3(skin) * normal;
+        }
+    } else if (skinned) {
+        // Dual quaternions blend rotations without the volume loss of
+        // blending matrices.
+        vec4 real = vec4(0);
+        vec4 dual = vec4(0);
+        vec4 first_real = vec4(0);
+        for (uint i = 0; i < max_influences; i++) {
+            float weight = in_bone_weights[i];
+            if (weight <= 0) {
+                continue;
+            }
+            mat4 joint = joint_matrix(in_weight_indices[i]);
+            vec4 joint_real =
+                normalize_quaternion(matrix_to_quaternion(mat3(joint)));
+            vec4 joint_dual =
+                0.5 * quaternion_multiply(vec4(joint[3].xyz, 0), joint_real);
+            if (i == 0) {
+                first_real = joint_real;
+            } else if (dot(first_real, joint_real) < 0) {
+                weight = -weight;
+            }
+            real += weight * joint_real;
+            dual += weight * joint_dual;
+        }
+        float norm = sqrt(dot(real, real));
+        if (norm > 0) {
+            real /= norm;
+            dual /= norm;
+            vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz +
+                                      cross(real.xyz, dual.xyz));
+            position.xyz = quaternion_rotate(real, position.xyz) + translation;
+            normal = quaternion_rotate(real, normal);
         }
     }
 
-    vec4 quaternion = mix(global_transform_cur.quaternion,
-                          global_transform_next.quaternion,
-                          keyframe);
-    mat4 current_matrix = quaternion_to_matrix
-        (global_transform_cur.quaternion);
-    current_matrix[3] = vec4(mix(global_transform_cur.translation,
-                                 global_transform_next.translation,
-                                 keyframe), 1);
-
-
-    vec4 vert_pos_inv = 1 *
-        current_matrix *
-        inverse_bind_cur *
-        ubo_obj.model *
-        vec4(in_pos.x, in_pos.y, in_pos.z, 1.0);
+    vec4 world_pos = model * position;
+    normal = normalize(transpose(inverse(mat3(model))) * normal);
+    if (flip_y) {
+        world_pos.y = -world_pos.y;
+        normal.y = -normal.y;
+    }
 
-    out_pos_vert = vert_pos_inv;
+    out_pos_vert = world_pos;
     out_pos_view = vec4(ubo_camera.pos, 1);
     out_col = in_col;
     out_uv = in_uv;
-    out_norm = vec3(in_norm.x, -in_norm.y, in_norm.z)
-        * inverse(transpose(mat3(ubo_obj.model)));
+    out_material = instances[gl_InstanceIndex].material;
+    out_norm = normal;
 
-    gl_Position = 1
-        * ubo_camera.view_proj
-        * vec4(vert_pos_inv.x, -vert_pos_inv.y, vert_pos_inv.z, 1.0);
+    gl_Position = ubo_camera.view_proj * world_pos;
 }
@@ -0,0 +1,83 @@
+#include "animation.h"
+
+namespace {
+
+// The keyframes around a time in frames, and the blend between them.
+fn find_keyframes(AnimationClip const& clip, double time)
+    ->std::tuple<Keyframe const&, Keyframe const&, float> {
+  size_t const last_frame = clip.frames.size() - 1;
+  size_t const cur_frame =
+      std::min(static_cast<size_t>(std::max(time, 0.0)), last_frame);
+  size_t const next_frame = std::min(cur_frame + 1, last_frame);
+  float const blend = static_cast<float>(time - std::floor(time));
+  return {clip.frames[cur_frame], clip.frames[next_frame], blend};
+}
+
+}  // namespace
+
+fn blend_transforms(Transform const& cur, Transform const& next, float blend)
+    ->Transform {
+  // Blend along the shorter arc.
+  glm::quat next_orientation = next.orientation;
+  if (glm::dot(cur.orientation, next_orientation) < 0) {
+    next_orientation = -next_orientation;
+  }
+  return {
+      .translation = glm::mix(cur.translation, next.translation, blend),
+      .orientation = glm::normalize(
+          glm::lerp(cur.orientation, next_orientation, blend)),
+  };
+}
+
+fn sample_pose(AnimationClip const& clip, double time,
+               std::vector<Transform>& pose)->void {
+  if (clip.frames.empty()) {
+    pose.clear();
+    return;
+  }
+  auto const [cur, next, blend] = find_keyframes(clip, time);
+  pose.resize(cur.transforms.size());
+  for (size_t i = 0; i < pose.size(); i++) {
+    pose[i] = blend_transforms(cur.transforms[i], next.transforms[i], blend);
+  }
+}
+
+fn sample_joints(AnimationClip const& clip, double time,
+                 std::vector<uint32_t> const& joints,
+                 std::vector<Transform>& pose)->void {
+  if (clip.frames.empty()) {
+    pose.clear();
+    return;
+  }
+  auto const [cur, next, blend] = find_keyframes(clip, time);
+  pose.resize(cur.transforms.size());
+  for (uint32_t joint : joints) {
+    pose[joint] = blend_transforms(cur.transforms[joint],
+                                   next.transforms[joint], blend);
+  }
+}
+
+fn skinning_matrix(Transform const& joint, lava::mat4 const& inverse_bind)
+    ->lava::mat4 {
+  lava::mat4 transform = glm::mat4_cast(joint.orientation);
+  transform[3] = lava::v4(joint.translation, 1);
+  return transform * inverse_bind;
+}
+
+fn write_skinning_palette(std::vector<Transform> const& pose,
+                          std::vector<lava::mat4> const& inverse_bind,
+                          lava::mat4* palette)->void {
+  for (size_t i = 0; i < inverse_bind.size(); i++) {
+    palette[i] = i < pose.size() ? skinning_matrix(pose[i], inverse_bind[i])
+                                 : lava::mat4(1);
+  }
+}
+
+fn evaluate_pose(AnimationClip const& clip, double time,
+                 std::vector<lava::mat4> const& inverse_bind,
+                 std::vector<lava::mat4>& palette)->void {
+  thread_local std::vector<Transform> pose;
+  sample_pose(clip, time, pose);
+  palette.resize(inverse_bind.size());
+  write_skinning_palette(pose, inverse_bind, palette.data());
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "fbx_loading.h"
+#include "includes.h"
+
+// Blend the clip's global joint transforms at a time in frames. The pose is
+// resized to the joint count, so reusing it doesn't allocate.
+fn sample_pose(AnimationClip const& clip, double time,
+               std::vector<Transform>& pose)->void;
+
+// Same as sample_pose(), for the listed joints only. The others keep
+// whatever the pose held.
+fn sample_joints(AnimationClip const& clip, double time,
+                 std::vector<uint32_t> const& joints,
+                 std::vector<Transform>& pose)->void;
+
+// Translations blend linearly, and orientations by normalized lerp along the
+// shorter arc.
+fn blend_transforms(Transform const& cur, Transform const& next, float blend)
+    ->Transform;
+
+// A joint's global transform times its inverse bind matrix.
+fn skinning_matrix(Transform const& joint, lava::mat4 const& inverse_bind)
+    ->lava::mat4;
+
+// Write each joint's skinning matrix for a pose into palette, which holds
+// inverse_bind.size() matrices.
+fn write_skinning_palette(std::vector<Transform> const& pose,
+                          std::vector<lava::mat4> const& inverse_bind,
+                          lava::mat4* palette)->void;
+
+// Blend the clip's global joint transforms at a time in frames, like
+// joint_matrix() in vert.glsl, and write each joint's skinning matrix.
+fn evaluate_pose(AnimationClip const& clip, double time,
+                 std::vector<lava::mat4> const& inverse_bind,
+                 std::vector<lava::mat4>& palette)->void;
@@ -0,0 +1,80 @@
+#include "baked_asset.h"
+
+#include <fstream>
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t chunk_count;
+} AssetHeader;
+
+typedef struct {
+  uint32_t tag;
+  uint32_t size;
+} AssetChunkHeader;
+
+fn read_asset_source(std::string const& path)->std::optional<AssetSource> {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return std::nullopt;
+  }
+  AssetSource source{.size = 0, .hash = 14695981039346656037ull};
+  std::array<char, 1 << 16> block;
+  while (file.read(block.data(), block.size()) || file.gcount() > 0) {
+    size_t const count = file.gcount();
+    for (size_t i = 0; i < count; i++) {
+      source.hash ^= static_cast<unsigned char>(block[i]);
+      source.hash *= 1099511628211ull;
+    }
+    source.size += count;
+  }
+  if (file.bad()) {
+    return std::nullopt;
+  }
+  return source;
+}
+
+fn write_baked_asset(std::string const& path, BakedAsset const& asset)->bool {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  AssetHeader const header{asset_magic, asset_version,
+                           static_cast<uint32_t>(asset.chunks.size())};
+  file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+  for (auto const& chunk : asset.chunks) {
+    AssetChunkHeader const chunk_header{
+        chunk.tag, static_cast<uint32_t>(chunk.data.size())};
+    file.write(reinterpret_cast<char const*>(&chunk_header),
+               sizeof(chunk_header));
+    file.write(chunk.data.data(), chunk.data.size());
+  }
+  return file.good();
+}
+
+fn read_baked_asset(std::string const& path)->std::optional<BakedAsset> {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return std::nullopt;
+  }
+  AssetHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || header.magic != asset_magic ||
+      header.version != asset_version) {
+    return std::nullopt;
+  }
+  BakedAsset asset;
+  asset.chunks.reserve(header.chunk_count);
+  for (size_t i = 0; i < header.chunk_count; i++) {
+    AssetChunkHeader chunk_header;
+    file.read(reinterpret_cast<char*>(&chunk_header), sizeof(chunk_header));
+    AssetChunk chunk{.tag = chunk_header.tag};
+    chunk.data.resize(chunk_header.size);
+    file.read(chunk.data.data(), chunk.data.size());
+    if (!file) {
+      return std::nullopt;
+    }
+    asset.chunks.push_back(std::move(chunk));
+  }
+  return asset;
+}
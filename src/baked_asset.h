@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstring>
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+
+// Baked assets are a flat list of tagged chunks, so new data can be added
+// without breaking readers that do not know about it.
+constexpr fn make_asset_tag(char const (&name)[5])->uint32_t {
+  return static_cast<uint32_t>(name[0]) |
+         (static_cast<uint32_t>(name[1]) << 8) |
+         (static_cast<uint32_t>(name[2]) << 16) |
+         (static_cast<uint32_t>(name[3]) << 24);
+}
+
+constexpr uint32_t asset_magic = make_asset_tag("LFBX");
+constexpr uint32_t asset_version = 3;
+
+constexpr uint32_t asset_chunk_vertices = make_asset_tag("VERT");
+constexpr uint32_t asset_chunk_indices = make_asset_tag("INDX");
+constexpr uint32_t asset_chunk_meshlets = make_asset_tag("MSHL");
+constexpr uint32_t asset_chunk_meshlet_vertices = make_asset_tag("MSVT");
+constexpr uint32_t asset_chunk_meshlet_triangles = make_asset_tag("MSTR");
+constexpr uint32_t asset_chunk_meshlet_joints = make_asset_tag("MSJT");
+constexpr uint32_t asset_chunk_source = make_asset_tag("SRCE");
+
+typedef struct {
+  uint32_t tag;
+  std::vector<char> data;
+} AssetChunk;
+
+typedef struct {
+  std::vector<AssetChunk> chunks;
+} BakedAsset;
+
+// The file an asset was baked from, so a bake is only reused for the same
+// contents, whatever the file times say.
+typedef struct {
+  uint64_t size;
+  // FNV-1a of the contents.
+  uint64_t hash;
+} AssetSource;
+
+fn read_asset_source(std::string const& path)->std::optional<AssetSource>;
+
+fn write_baked_asset(std::string const& path, BakedAsset const& asset)->bool;
+
+fn read_baked_asset(std::string const& path)->std::optional<BakedAsset>;
+
+template <typename T>
+fn add_asset_chunk(BakedAsset& asset, uint32_t tag, std::vector<T> const& items)
+    ->void {
+  static_assert(std::is_trivially_copyable_v<T>);
+  AssetChunk chunk{.tag = tag};
+  chunk.data.resize(items.size() * sizeof(T));
+  std::memcpy(chunk.data.data(), items.data(), chunk.data.size());
+  asset.chunks.push_back(std::move(chunk));
+}
+
+template <typename T>
+fn get_asset_chunk(BakedAsset const& asset, uint32_t tag)
+    ->std::optional<std::vector<T>> {
+  static_assert(std::is_trivially_copyable_v<T>);
+  for (auto const& chunk : asset.chunks) {
+    if (chunk.tag == tag && chunk.data.size() % sizeof(T) == 0) {
+      std::vector<T> items(chunk.data.size() / sizeof(T));
+      std::memcpy(items.data(), chunk.data.data(), chunk.data.size());
+      return items;
+    }
+  }
+  return std::nullopt;
+}
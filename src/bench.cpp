@@ -0,0 +1,336 @@
+// Headless benchmark of the FBX loading and animation paths. Creates no
+// window and no Vulkan device.
+//
+// Usage: bench [--repetitions N] [--out results.json] [file.fbx...]
+
+#include <fbxsdk.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <liblava/lava.hpp>
+
+#include "animation.h"
+#include "cpu_skinning.h"
+#include "fbx_loading.h"
+#include "includes.h"
+#include "job_system.h"
+#include "joint_curves.h"
+
+namespace {
+
+typedef struct {
+  std::string file;
+  std::string stage;
+  // Milliseconds per repetition.
+  std::vector<double> samples;
+} BenchResult;
+
+typedef struct {
+  double min;
+  double p50;
+  double p90;
+  double p99;
+  double max;
+  double mean;
+} BenchStats;
+
+// Subframes evaluated between each pair of keyframes.
+constexpr size_t pose_subframes = 4;
+
+// Characters posed per frame in the crowd stages, each at its own time.
+constexpr size_t crowd_size = 1024;
+constexpr size_t characters_per_batch = 16;
+
+fn elapsed_ms(std::chrono::steady_clock::time_point start)->double {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Nearest-rank percentile of sorted samples.
+fn percentile(std::vector<double> const& sorted, double fraction)->double {
+  size_t const rank = std::ceil(fraction * sorted.size());
+  return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+fn compute_stats(std::vector<double> samples)->BenchStats {
+  std::sort(samples.begin(), samples.end());
+  double total = 0;
+  for (double sample : samples) {
+    total += sample;
+  }
+  return {
+      .min = samples.front(),
+      .p50 = percentile(samples, 0.5),
+      .p90 = percentile(samples, 0.9),
+      .p99 = percentile(samples, 0.99),
+      .max = samples.back(),
+      .mean = total / samples.size(),
+  };
+}
+
+fn find_result(std::vector<BenchResult>& results, std::string const& file,
+               std::string const& stage)->BenchResult& {
+  for (auto& result : results) {
+    if (result.file == file && result.stage == stage) {
+      return result;
+    }
+  }
+  results.push_back({file, stage, {}});
+  return results.back();
+}
+
+// Load a file through every stage once. Returns false if it can't be read.
+fn run_file(std::string const& path, std::vector<BenchResult>& results,
+            bool record, JobSystem& serial_jobs, JobSystem& jobs)->bool {
+  std::string const file = std::filesystem::path(path).filename().string();
+  auto add_sample = [&](char const* stage, double ms) {
+    if (record) {
+      find_result(results, file, stage).samples.push_back(ms);
+    }
+  };
+
+  FbxManager* fbx_manager = FbxManager::Create();
+  FbxIOSettings* io_settings = FbxIOSettings::Create(fbx_manager, IOSROOT);
+  fbx_manager->SetIOSettings(io_settings);
+  FbxImporter* importer = FbxImporter::Create(fbx_manager, "");
+  FbxScene* scene = FbxScene::Create(fbx_manager, "");
+
+  auto start = std::chrono::steady_clock::now();
+  if (!importer->Initialize(path.c_str(), -1,
+                            fbx_manager->GetIOSettings())) {
+    std::cout << "Failed to import " << path << std::endl;
+    fbx_manager->Destroy();
+    return false;
+  }
+  importer->Import(scene);
+  add_sample("import", elapsed_ms(start));
+  importer->Destroy();
+
+  start = std::chrono::steady_clock::now();
+  FbxPose* bind_pose = find_fbx_bind_pose(scene);
+  FbxSkeleton* root_skeleton =
+      bind_pose ? find_fbx_root_skeleton(bind_pose) : nullptr;
+  if (!root_skeleton) {
+    std::cout << "No skeleton in " << path << std::endl;
+    fbx_manager->Destroy();
+    return false;
+  }
+  std::vector<Joint> joints = read_joints(root_skeleton);
+  add_sample("skeleton", elapsed_ms(start));
+
+  FbxNode* root_node = scene->GetRootNode();
+  FbxSkin* skin = find_fbx_skin(root_node);
+  std::vector<SkinWeights> skin_weights;
+  if (skin) {
+    start = std::chrono::steady_clock::now();
+    skin_weights = read_skin_weights(
+        skin, joints, skin->GetGeometry()->GetControlPointsCount());
+    add_sample("skin_weights", elapsed_ms(start));
+  }
+
+  start = std::chrono::steady_clock::now();
+  std::optional<lava::mesh_template_data<skin_vertex>> mesh =
+      find_fbx_mesh(root_node, skin ? &skin_weights : nullptr);
+  add_sample("read_mesh", elapsed_ms(start));
+
+  start = std::chrono::steady_clock::now();
+  AnimationClip clip = sample_animation_clip(scene, joints);
+  add_sample("keyframes", elapsed_ms(start));
+
+  start = std::chrono::steady_clock::now();
+  sample_animation_clip_parallel(scene, joints, path,
+                                 std::thread::hardware_concurrency());
+  add_sample("keyframes_mt", elapsed_ms(start));
+
+  start = std::chrono::steady_clock::now();
+  std::optional<SkeletonCurves> curves = read_skeleton_curves(scene, joints);
+  if (curves) {
+    AnimationClip const curve_clip =
+        sample_animation_clip_curves(scene, *curves);
+    add_sample("keyframes_curves", elapsed_ms(start));
+    if (!record) {
+      CurveValidation const validation =
+          validate_animation_clip(curve_clip, joints, curve_clip.frames.size());
+      std::cout << file << ": curve evaluation max error "
+                << validation.max_translation_error << " units, "
+                << validation.max_rotation_error << " rad"
+                << (curve_validation_passed(validation, curve_clip)
+                        ? ""
+                        : " (over tolerance)")
+                << '\n';
+    }
+  }
+
+  std::vector<lava::mat4> inverse_bind;
+  inverse_bind.reserve(joints.size());
+  for (auto const& joint : joints) {
+    inverse_bind.push_back(glm::inverse(fbxmat_to_lavamat(joint.transform)));
+  }
+  std::vector<lava::mat4> palette;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < clip.frames.size() * pose_subframes; i++) {
+    evaluate_pose(clip, static_cast<double>(i) / pose_subframes,
+                  inverse_bind, palette);
+  }
+  add_sample("pose_eval", elapsed_ms(start));
+
+  // One frame of a crowd, sampled and skinned like update_characters().
+  std::vector<lava::mat4> crowd_palettes(crowd_size * inverse_bind.size());
+  auto pose_crowd = [&](JobSystem& crowd_jobs) {
+    parallel_for(crowd_jobs, crowd_size, characters_per_batch,
+                 [&](size_t first, size_t last) {
+                   thread_local std::vector<Transform> pose;
+                   for (size_t i = first; i < last; i++) {
+                     sample_pose(clip, std::fmod(i * 0.618, 1.0) *
+                                           clip.frames.size(),
+                                 pose);
+                     write_skinning_palette(
+                         pose, inverse_bind,
+                         &crowd_palettes[i * inverse_bind.size()]);
+                   }
+                 });
+  };
+  start = std::chrono::steady_clock::now();
+  pose_crowd(serial_jobs);
+  add_sample("crowd_1t", elapsed_ms(start));
+  start = std::chrono::steady_clock::now();
+  pose_crowd(jobs);
+  add_sample("crowd_mt", elapsed_ms(start));
+
+  // The crowd's first character skinned on the CPU by every kernel this
+  // machine runs, checked against the scalar kernel.
+  if (mesh && skin) {
+    SkinningInput const skinning_input = build_skinning_input(mesh->vertices);
+    size_t const vertex_count = skinning_input.vertex_count;
+    std::vector<lava::v3> reference_positions(vertex_count);
+    std::vector<lava::v3> reference_normals(vertex_count);
+    skin_vertices(serial_jobs, skinning_input, crowd_palettes.data(),
+                  SkinningKernel::scalar, reference_positions.data(),
+                  reference_normals.data());
+    std::vector<lava::v3> positions(vertex_count);
+    std::vector<lava::v3> normals(vertex_count);
+    for (SkinningKernel kernel :
+         {SkinningKernel::scalar, SkinningKernel::sse4, SkinningKernel::avx2}) {
+      if (!skinning_kernel_supported(kernel)) {
+        continue;
+      }
+      std::string const stage =
+          std::string("skin_") + skinning_kernel_name(kernel);
+      start = std::chrono::steady_clock::now();
+      skin_vertices(jobs, skinning_input, crowd_palettes.data(), kernel,
+                    positions.data(), normals.data());
+      add_sample(stage.c_str(), elapsed_ms(start));
+      if (!record) {
+        float max_error = 0;
+        for (size_t i = 0; i < vertex_count; i++) {
+          max_error = std::max(
+              max_error, glm::distance(positions[i], reference_positions[i]));
+        }
+        std::cout << file << ": " << stage << " max error " << max_error
+                  << " units over " << vertex_count << " vertices\n";
+      }
+    }
+  }
+
+  fbx_manager->Destroy();
+  return mesh.has_value();
+}
+
+fn write_json(std::string const& path,
+              std::vector<BenchResult> const& results, size_t repetitions)
+    ->bool {
+  std::ofstream file(path);
+  file << std::fixed << std::setprecision(4);
+  file << "{\n  \"repetitions\": " << repetitions << ",\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    BenchStats const stats = compute_stats(results[i].samples);
+    file << (i ? ",\n" : "\n") << "    {\"file\": \"" << results[i].file
+         << "\", \"stage\": \"" << results[i].stage
+         << "\", \"ms\": {\"min\": " << stats.min << ", \"p50\": " << stats.p50
+         << ", \"p90\": " << stats.p90 << ", \"p99\": " << stats.p99
+         << ", \"max\": " << stats.max << ", \"mean\": " << stats.mean
+         << "}}";
+  }
+  file << "\n  ]\n}\n";
+  return static_cast<bool>(file);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t repetitions = 10;
+  std::string out_path = "bench.json";
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    std::string const arg = argv[i];
+    if (arg == "--repetitions" && i + 1 < argc) {
+      repetitions = std::max(std::stoi(argv[++i]), 1);
+    } else if (arg == "--out" && i + 1 < argc) {
+      out_path = argv[++i];
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (paths.empty()) {
+    for (char const* name : {"Idle", "Run", "Walk", "Jump"}) {
+      paths.push_back(std::string(BENCH_RES_DIR) + "/" + name + ".fbx");
+    }
+  }
+
+  // No workers, so every job runs on the calling thread.
+  JobSystem serial_jobs;
+  start_job_system(serial_jobs, 0);
+  JobSystem jobs;
+  start_job_system(jobs,
+                   std::max(std::thread::hardware_concurrency(), 2u) - 1);
+
+  std::vector<BenchResult> results;
+  for (auto const& path : paths) {
+    // The first pass warms the file cache and the SDK's allocators.
+    if (!run_file(path, results, false, serial_jobs, jobs)) {
+      continue;
+    }
+    for (size_t i = 0; i < repetitions; i++) {
+      run_file(path, results, true, serial_jobs, jobs);
+    }
+  }
+  stop_job_system(jobs);
+  stop_job_system(serial_jobs);
+  if (results.empty()) {
+    return 1;
+  }
+
+  std::cout << std::left << std::setw(12) << "file" << std::setw(18)
+            << "stage" << std::right << std::setw(10) << "p50 ms"
+            << std::setw(10) << "p90 ms" << std::setw(10) << "max ms" << '\n'
+            << std::fixed << std::setprecision(3);
+  for (auto const& result : results) {
+    BenchStats const stats = compute_stats(result.samples);
+    std::cout << std::left << std::setw(12) << result.file << std::setw(18)
+              << result.stage << std::right << std::setw(10) << stats.p50
+              << std::setw(10) << stats.p90 << std::setw(10) << stats.max
+              << '\n';
+  }
+  for (auto const& result : results) {
+    if (result.stage != "keyframes_curves") {
+      continue;
+    }
+    double const curves_ms = compute_stats(result.samples).p50;
+    double const sdk_ms =
+        compute_stats(find_result(results, result.file, "keyframes").samples)
+            .p50;
+    std::cout << result.file << ": curve evaluation is " << sdk_ms / curves_ms
+              << "x faster than the SDK's evaluator\n";
+  }
+  if (!write_json(out_path, results, repetitions)) {
+    std::cout << "Failed to write " << out_path << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << out_path << '\n';
+  return 0;
+}
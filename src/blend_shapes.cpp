@@ -0,0 +1,172 @@
+#include "blend_shapes.h"
+
+#include <numeric>
+
+#include "trace.h"
+
+namespace {
+
+fn read_normal(FbxGeometryElementNormal const *normals, int control_point)
+    ->lava::v3 {
+  if (!normals ||
+      normals->GetMappingMode() != FbxGeometryElement::eByControlPoint) {
+    return lava::v3(0);
+  }
+  int const index =
+      normals->GetReferenceMode() == FbxGeometryElement::eDirect
+          ? control_point
+          : normals->GetIndexArray().GetAt(control_point);
+  FbxVector4 const normal = normals->GetDirectArray().GetAt(index);
+  return lava::v3(normal[0], normal[1], normal[2]);
+}
+
+fn read_channel(FbxMesh *mesh, FbxBlendShapeChannel *channel)
+    ->MorphChannel {
+  MorphChannel output{channel->GetName(), {}};
+  int const target_count = channel->GetTargetShapeCount();
+  if (target_count == 0) {
+    return output;
+  }
+  FbxShape *target = channel->GetTargetShape(target_count - 1);
+  int const count =
+      std::min(mesh->GetControlPointsCount(), target->GetControlPointsCount());
+  FbxVector4 const *base_points = mesh->GetControlPoints();
+  FbxVector4 const *target_points = target->GetControlPoints();
+  FbxGeometryElementNormal const *base_normals = mesh->GetElementNormal();
+  FbxGeometryElementNormal const *target_normals = target->GetElementNormal();
+  for (int i = 0; i < count; i++) {
+    lava::v3 const position(target_points[i][0] - base_points[i][0],
+                            target_points[i][1] - base_points[i][1],
+                            target_points[i][2] - base_points[i][2]);
+    // Targets without normals keep the base normals.
+    lava::v3 const normal =
+        target_normals ? read_normal(target_normals, i) -
+                             read_normal(base_normals, i)
+                       : lava::v3(0);
+    if (glm::length(position) > min_morph_delta ||
+        glm::length(normal) > min_morph_delta) {
+      output.deltas.push_back(
+          {static_cast<uint32_t>(i), position, normal});
+    }
+  }
+  return output;
+}
+
+}  // namespace
+
+fn read_morph_set(FbxScene *scene, FbxMesh *mesh, AnimationClip const &clip)
+    ->MorphSet {
+  TRACE_SCOPE("read_morph_set");
+  MorphSet set{};
+  FbxAnimStack *anim_stack = scene->GetCurrentAnimationStack();
+  FbxAnimLayer *layer = anim_stack && anim_stack->GetMemberCount<FbxAnimLayer>()
+                            ? anim_stack->GetMember<FbxAnimLayer>(0)
+                            : nullptr;
+  // Weight curves per channel, or null with the static weight instead.
+  std::vector<FbxAnimCurve *> curves;
+  std::vector<double> static_weights;
+  std::vector<double> full_weights;
+  int const blend_shape_count =
+      mesh->GetDeformerCount(FbxDeformer::eBlendShape);
+  for (int i = 0; i < blend_shape_count; i++) {
+    auto *blend_shape = static_cast<FbxBlendShape *>(
+        mesh->GetDeformer(i, FbxDeformer::eBlendShape));
+    for (int j = 0; j < blend_shape->GetBlendShapeChannelCount(); j++) {
+      FbxBlendShapeChannel *channel = blend_shape->GetBlendShapeChannel(j);
+      set.channels.push_back(read_channel(mesh, channel));
+      curves.push_back(layer ? mesh->GetShapeChannel(i, j, layer) : nullptr);
+      static_weights.push_back(channel->DeformPercent.Get());
+      int const target_count = channel->GetTargetShapeCount();
+      full_weights.push_back(
+          target_count > 0
+              ? channel->GetTargetShapeFullWeights()[target_count - 1]
+              : 100.0);
+    }
+  }
+
+  size_t const channel_count = set.channels.size();
+  set.weights.resize(clip.frames.size() * channel_count);
+  std::vector<bool> active(channel_count, false);
+  FbxTime time;
+  for (size_t frame = 0; frame < clip.frames.size(); frame++) {
+    time.SetFrame(clip.frames[frame].time, clip_frame_rate);
+    for (size_t c = 0; c < channel_count; c++) {
+      double const percent =
+          curves[c] ? curves[c]->Evaluate(time) : static_weights[c];
+      float const weight = static_cast<float>(
+          full_weights[c] > 0 ? percent / full_weights[c] : 0);
+      set.weights[frame * channel_count + c] = weight;
+      active[c] = active[c] || weight != 0;
+    }
+  }
+  size_t delta_count = 0;
+  for (uint32_t c = 0; c < channel_count; c++) {
+    if (active[c] && !set.channels[c].deltas.empty()) {
+      set.active_channels.push_back(c);
+    }
+    delta_count += set.channels[c].deltas.size();
+  }
+  std::cout << "Blend shapes: " << channel_count << " channels, "
+            << set.active_channels.size() << " animated, " << delta_count
+            << " deltas, "
+            << delta_count * sizeof(MorphDelta) / 1024 << " KiB\n";
+  return set;
+}
+
+fn build_gpu_morph_targets(MorphSet const &set,
+                           std::vector<skin_vertex> const &vertices)
+    ->GpuMorphTargets {
+  TRACE_SCOPE("build_gpu_morph_targets");
+  // Group the deltas by control point.
+  uint32_t control_point_count = 0;
+  for (auto const &vertex : vertices) {
+    control_point_count =
+        std::max(control_point_count, vertex.control_point + 1);
+  }
+  std::vector<uint32_t> offsets(control_point_count + 1, 0);
+  for (auto const &channel : set.channels) {
+    for (auto const &delta : channel.deltas) {
+      if (delta.control_point < control_point_count) {
+        offsets[delta.control_point + 1]++;
+      }
+    }
+  }
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+  GpuMorphTargets targets{};
+  targets.deltas.resize(offsets.back());
+  std::vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+  for (uint32_t c = 0; c < set.channels.size(); c++) {
+    for (auto const &delta : set.channels[c].deltas) {
+      if (delta.control_point < control_point_count) {
+        targets.deltas[filled[delta.control_point]++] = {
+            delta.position, c, delta.normal, 0};
+      }
+    }
+  }
+  targets.ranges.reserve(vertices.size());
+  for (auto const &vertex : vertices) {
+    targets.ranges.push_back(
+        {offsets[vertex.control_point],
+         offsets[vertex.control_point + 1] - offsets[vertex.control_point]});
+  }
+  return targets;
+}
+
+fn sample_morph_weights(MorphSet const &set, double time, float *weights)
+    ->void {
+  size_t const channel_count = set.channels.size();
+  if (channel_count == 0 || set.weights.empty()) {
+    return;
+  }
+  size_t const last_frame = set.weights.size() / channel_count - 1;
+  size_t const cur_frame =
+      std::min(static_cast<size_t>(std::max(time, 0.0)), last_frame);
+  size_t const next_frame = std::min(cur_frame + 1, last_frame);
+  float const blend = static_cast<float>(time - std::floor(time));
+  float const *cur = &set.weights[cur_frame * channel_count];
+  float const *next = &set.weights[next_frame * channel_count];
+  for (uint32_t c : set.active_channels) {
+    weights[c] = cur[c] + (next[c] - cur[c]) * blend;
+  }
+}
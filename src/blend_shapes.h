@@ -0,0 +1,71 @@
+#pragma once
+
+#include <fbxsdk.h>
+
+#include "fbx_loading.h"
+#include "includes.h"
+
+// Offsets smaller than this are left out of a channel's deltas.
+constexpr float min_morph_delta = 1e-5f;
+
+// One control point's offset from the base mesh at a channel's full weight.
+typedef struct {
+  uint32_t control_point;
+  lava::v3 position;
+  lava::v3 normal;
+} MorphDelta;
+
+// A blend shape channel, stored sparsely: only the control points its
+// target moves.
+typedef struct {
+  std::string name;
+  std::vector<MorphDelta> deltas;
+} MorphChannel;
+
+typedef struct {
+  std::vector<MorphChannel> channels;
+  // Channel weights from 0 to 1 at every keyframe of the clip, frame by
+  // frame.
+  std::vector<float> weights;
+  // Channels with a nonzero weight at any frame. Only these are sampled.
+  std::vector<uint32_t> active_channels;
+} MorphSet;
+
+// Matches MorphDelta in vert.glsl (std430). The channel indexes an
+// instance's weights.
+typedef struct {
+  lava::v3 position;
+  uint32_t channel;
+  lava::v3 normal;
+  float padding;
+} GpuMorphDelta;
+
+// Matches MorphRange in vert.glsl (std430): the deltas of one vertex.
+typedef struct {
+  uint32_t first;
+  uint32_t count;
+} MorphRange;
+
+typedef struct {
+  // One per vertex. Vertices read from the same control point share their
+  // deltas.
+  std::vector<MorphRange> ranges;
+  std::vector<GpuMorphDelta> deltas;
+} GpuMorphTargets;
+
+// Read the blend shape channels deforming a mesh, and bake their weights
+// at the clip's keyframe times. Only the full-weight target of a channel is
+// read, so in-between targets blend linearly instead.
+fn read_morph_set(FbxScene *scene, FbxMesh *mesh, AnimationClip const &clip)
+    ->MorphSet;
+
+// Lay the channels out per vertex, for vertices that are already welded,
+// reordered and packed.
+fn build_gpu_morph_targets(MorphSet const &set,
+                           std::vector<skin_vertex> const &vertices)
+    ->GpuMorphTargets;
+
+// Blend the active channels' weights at a time in frames into weights,
+// which holds a weight per channel.
+fn sample_morph_weights(MorphSet const &set, double time, float *weights)
+    ->void;
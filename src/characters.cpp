@@ -0,0 +1,353 @@
+#include "characters.h"
+
+#include "animation.h"
+#include "root_motion.h"
+#include "trace.h"
+
+namespace {
+
+// A character due for sampling, but not yet sampled this frame.
+typedef struct {
+  uint32_t character;
+  uint64_t frames_overdue;
+  float distance;
+} DueCharacter;
+
+fn lod_joints_of(CharacterFrame const& frame, Character const& character)
+    ->AnimationLodJoints const* {
+  if (!frame.lod_joints || frame.lod_joints->empty()) {
+    return nullptr;
+  }
+  return &(*frame.lod_joints)[std::min<size_t>(
+      character.lod, frame.lod_joints->size() - 1)];
+}
+
+// Distance to the camera in multiples of the character's bounding radius,
+// where the character stood last frame.
+fn relative_distance(CharacterFrame const& frame, InstanceData instance,
+                     Character const& character)->float {
+  instance.model = character.model;
+  lava::v4 const sphere = instance_sphere(instance, character.pose_bounds);
+  return glm::distance(lava::v3(sphere), frame.camera_position) /
+         std::max(sphere.w, 1e-3f);
+}
+
+fn select_update_interval(CharacterFrame const& frame, float distance,
+                          bool visible)->uint32_t {
+  if (!frame.animation_tiers || frame.animation_tiers->empty()) {
+    return 1;
+  }
+  std::vector<AnimationLodTier> const& tiers = *frame.animation_tiers;
+  // Characters out of view only need their bounds, to come back into it.
+  AnimationLodTier const* tier = &tiers.back();
+  if (visible) {
+    tier = &*std::find_if(
+        tiers.begin(), tiers.end() - 1, [&](AnimationLodTier const& t) {
+          return distance <= t.max_distance;
+        });
+  }
+  return std::max(tier->update_interval, 1u);
+}
+
+// How far the shown pose is from from_pose to to_pose.
+fn blend_fraction(Character const& character, uint64_t frame_index)->float {
+  return std::min(
+      static_cast<float>(frame_index - character.last_update_frame + 1) /
+          character.update_interval,
+      1.0f);
+}
+
+// The character's clip time in frames, some frames from now.
+fn character_time(CharacterFrame const& frame, Character const& character,
+                  double ahead)->double {
+  double const frame_count = frame.clip->frames.size();
+  return frame_count > 0
+             ? std::fmod(frame.time + character.phase + ahead, frame_count)
+             : 0;
+}
+
+// Where a joint rigidly attached to a parent joint ends up.
+fn attach_transform(Transform const& parent, Transform const& attach)
+    ->Transform {
+  return {
+      .translation =
+          parent.translation + parent.orientation * attach.translation,
+      .orientation = glm::normalize(parent.orientation * attach.orientation),
+  };
+}
+
+// Sample the pose at the end of the character's update interval into
+// to_pose and to_bounds.
+fn sample_character(CharacterFrame const& frame, Character& character,
+                    std::vector<Transform>& pose)->void {
+  double const time = character_time(
+      frame, character, frame.time_step * (character.update_interval - 1));
+  AnimationLodJoints const* lod_joints = lod_joints_of(frame, character);
+  if (frame.retarget) {
+    // Every source joint may drive a kept joint, so the whole source pose
+    // is sampled. Reused across characters, so only a thread's first
+    // sample allocates.
+    thread_local std::vector<Transform> source_pose;
+    sample_pose(*frame.clip, time, source_pose);
+    retarget_pose(*frame.retarget, source_pose, pose);
+  } else if (!lod_joints) {
+    sample_pose(*frame.clip, time, pose);
+  } else {
+    sample_joints(*frame.clip, time, lod_joints->sampled, pose);
+  }
+  if (!lod_joints) {
+    character.to_bounds = compute_pose_bounds(*frame.joint_bounds, pose);
+  } else {
+    // Kept joints are all sampled, so dropped joints follow sampled ones.
+    size_t const count = std::min(
+        {lod_joints->joint_remap.size(), lod_joints->attach.size(),
+         pose.size()});
+    for (size_t joint = 0; joint < count; joint++) {
+      int const kept = lod_joints->joint_remap[joint];
+      if (kept >= 0 && static_cast<size_t>(kept) != joint) {
+        pose[joint] =
+            attach_transform(pose[kept], lod_joints->attach[joint]);
+      }
+    }
+    character.to_bounds = compute_pose_bounds(lod_joints->bounds, pose);
+  }
+  // Doesn't allocate once the character has been sampled.
+  character.to_pose.assign(pose.begin(), pose.end());
+  if (is_empty(character.to_bounds)) {
+    LodChain const& chain = *frame.lod_chain;
+    character.to_bounds = {chain.center - lava::v3(chain.radius),
+                           chain.center + lava::v3(chain.radius)};
+  }
+}
+
+fn update_character(CharacterFrame const& frame, InstanceData instance,
+                    Character& character, bool sample,
+                    std::vector<Transform>& pose, lava::mat4* palette,
+                    float* morph_weights)->void {
+  double const time = character_time(frame, character, 0);
+  if (frame.morph_set && morph_weights) {
+    sample_morph_weights(*frame.morph_set, time, morph_weights);
+  }
+  if (frame.root_motion && character.posed) {
+    character.root_motion = combine_root_motion(
+        character.root_motion,
+        root_motion_between(*frame.clip, character.clip_time, time));
+  }
+  character.clip_time = time;
+  if (frame.root_motion) {
+    instance.model *= root_motion_matrix(character.root_motion);
+  }
+  character.model = instance.model;
+
+  if (sample) {
+    if (!character.posed) {
+      sample_character(frame, character, pose);
+      character.from_pose = character.to_pose;
+      character.pose_bounds = character.to_bounds;
+    } else {
+      // Blend on from whatever is shown now.
+      float const shown = blend_fraction(character, frame.frame_index);
+      size_t const blended =
+          std::min(character.from_pose.size(), character.to_pose.size());
+      for (size_t i = 0; i < blended; i++) {
+        character.from_pose[i] = blend_transforms(
+            character.from_pose[i], character.to_pose[i], shown);
+      }
+      Aabb const from_bounds =
+          shown < 1 ? character.pose_bounds : character.to_bounds;
+      sample_character(frame, character, pose);
+      character.pose_bounds = merge_aabb(from_bounds, character.to_bounds);
+      character.last_update_frame = frame.frame_index;
+    }
+    character.posed = true;
+    character.palette_settled = 0;
+  }
+
+  uint32_t const copy_bit = 1u << frame.palette_copy;
+  if (character.posed && !(character.palette_settled & copy_bit)) {
+    float const blend = blend_fraction(character, frame.frame_index);
+    if (blend >= 1) {
+      write_skinning_palette(character.to_pose, *frame.inverse_bind, palette);
+      character.palette_settled |= copy_bit;
+    } else {
+      // The sample is done with, so the pose holds the blend.
+      pose.resize(character.to_pose.size());
+      for (size_t i = 0; i < pose.size(); i++) {
+        pose[i] = i < character.from_pose.size()
+                      ? blend_transforms(character.from_pose[i],
+                                         character.to_pose[i], blend)
+                      : character.to_pose[i];
+      }
+      write_skinning_palette(pose, *frame.inverse_bind, palette);
+    }
+  }
+
+  lava::v4 const sphere = instance_sphere(instance, character.pose_bounds);
+  character.visible =
+      sphere_in_frustum(frame.frustum, lava::v3(sphere), sphere.w);
+  if (!character.visible) {
+    return;
+  }
+  character.lod =
+      frame.forced_lod >= 0
+          ? std::min<size_t>(frame.forced_lod,
+                             frame.lod_chain->lods.size() - 1)
+          : select_lod(*frame.lod_chain, instance.model,
+                       frame.camera_position, frame.fov_y_degrees,
+                       frame.lod_bias);
+}
+
+// Pick the characters to sample this frame, and set their intervals.
+fn schedule_characters(CharacterFrame const& frame,
+                       std::vector<InstanceData> const& instances,
+                       std::vector<Character>& characters, size_t count,
+                       std::vector<uint8_t>& scheduled)->AnimationLodStats {
+  TRACE_SCOPE("schedule_characters");
+  AnimationLodStats stats{};
+  scheduled.assign(count, false);
+  auto joint_cost = [&](Character const& character) {
+    AnimationLodJoints const* lod_joints = lod_joints_of(frame, character);
+    return lod_joints ? lod_joints->sampled.size()
+                      : frame.inverse_bind->size();
+  };
+
+  uint32_t const longest_interval =
+      frame.animation_tiers && !frame.animation_tiers->empty()
+          ? std::max(frame.animation_tiers->back().update_interval, 1u)
+          : 1;
+
+  // Reused across frames, so scheduling doesn't allocate.
+  thread_local std::vector<DueCharacter> due;
+  due.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    Character& character = characters[i];
+    if (!character.posed) {
+      // Backdate the first sample by a different amount per character, so
+      // characters sharing an interval don't all come due on one frame.
+      character.update_interval = 1;
+      character.last_update_frame = frame.frame_index - i % longest_interval;
+      scheduled[i] = true;
+      stats.characters_sampled++;
+      stats.joints_sampled += joint_cost(character);
+      continue;
+    }
+    float const distance =
+        relative_distance(frame, instances[i], character);
+    uint32_t const interval =
+        select_update_interval(frame, distance, character.visible);
+    uint64_t const elapsed = frame.frame_index - character.last_update_frame;
+    if (elapsed >= interval) {
+      due.push_back({i, elapsed - interval, distance});
+    }
+  }
+  std::sort(due.begin(), due.end(),
+            [](DueCharacter const& a, DueCharacter const& b) {
+              if (a.frames_overdue != b.frames_overdue) {
+                return a.frames_overdue > b.frames_overdue;
+              }
+              return a.distance < b.distance;
+            });
+
+  for (DueCharacter const& candidate : due) {
+    Character& character = characters[candidate.character];
+    size_t const cost = joint_cost(character);
+    if (frame.joint_budget > 0 &&
+        stats.joints_sampled + cost > frame.joint_budget) {
+      stats.characters_deferred++;
+      continue;
+    }
+    character.update_interval = select_update_interval(
+        frame, candidate.distance, character.visible);
+    scheduled[candidate.character] = true;
+    stats.characters_sampled++;
+    stats.joints_sampled += cost;
+  }
+  return stats;
+}
+
+}  // namespace
+
+fn make_characters(size_t count, double clip_duration)
+    ->std::vector<Character> {
+  std::vector<Character> characters(count);
+  for (size_t i = 0; i < count; i++) {
+    // Golden ratio steps spread phases evenly for any count.
+    double const fraction = std::fmod(i * 0.6180339887, 1.0);
+    characters[i].phase = fraction * clip_duration;
+  }
+  return characters;
+}
+
+fn build_animation_lod_joints(LodChain const& chain,
+                              std::vector<JointBounds> const& joint_bounds,
+                              std::vector<lava::mat4> const& inverse_bind)
+    ->std::vector<AnimationLodJoints> {
+  std::vector<AnimationLodJoints> lod_joints;
+  for (auto const& lod : chain.lods) {
+    AnimationLodJoints joints{
+        .joint_remap = lod.joint_remap,
+        .attach = std::vector<Transform>(lod.joint_remap.size()),
+        .bounds = joint_bounds,
+    };
+    size_t const count = std::min(
+        {joints.joint_remap.size(), joint_bounds.size(), inverse_bind.size()});
+    for (size_t joint = 0; joint < count; joint++) {
+      int const kept = joints.joint_remap[joint];
+      if (kept < 0 || static_cast<size_t>(kept) == joint) {
+        joints.sampled.push_back(joint);
+        continue;
+      }
+      // Skinned by the kept joint's matrix, the dropped joint's vertices
+      // stay where its bind pose puts them relative to the kept joint.
+      lava::mat4 const attach =
+          inverse_bind[kept] * glm::inverse(inverse_bind[joint]);
+      joints.attach[joint] = {
+          .translation = lava::v3(attach[3]),
+          .orientation = glm::normalize(glm::quat_cast(lava::mat3(attach))),
+      };
+      joints.bounds[joint].influenced = false;
+      if (!joint_bounds[joint].influenced) {
+        continue;
+      }
+      Aabb const box = transform_aabb(joint_bounds[joint].box, attach);
+      JointBounds& kept_bounds = joints.bounds[kept];
+      kept_bounds.box = kept_bounds.influenced
+                            ? merge_aabb(kept_bounds.box, box)
+                            : box;
+      kept_bounds.influenced = true;
+    }
+    lod_joints.push_back(std::move(joints));
+  }
+  return lod_joints;
+}
+
+fn update_characters(JobSystem& jobs, CharacterFrame const& frame,
+                     std::vector<InstanceData> const& instances,
+                     std::vector<Character>& characters, size_t count,
+                     lava::mat4* palettes, float* morph_weights)
+    ->AnimationLodStats {
+  TRACE_SCOPE("update_characters");
+  size_t const joint_count = frame.inverse_bind->size();
+  size_t const channel_count =
+      frame.morph_set ? frame.morph_set->channels.size() : 0;
+  count = std::min({count, characters.size(), instances.size()});
+  // Reused across frames, like the per-thread scratch below. The jobs read
+  // it through a reference, since a thread_local names each worker's own.
+  thread_local std::vector<uint8_t> scheduled_scratch;
+  std::vector<uint8_t>& scheduled = scheduled_scratch;
+  AnimationLodStats const stats =
+      schedule_characters(frame, instances, characters, count, scheduled);
+  parallel_for(jobs, count, characters_per_job, [&](size_t first,
+                                                    size_t last) {
+    TRACE_SCOPE("update character batch");
+    // Reused across batches, so a thread only allocates on its first one.
+    thread_local std::vector<Transform> pose;
+    for (size_t i = first; i < last; i++) {
+      update_character(frame, instances[i], characters[i], scheduled[i], pose,
+                       palettes + i * joint_count,
+                       morph_weights ? morph_weights + i * channel_count
+                                     : nullptr);
+    }
+  });
+  return stats;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "blend_shapes.h"
+#include "culling.h"
+#include "fbx_loading.h"
+#include "gpu_culling.h"
+#include "includes.h"
+#include "job_system.h"
+#include "mesh_lod.h"
+#include "retargeting.h"
+
+// Characters updated per job. Large enough to amortize queueing, small
+// enough to balance across threads.
+constexpr size_t characters_per_job = 16;
+
+// Characters at most max_distance away, in multiples of their bounding
+// radius, are sampled every update_interval frames.
+typedef struct {
+  float max_distance;
+  uint32_t update_interval;
+} AnimationLodTier;
+
+inline std::vector<AnimationLodTier> const default_animation_lod_tiers = {
+    {12.0f, 1},
+    {30.0f, 2},
+    {60.0f, 4},
+    {std::numeric_limits<float>::max(), 8},
+};
+
+// Joints sampled at one mesh LOD: those its reduced skeleton keeps. The
+// others take their kept ancestor's skinning matrix, as the LOD's skin
+// weights already do.
+typedef struct {
+  std::vector<uint32_t> sampled;
+  std::vector<int> joint_remap;
+  // Each dropped joint's bind transform relative to its kept joint, which
+  // it follows rigidly, so it gets the same skinning matrix.
+  std::vector<Transform> attach;
+  // Bounds of each kept joint, grown by the dropped joints it stands in for.
+  // Dropped joints are marked uninfluenced.
+  std::vector<JointBounds> bounds;
+} AnimationLodJoints;
+
+// Animation and visibility of one crowd instance.
+typedef struct {
+  // Offset into the clip in frames, so the crowd isn't in lockstep.
+  double phase;
+  // Model-space bounds of the current pose.
+  Aabb pose_bounds;
+  bool visible;
+  uint32_t lod;
+  // Sampled at least once.
+  bool posed;
+  uint64_t last_update_frame;
+  uint32_t update_interval;
+  // Shown poses blend joint by joint from the pose shown at the last update
+  // to the one sampled for the end of the interval, and the palette is
+  // built from the blend.
+  std::vector<Transform> from_pose;
+  std::vector<Transform> to_pose;
+  Aabb to_bounds;
+  // Bit per palette buffer copy already holding to_pose's palette, once it
+  // is the shown pose.
+  uint32_t palette_settled;
+  // Clip time in frames at the last update, after the phase.
+  double clip_time;
+  // Root motion gathered since the character spawned.
+  RootMotion root_motion;
+  // The instance's model matrix moved by the root motion.
+  lava::mat4 model;
+} Character;
+
+// Inputs shared by every character this frame.
+typedef struct {
+  AnimationClip const* clip;
+  std::vector<lava::mat4> const* inverse_bind;
+  std::vector<JointBounds> const* joint_bounds;
+  LodChain const* lod_chain;
+  // Clip time in frames, before each character's phase.
+  double time;
+  Frustum frustum;
+  lava::v3 camera_position;
+  float fov_y_degrees;
+  float lod_bias;
+  // A LOD for every character, or -1 to select by screen size.
+  int forced_lod;
+  // Animation LOD. Without tiers, every character is sampled every frame,
+  // and without joints, every joint is sampled.
+  std::vector<AnimationLodTier> const* animation_tiers;
+  std::vector<AnimationLodJoints> const* lod_joints;
+  // Most joints sampled in a frame, or 0 for no limit. Characters that
+  // were never sampled are exempt.
+  size_t joint_budget;
+  uint64_t frame_index;
+  // Clip frames advanced since the last frame.
+  double time_step;
+  // Move characters by the clip's root motion.
+  bool root_motion;
+  // Blend shape weights to sample, or null.
+  MorphSet const* morph_set;
+  // Maps the clip's skeleton onto the character's, or null where they are
+  // the same skeleton.
+  RetargetMap const* retarget;
+  // Which copy of the palette buffer this frame writes, below 32.
+  uint32_t palette_copy;
+} CharacterFrame;
+
+typedef struct {
+  size_t characters_sampled;
+  size_t joints_sampled;
+  // Characters due for sampling but pushed past the joint budget.
+  size_t characters_deferred;
+} AnimationLodStats;
+
+// The first character has no phase offset, so it follows the clip time.
+fn make_characters(size_t count, double clip_duration)
+    ->std::vector<Character>;
+
+// The joints to sample at each LOD of the chain.
+fn build_animation_lod_joints(LodChain const& chain,
+                              std::vector<JointBounds> const& joint_bounds,
+                              std::vector<lava::mat4> const& inverse_bind)
+    ->std::vector<AnimationLodJoints>;
+
+// Schedule, sample, blend, skin, bound and cull the first count characters
+// on the job system. Palettes receive inverse_bind->size() matrices per
+// character, in instance order, and morph_weights a weight per blend shape
+// channel. Models are the instances' model matrices moved by root motion.
+// The clip's transforms are already global,
+// so there is no hierarchy pass.
+//
+// Characters due for sampling are picked most overdue first, then nearest
+// first, until the joint budget runs out. The rest blend towards their last
+// sample, and stay due.
+fn update_characters(JobSystem& jobs, CharacterFrame const& frame,
+                     std::vector<InstanceData> const& instances,
+                     std::vector<Character>& characters, size_t count,
+                     lava::mat4* palettes, float* morph_weights)
+    ->AnimationLodStats;
@@ -0,0 +1,311 @@
+#include "cpu_skinning.h"
+
+#include "trace.h"
+
+// The SIMD kernels are compiled for their instruction sets function by
+// function, and picked at run time, so the build needs no -mavx2.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_SKINNING_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+typedef void (*SkinBlockFn)(SkinningBlock const& block, float const* palette,
+                            size_t count, lava::v3* positions,
+                            lava::v3* normals);
+
+// Palettes are column-major mat4s: column c, row r at palette[c * 4 + r].
+constexpr size_t floats_per_matrix = 16;
+
+fn skin_block_scalar(SkinningBlock const& block, float const* palette,
+                     size_t count, lava::v3* positions, lava::v3* normals)
+    ->void {
+  for (size_t lane = 0; lane < count; lane++) {
+    lava::v3 const position(block.position[0][lane],
+                            block.position[1][lane],
+                            block.position[2][lane]);
+    lava::v3 const normal(block.normal[0][lane], block.normal[1][lane],
+                          block.normal[2][lane]);
+    // The top three rows of the blended matrix, column by column.
+    std::array<lava::v3, 4> skin{};
+    float total_weight = 0;
+    for (size_t i = 0; i < 4; i++) {
+      float const weight = block.weights[i][lane];
+      if (weight <= 0) {
+        continue;
+      }
+      float const* joint =
+          palette + block.joints[i][lane] * floats_per_matrix;
+      for (size_t column = 0; column < 4; column++) {
+        skin[column] += weight * lava::v3(joint[column * 4],
+                                          joint[column * 4 + 1],
+                                          joint[column * 4 + 2]);
+      }
+      total_weight += weight;
+    }
+    if (total_weight <= 0) {
+      positions[lane] = position;
+      normals[lane] = glm::normalize(normal);
+      continue;
+    }
+    positions[lane] = (skin[0] * position.x + skin[1] * position.y +
+                       skin[2] * position.z + skin[3]) /
+                      total_weight;
+    // The total weight only scales the normal, which is normalized anyway.
+    normals[lane] = glm::normalize(skin[0] * normal.x + skin[1] * normal.y +
+                                   skin[2] * normal.z);
+  }
+}
+
+#ifdef CPU_SKINNING_X86
+
+// One vertex at a time, with a blended matrix column per register. SSE4.1
+// adds the dot product used to normalize.
+__attribute__((target("sse4.1"))) fn skin_block_sse4(
+    SkinningBlock const& block, float const* palette, size_t count,
+    lava::v3* positions, lava::v3* normals)->void {
+  for (size_t lane = 0; lane < count; lane++) {
+    __m128 skin[4] = {};
+    float total_weight = 0;
+    for (size_t i = 0; i < 4; i++) {
+      float const weight = block.weights[i][lane];
+      if (weight <= 0) {
+        continue;
+      }
+      float const* joint =
+          palette + block.joints[i][lane] * floats_per_matrix;
+      __m128 const weights = _mm_set1_ps(weight);
+      for (size_t column = 0; column < 4; column++) {
+        skin[column] = _mm_add_ps(
+            skin[column],
+            _mm_mul_ps(weights, _mm_loadu_ps(joint + column * 4)));
+      }
+      total_weight += weight;
+    }
+    __m128 const x = _mm_set1_ps(block.position[0][lane]);
+    __m128 const y = _mm_set1_ps(block.position[1][lane]);
+    __m128 const z = _mm_set1_ps(block.position[2][lane]);
+    __m128 const normal_x = _mm_set1_ps(block.normal[0][lane]);
+    __m128 const normal_y = _mm_set1_ps(block.normal[1][lane]);
+    __m128 const normal_z = _mm_set1_ps(block.normal[2][lane]);
+    __m128 position;
+    __m128 normal;
+    if (total_weight <= 0) {
+      position = _mm_setr_ps(block.position[0][lane],
+                             block.position[1][lane],
+                             block.position[2][lane], 0);
+      normal = _mm_setr_ps(block.normal[0][lane], block.normal[1][lane],
+                           block.normal[2][lane], 0);
+    } else {
+      position = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(skin[0], x), _mm_mul_ps(skin[1], y)),
+          _mm_add_ps(_mm_mul_ps(skin[2], z), skin[3]));
+      position = _mm_div_ps(position, _mm_set1_ps(total_weight));
+      normal = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(skin[0], normal_x),
+                     _mm_mul_ps(skin[1], normal_y)),
+          _mm_mul_ps(skin[2], normal_z));
+    }
+    // Dot product of x, y and z, broadcast to every element.
+    __m128 const length = _mm_sqrt_ps(_mm_dp_ps(normal, normal, 0x7f));
+    normal = _mm_div_ps(normal, length);
+
+    alignas(16) std::array<float, 4> stored_position;
+    alignas(16) std::array<float, 4> stored_normal;
+    _mm_store_ps(stored_position.data(), position);
+    _mm_store_ps(stored_normal.data(), normal);
+    positions[lane] = lava::v3(stored_position[0], stored_position[1],
+                               stored_position[2]);
+    normals[lane] =
+        lava::v3(stored_normal[0], stored_normal[1], stored_normal[2]);
+  }
+}
+
+// Eight vertices at a time, one per lane, with each blended matrix element
+// gathered from the lanes' joints.
+__attribute__((target("avx2,fma"))) fn skin_block_avx2(
+    SkinningBlock const& block, float const* palette, size_t count,
+    lava::v3* positions, lava::v3* normals)->void {
+  __m256 const zero = _mm256_setzero_ps();
+  // The top three rows of the blended matrices, column by column.
+  __m256 skin[12];
+  std::fill(std::begin(skin), std::end(skin), zero);
+  __m256 total_weight = zero;
+  for (size_t i = 0; i < 4; i++) {
+    __m256 const weight =
+        _mm256_max_ps(_mm256_load_ps(block.weights[i].data()), zero);
+    // Influences are sorted strongest first, so later ones are often
+    // unused by the whole block.
+    if (_mm256_movemask_ps(_mm256_cmp_ps(weight, zero, _CMP_GT_OQ)) == 0) {
+      continue;
+    }
+    __m256i const offsets = _mm256_slli_epi32(
+        _mm256_load_si256(
+            reinterpret_cast<__m256i const*>(block.joints[i].data())),
+        4);
+    for (size_t column = 0; column < 4; column++) {
+      for (size_t row = 0; row < 3; row++) {
+        __m256 const element =
+            _mm256_i32gather_ps(palette + column * 4 + row, offsets, 4);
+        skin[column * 3 + row] =
+            _mm256_fmadd_ps(weight, element, skin[column * 3 + row]);
+      }
+    }
+    total_weight = _mm256_add_ps(total_weight, weight);
+  }
+
+  __m256 const weighted = _mm256_cmp_ps(total_weight, zero, _CMP_GT_OQ);
+  // Clamped so unweighted lanes divide by something, for blendv to drop.
+  __m256 const inverse_weight = _mm256_div_ps(
+      _mm256_set1_ps(1), _mm256_max_ps(total_weight, _mm256_set1_ps(1e-30f)));
+  __m256 const position[3] = {
+      _mm256_load_ps(block.position[0].data()),
+      _mm256_load_ps(block.position[1].data()),
+      _mm256_load_ps(block.position[2].data()),
+  };
+  __m256 const normal[3] = {
+      _mm256_load_ps(block.normal[0].data()),
+      _mm256_load_ps(block.normal[1].data()),
+      _mm256_load_ps(block.normal[2].data()),
+  };
+  alignas(32) std::array<std::array<float, skinning_block_size>, 3>
+      skinned_position;
+  alignas(32) std::array<std::array<float, skinning_block_size>, 3>
+      skinned_normal;
+  __m256 rotated[3];
+  for (size_t row = 0; row < 3; row++) {
+    __m256 const rotated_position = _mm256_fmadd_ps(
+        skin[row], position[0],
+        _mm256_fmadd_ps(skin[3 + row], position[1],
+                        _mm256_mul_ps(skin[6 + row], position[2])));
+    __m256 const moved = _mm256_mul_ps(
+        _mm256_add_ps(rotated_position, skin[9 + row]), inverse_weight);
+    _mm256_store_ps(skinned_position[row].data(),
+                    _mm256_blendv_ps(position[row], moved, weighted));
+    rotated[row] = _mm256_blendv_ps(
+        normal[row],
+        _mm256_fmadd_ps(
+            skin[row], normal[0],
+            _mm256_fmadd_ps(skin[3 + row], normal[1],
+                            _mm256_mul_ps(skin[6 + row], normal[2]))),
+        weighted);
+  }
+  __m256 const length = _mm256_sqrt_ps(_mm256_fmadd_ps(
+      rotated[0], rotated[0],
+      _mm256_fmadd_ps(rotated[1], rotated[1],
+                      _mm256_mul_ps(rotated[2], rotated[2]))));
+  for (size_t row = 0; row < 3; row++) {
+    _mm256_store_ps(skinned_normal[row].data(),
+                    _mm256_div_ps(rotated[row], length));
+  }
+
+  for (size_t lane = 0; lane < count; lane++) {
+    positions[lane] =
+        lava::v3(skinned_position[0][lane], skinned_position[1][lane],
+                 skinned_position[2][lane]);
+    normals[lane] = lava::v3(skinned_normal[0][lane], skinned_normal[1][lane],
+                             skinned_normal[2][lane]);
+  }
+}
+
+#endif
+
+fn select_block_fn(SkinningKernel kernel)->SkinBlockFn {
+  if (!skinning_kernel_supported(kernel)) {
+    return skin_block_scalar;
+  }
+  switch (kernel) {
+#ifdef CPU_SKINNING_X86
+    case SkinningKernel::sse4:
+      return skin_block_sse4;
+    case SkinningKernel::avx2:
+      return skin_block_avx2;
+#endif
+    default:
+      return skin_block_scalar;
+  }
+}
+
+}  // namespace
+
+fn build_skinning_input(std::vector<skin_vertex> const& vertices)
+    ->SkinningInput {
+  TRACE_SCOPE("build_skinning_input");
+  SkinningInput input{
+      .blocks = std::vector<SkinningBlock>(
+          (vertices.size() + skinning_block_size - 1) / skinning_block_size),
+      .vertex_count = vertices.size(),
+  };
+  for (size_t i = 0; i < vertices.size(); i++) {
+    skin_vertex const& vertex = vertices[i];
+    SkinningBlock& block = input.blocks[i / skinning_block_size];
+    size_t const lane = i % skinning_block_size;
+    for (size_t axis = 0; axis < 3; axis++) {
+      block.position[axis][lane] = vertex.position[axis];
+      block.normal[axis][lane] = vertex.normal[axis];
+    }
+    for (size_t influence = 0; influence < 4; influence++) {
+      float const weight = vertex.bone_weights[influence];
+      block.weights[influence][lane] = std::max(weight, 0.0f);
+      block.joints[influence][lane] =
+          weight > 0 ? vertex.weight_indices[influence] : 0;
+    }
+  }
+  return input;
+}
+
+fn skinning_kernel_supported(SkinningKernel kernel)->bool {
+  switch (kernel) {
+    case SkinningKernel::scalar:
+      return true;
+#ifdef CPU_SKINNING_X86
+    case SkinningKernel::sse4:
+      return __builtin_cpu_supports("sse4.1");
+    case SkinningKernel::avx2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    default:
+      return false;
+  }
+}
+
+fn best_skinning_kernel()->SkinningKernel {
+  for (SkinningKernel kernel : {SkinningKernel::avx2, SkinningKernel::sse4}) {
+    if (skinning_kernel_supported(kernel)) {
+      return kernel;
+    }
+  }
+  return SkinningKernel::scalar;
+}
+
+fn skinning_kernel_name(SkinningKernel kernel)->char const* {
+  switch (kernel) {
+    case SkinningKernel::sse4:
+      return "sse4";
+    case SkinningKernel::avx2:
+      return "avx2";
+    default:
+      return "scalar";
+  }
+}
+
+fn skin_vertices(JobSystem& jobs, SkinningInput const& input,
+                 lava::mat4 const* palette, SkinningKernel kernel,
+                 lava::v3* positions, lava::v3* normals)->void {
+  TRACE_SCOPE("skin_vertices");
+  SkinBlockFn const skin_block = select_block_fn(kernel);
+  float const* palette_floats = reinterpret_cast<float const*>(palette);
+  parallel_for(
+      jobs, input.blocks.size(), skinning_blocks_per_job,
+      [&](size_t first, size_t last) {
+        TRACE_SCOPE("skin vertex blocks");
+        for (size_t i = first; i < last; i++) {
+          size_t const offset = i * skinning_block_size;
+          size_t const count =
+              std::min(skinning_block_size, input.vertex_count - offset);
+          skin_block(input.blocks[i], palette_floats, count,
+                     positions + offset, normals + offset);
+        }
+      });
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "fbx_loading.h"
+#include "includes.h"
+#include "job_system.h"
+
+// Vertices skinned together, one per SIMD lane.
+constexpr size_t skinning_block_size = 8;
+// Blocks skinned per job.
+constexpr size_t skinning_blocks_per_job = 64;
+
+enum class SkinningKernel { scalar, sse4, avx2 };
+
+// The skinning inputs of skinning_block_size vertices, attribute by
+// attribute, so kernels load a lane's worth of each with one instruction.
+// Padding lanes have no weights.
+typedef struct alignas(32) {
+  std::array<std::array<float, skinning_block_size>, 3> position;
+  std::array<std::array<float, skinning_block_size>, 3> normal;
+  std::array<std::array<uint32_t, skinning_block_size>, 4> joints;
+  std::array<std::array<float, skinning_block_size>, 4> weights;
+} SkinningBlock;
+
+typedef struct {
+  std::vector<SkinningBlock> blocks;
+  size_t vertex_count;
+} SkinningInput;
+
+// Repack extracted vertices into blocks, once per mesh. Joints of
+// influences without weight are set to 0, so kernels can read them safely.
+fn build_skinning_input(std::vector<skin_vertex> const& vertices)
+    ->SkinningInput;
+
+// The fastest kernel this CPU runs.
+fn best_skinning_kernel()->SkinningKernel;
+
+fn skinning_kernel_supported(SkinningKernel kernel)->bool;
+
+fn skinning_kernel_name(SkinningKernel kernel)->char const*;
+
+// Skin every vertex by a palette of skinning matrices, like the linear path
+// of vert.glsl: up to four influences, renormalized, and vertices without
+// weights left in the bind pose. Blend shapes aren't applied. Normals come
+// out normalized. positions and normals hold input.vertex_count each.
+fn skin_vertices(JobSystem& jobs, SkinningInput const& input,
+                 lava::mat4 const* palette, SkinningKernel kernel,
+                 lava::v3* positions, lava::v3* normals)->void;
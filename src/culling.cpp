@@ -0,0 +1,113 @@
+#include "culling.h"
+
+fn extract_frustum(lava::mat4 const& view_proj)->Frustum {
+  // GLM matrices are column-major, so gather rows first.
+  std::array<lava::v4, 4> rows;
+  for (size_t i = 0; i < 4; i++) {
+    rows[i] = lava::v4(view_proj[0][i], view_proj[1][i], view_proj[2][i],
+                       view_proj[3][i]);
+  }
+  Frustum frustum{{
+      rows[3] + rows[0],
+      rows[3] - rows[0],
+      rows[3] + rows[1],
+      rows[3] - rows[1],
+      rows[2],
+      rows[3] - rows[2],
+  }};
+  for (auto& plane : frustum.planes) {
+    plane /= glm::length(lava::v3(plane));
+  }
+  return frustum;
+}
+
+fn sphere_in_frustum(Frustum const& frustum, lava::v3 center, float radius)
+    ->bool {
+  for (auto const& plane : frustum.planes) {
+    if (glm::dot(lava::v3(plane), center) + plane.w < -radius) {
+      return false;
+    }
+  }
+  return true;
+}
+
+fn aabb_in_frustum(Frustum const& frustum, Aabb const& box)->bool {
+  lava::v3 const center = (box.min + box.max) * 0.5f;
+  lava::v3 const extent = (box.max - box.min) * 0.5f;
+  for (auto const& plane : frustum.planes) {
+    float const radius = extent.x * std::abs(plane.x) +
+                         extent.y * std::abs(plane.y) +
+                         extent.z * std::abs(plane.z);
+    if (glm::dot(lava::v3(plane), center) + plane.w < -radius) {
+      return false;
+    }
+  }
+  return true;
+}
+
+fn empty_aabb()->Aabb {
+  return {lava::v3(std::numeric_limits<float>::max()),
+          lava::v3(std::numeric_limits<float>::lowest())};
+}
+
+fn is_empty(Aabb const& box)->bool {
+  return box.min.x > box.max.x;
+}
+
+fn merge_aabb(Aabb const& a, Aabb const& b)->Aabb {
+  return {glm::min(a.min, b.min), glm::max(a.max, b.max)};
+}
+
+fn transform_aabb(Aabb const& box, lava::mat4 const& transform)->Aabb {
+  if (is_empty(box)) {
+    return box;
+  }
+  lava::v3 const center = (box.min + box.max) * 0.5f;
+  lava::v3 const extent = (box.max - box.min) * 0.5f;
+  lava::v3 const new_center = lava::v3(transform * lava::v4(center, 1));
+  lava::v3 new_extent(0);
+  for (size_t i = 0; i < 3; i++) {
+    for (size_t j = 0; j < 3; j++) {
+      new_extent[i] += std::abs(transform[j][i]) * extent[j];
+    }
+  }
+  return {new_center - new_extent, new_center + new_extent};
+}
+
+fn compute_joint_bounds(lava::mesh_template_data<skin_vertex> const& data,
+                        std::vector<lava::mat4> const& inverse_bind_mats,
+                        float min_weight)
+    ->std::vector<JointBounds> {
+  std::vector<JointBounds> bounds(
+      inverse_bind_mats.size(),
+      JointBounds{.box = empty_aabb(), .influenced = false});
+  for (auto const& vertex : data.vertices) {
+    for (size_t i = 0; i < 4; i++) {
+      std::uint32_t const joint = vertex.weight_indices[i];
+      if (vertex.bone_weights[i] < min_weight || joint >= bounds.size()) {
+        continue;
+      }
+      lava::v3 const position =
+          lava::v3(inverse_bind_mats[joint] * lava::v4(vertex.position, 1));
+      bounds[joint].box.min = glm::min(bounds[joint].box.min, position);
+      bounds[joint].box.max = glm::max(bounds[joint].box.max, position);
+      bounds[joint].influenced = true;
+    }
+  }
+  return bounds;
+}
+
+fn compute_pose_bounds(std::vector<JointBounds> const& joint_bounds,
+                       std::vector<Transform> const& pose)->Aabb {
+  Aabb bounds = empty_aabb();
+  size_t const count = std::min(joint_bounds.size(), pose.size());
+  for (size_t i = 0; i < count; i++) {
+    if (!joint_bounds[i].influenced) {
+      continue;
+    }
+    lava::mat4 transform = glm::mat4_cast(pose[i].orientation);
+    transform[3] = lava::v4(pose[i].translation, 1);
+    bounds = merge_aabb(bounds, transform_aabb(joint_bounds[i].box, transform));
+  }
+  return bounds;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "fbx_loading.h"
+#include "includes.h"
+
+// Plane normals point into the frustum: left, right, bottom, top, near, far.
+typedef struct {
+  std::array<lava::v4, 6> planes;
+} Frustum;
+
+typedef struct {
+  lava::v3 min;
+  lava::v3 max;
+} Aabb;
+
+// Bounds of the vertices a joint influences, in the joint's bind space.
+typedef struct {
+  Aabb box;
+  bool influenced;
+} JointBounds;
+
+// Extract world-space planes from a Vulkan (zero-to-one depth) view-proj.
+fn extract_frustum(lava::mat4 const& view_proj)->Frustum;
+
+fn sphere_in_frustum(Frustum const& frustum, lava::v3 center, float radius)
+    ->bool;
+
+fn aabb_in_frustum(Frustum const& frustum, Aabb const& box)->bool;
+
+fn empty_aabb()->Aabb;
+
+fn is_empty(Aabb const& box)->bool;
+
+fn merge_aabb(Aabb const& a, Aabb const& b)->Aabb;
+
+fn transform_aabb(Aabb const& box, lava::mat4 const& transform)->Aabb;
+
+// Bound every vertex with at least min_weight influence from each joint.
+fn compute_joint_bounds(lava::mesh_template_data<skin_vertex> const& data,
+                        std::vector<lava::mat4> const& inverse_bind_mats,
+                        float min_weight = 0.01f)
+    ->std::vector<JointBounds>;
+
+// Model-space bounds of the skinned mesh in the given pose of global joint
+// transforms.
+fn compute_pose_bounds(std::vector<JointBounds> const& joint_bounds,
+                       std::vector<Transform> const& pose)
+    ->Aabb;
@@ -1,7 +1,35 @@
 #include "fbx_loading.h"
 
+#include <atomic>
+#include <thread>
+
+#include "trace.h"
+
 using fbxsdk::FbxNode;
 
+namespace {
+
+// Frames a thread must have to be worth importing another scene for.
+constexpr size_t min_frames_per_thread = 32;
+
+// Evaluate the clip's frames in [first, last) on the calling thread.
+fn sample_frames(std::vector<Joint> const &joints, AnimationClip &anim_clip,
+                 size_t first, size_t last)->void {
+  FbxTime real_time;
+  for (size_t i = first; i < last; i++) {
+    Keyframe &keyframe = anim_clip.frames[i];
+    real_time.SetFrame(keyframe.time, clip_frame_rate);
+    for (size_t j = 0; j < joints.size(); j++) {
+      lava::mat4 current_matrix = fbxmat_to_lavamat(
+          joints[j].node->EvaluateGlobalTransform(real_time));
+      keyframe.transforms[j] = Transform{lava::v3(current_matrix[3]),
+                                         glm::quat_cast(current_matrix)};
+    }
+  }
+}
+
+}  // namespace
+
 fn read_uv(FbxMesh *mesh, int texture_uv_index)->lava::v2 {
   auto uv = lava::v2();
   FbxGeometryElementUV *vertex_uv = mesh->GetElementUV();
@@ -10,7 +38,60 @@ fn read_uv(FbxMesh *mesh, int texture_uv_index)->lava::v2 {
   return uv;
 }
 
-fn read_mesh(FbxNode *node)->lava::mesh_template_data<skin_vertex> {
+fn read_skin_weights(FbxSkin *skin, std::vector<Joint> const &joints,
+                     size_t control_point_count)
+    ->std::vector<SkinWeights> {
+  TRACE_SCOPE("read_skin_weights");
+  // Every (joint, weight) pair influencing each control point.
+  std::vector<std::vector<std::pair<std::uint32_t, float>>> influences(
+      control_point_count);
+  for (size_t i = 0; i < skin->GetClusterCount(); i++) {
+    FbxCluster *cluster = skin->GetCluster(i);
+    auto joint = std::find_if(joints.begin(), joints.end(),
+                              [&](Joint const &joint) {
+                                return joint.node == cluster->GetLink();
+                              });
+    if (joint == joints.end()) {
+      continue;
+    }
+    std::uint32_t joint_index = joint - joints.begin();
+    int *control_points = cluster->GetControlPointIndices();
+    double *weights = cluster->GetControlPointWeights();
+    for (size_t j = 0; j < cluster->GetControlPointIndicesCount(); j++) {
+      if (control_points[j] >= 0 && control_points[j] < control_point_count) {
+        influences[control_points[j]].push_back(
+            {joint_index, static_cast<float>(weights[j])});
+      }
+    }
+  }
+
+  std::vector<SkinWeights> output(control_point_count,
+                                  SkinWeights{{0, 0, 0, 0}, {0, 0, 0, 0}});
+  for (size_t i = 0; i < control_point_count; i++) {
+    auto &point_influences = influences[i];
+    size_t const count = std::min<size_t>(point_influences.size(), 4);
+    std::partial_sort(
+        point_influences.begin(), point_influences.begin() + count,
+        point_influences.end(),
+        [](auto const &a, auto const &b) { return a.second > b.second; });
+    float weight_sum = 0;
+    for (size_t j = 0; j < count; j++) {
+      weight_sum += point_influences[j].second;
+    }
+    if (weight_sum <= 0) {
+      continue;
+    }
+    for (size_t j = 0; j < count; j++) {
+      output[i].joint_indices[j] = point_influences[j].first;
+      output[i].weights[j] = point_influences[j].second / weight_sum;
+    }
+  }
+  return output;
+}
+
+fn read_mesh(FbxNode *node, std::vector<SkinWeights> const *skin_weights)
+    ->lava::mesh_template_data<skin_vertex> {
+  TRACE_SCOPE("read_mesh");
   lava::mesh_template_data<skin_vertex> output;
   FbxMesh *mesh = node->GetMesh();
   size_t tri_count = mesh->GetPolygonCount();
@@ -39,10 +120,16 @@ fn read_mesh(FbxNode *node)->lava::mesh_template_data<skin_vertex> {
                       mesh->GetElementNormal()->GetDirectArray().GetAt(
                           ctrl_index)[2]),
               },
-          // TODO: deserialize weight
           .weight_indices = {0, 0, 0, 0},
           .bone_weights = {0, 0, 0, 0},
+          .control_point = static_cast<std::uint32_t>(ctrl_index),
       });
+      if (skin_weights && ctrl_index < skin_weights->size()) {
+        output.vertices.back().weight_indices =
+            (*skin_weights)[ctrl_index].joint_indices;
+        output.vertices.back().bone_weights =
+            (*skin_weights)[ctrl_index].weights;
+      }
 
       // Mirror UVs.
       output.vertices[output.vertices.size() - 1].uv =
@@ -53,16 +140,16 @@ fn read_mesh(FbxNode *node)->lava::mesh_template_data<skin_vertex> {
   return output;
 }
 
-fn find_fbx_mesh(FbxNode *node)
+fn find_fbx_mesh(FbxNode *node, std::vector<SkinWeights> const *skin_weights)
     ->std::optional<lava::mesh_template_data<skin_vertex>> {
   FbxNodeAttribute *attribute = node->GetNodeAttribute();
   if (attribute != nullptr) {
     if (attribute->GetAttributeType() == FbxNodeAttribute::eMesh) {
-      return read_mesh(node);
+      return read_mesh(node, skin_weights);
     }
   }
   for (size_t i = 0; i < node->GetChildCount(); i++) {
-    auto maybe_mesh = find_fbx_mesh(node->GetChild(i));
+    auto maybe_mesh = find_fbx_mesh(node->GetChild(i), skin_weights);
     if (maybe_mesh.has_value()) {
       return maybe_mesh;
     }
@@ -70,6 +157,21 @@ fn find_fbx_mesh(FbxNode *node)
   return std::nullopt;
 }
 
+fn find_fbx_mesh_node(FbxNode *node)->FbxNode * {
+  FbxNodeAttribute *attribute = node->GetNodeAttribute();
+  if (attribute != nullptr &&
+      attribute->GetAttributeType() == FbxNodeAttribute::eMesh) {
+    return node;
+  }
+  for (size_t i = 0; i < node->GetChildCount(); i++) {
+    FbxNode *mesh_node = find_fbx_mesh_node(node->GetChild(i));
+    if (mesh_node != nullptr) {
+      return mesh_node;
+    }
+  }
+  return nullptr;
+}
+
 fn find_fbx_skin(FbxNode *node)->FbxSkin * {
   FbxNodeAttribute *attribute = node->GetNodeAttribute();
   if (attribute != nullptr) {
@@ -105,6 +207,144 @@ void find_fbx_poses(FbxNode *node, std::vector<FbxPose *> *poses)
   }
 }
 
+fn find_fbx_bind_pose(FbxScene *scene)->FbxPose * {
+  for (int i = 0; i < scene->GetPoseCount(); i++) {
+    FbxPose *pose = scene->GetPose(i);
+    if (pose->IsBindPose()) {
+      return pose;
+    }
+  }
+  return nullptr;
+}
+
+fn find_fbx_root_skeleton(FbxPose *bind_pose)->FbxSkeleton * {
+  FbxSkeleton *root_skeleton = nullptr;
+  for (int i = 0; i < bind_pose->GetCount(); i++) {
+    FbxSkeleton *skeleton = bind_pose->GetNode(i)->GetSkeleton();
+    if (skeleton && skeleton->IsSkeletonRoot()) {
+      root_skeleton = skeleton;
+    }
+  }
+  return root_skeleton;
+}
+
+fn read_joints(FbxSkeleton *root_skeleton)->std::vector<Joint> {
+  TRACE_SCOPE("read_joints");
+  std::vector<Joint> joints;
+  auto make_joint = [&](FbxNode *node, int index) -> Joint {
+    return Joint{.node = node,
+                 .parent_index = index,
+                 .transform = node->EvaluateGlobalTransform()};
+  };
+  std::function<void(FbxNode *, int)> add_children = [&](FbxNode *parent,
+                                                         int parent_index) {
+    for (int i = 0; i < parent->GetChildCount(); i++) {
+      FbxNode *child = parent->GetChild(i);
+      if (child && child->GetNodeAttribute() &&
+          child->GetNodeAttribute()->GetAttributeType() ==
+              FbxNodeAttribute::eSkeleton) {
+        joints.push_back(make_joint(child, parent_index));
+        add_children(child, joints.size() - 1);
+      }
+    }
+  };
+  joints.push_back(make_joint(root_skeleton->GetNode(), -1));
+  add_children(joints[0].node, 0);
+  return joints;
+}
+
+fn allocate_animation_clip(FbxScene *scene, size_t joint_count)
+    ->AnimationClip {
+  FbxAnimStack *anim_stack = scene->GetCurrentAnimationStack();
+  FbxTimeSpan time_span = anim_stack->GetLocalTimeSpan();
+  AnimationClip anim_clip{};
+  anim_clip.duration = time_span.GetDuration().GetFrameCount(clip_frame_rate);
+  // Start at 1, because 0 is the bind pose frame.
+  size_t const frame_count =
+      anim_clip.duration > 1 ? static_cast<size_t>(anim_clip.duration) - 1 : 0;
+  anim_clip.frames.resize(frame_count);
+  for (size_t i = 0; i < frame_count; i++) {
+    anim_clip.frames[i].time = i + 1;
+    anim_clip.frames[i].transforms.resize(joint_count);
+  }
+  return anim_clip;
+}
+
+fn sample_animation_clip(FbxScene *scene, std::vector<Joint> const &joints)
+    ->AnimationClip {
+  TRACE_SCOPE("sample_animation_clip");
+  AnimationClip anim_clip = allocate_animation_clip(scene, joints.size());
+  sample_frames(joints, anim_clip, 0, anim_clip.frames.size());
+  return anim_clip;
+}
+
+fn sample_animation_clip_parallel(FbxScene *scene,
+                                  std::vector<Joint> const &joints,
+                                  std::string const &path,
+                                  size_t thread_count)->AnimationClip {
+  TRACE_SCOPE("sample_animation_clip_parallel");
+  AnimationClip anim_clip = allocate_animation_clip(scene, joints.size());
+  size_t const frame_count = anim_clip.frames.size();
+  thread_count = std::clamp<size_t>(
+      std::min(thread_count, frame_count / min_frames_per_thread), 1,
+      std::max<size_t>(frame_count, 1));
+  auto range_start = [&](size_t thread) {
+    return frame_count * thread / thread_count;
+  };
+
+  // Evaluation caches results in the scene's nodes, so a scene can only be
+  // evaluated by one thread. Every other thread imports its own copy.
+  std::vector<std::thread> threads;
+  std::atomic<bool> failed = false;
+  for (size_t thread = 1; thread < thread_count; thread++) {
+    threads.emplace_back([&, thread]() {
+      set_trace_thread_name("keyframe baking");
+      FbxManager *manager = FbxManager::Create();
+      manager->SetIOSettings(FbxIOSettings::Create(manager, IOSROOT));
+      FbxImporter *importer = FbxImporter::Create(manager, "");
+      FbxScene *thread_scene = FbxScene::Create(manager, "");
+      FbxPose *bind_pose = nullptr;
+      {
+        TRACE_SCOPE("import scene copy");
+        if (importer->Initialize(path.c_str(), -1,
+                                 manager->GetIOSettings()) &&
+            importer->Import(thread_scene)) {
+          bind_pose = find_fbx_bind_pose(thread_scene);
+        }
+      }
+      importer->Destroy();
+      FbxSkeleton *root_skeleton =
+          bind_pose ? find_fbx_root_skeleton(bind_pose) : nullptr;
+      // The same file yields the same joint order.
+      std::vector<Joint> thread_joints;
+      if (root_skeleton) {
+        thread_joints = read_joints(root_skeleton);
+      }
+      if (thread_joints.size() == joints.size()) {
+        TRACE_SCOPE("sample frames");
+        sample_frames(thread_joints, anim_clip, range_start(thread),
+                      range_start(thread + 1));
+      } else {
+        failed = true;
+      }
+      manager->Destroy();
+    });
+  }
+  {
+    TRACE_SCOPE("sample frames");
+    sample_frames(joints, anim_clip, 0, range_start(1));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  if (failed) {
+    std::cout << "Failed to bake keyframes in parallel, retrying serially."
+              << std::endl;
+    sample_frames(joints, anim_clip, range_start(1), frame_count);
+  }
+  return anim_clip;
+}
+
 fn fbxvec_to_glmvec(FbxVector4 vec)->glm::vec3 {
   return glm::vec3(
       static_cast<glm::vec4>(*reinterpret_cast<glm::dvec4 *>(&vec)));
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <fbxsdk.h>
 
 #include <liblava/lava.hpp>
@@ -11,17 +13,14 @@ typedef struct {
   lava::v3 normal;
   std::array<std::uint32_t, 4> weight_indices;
   lava::v4 bone_weights;
+  // The FBX control point the vertex was read from, so per-control-point
+  // data such as blend shapes follows it through welding and reordering.
+  // Not a vertex attribute.
+  std::uint32_t control_point;
 } skin_vertex;
 
 fn read_uv(FbxMesh *mesh, int texture_uv_index)->lava::v2;
 
-fn read_mesh(FbxNode *node)->lava::mesh_template_data<skin_vertex>;
-
-fn find_fbx_mesh(FbxNode *node)
-    ->std::optional<lava::mesh_template_data<skin_vertex>>;
-
-fn find_fbx_skin(FbxNode *node)->FbxSkin *;
-
 // TODO: Is the matrix here redundant?
 typedef struct {
   FbxNode *node;
@@ -29,6 +28,29 @@ typedef struct {
   FbxAMatrix transform;
 } Joint;
 
+// The four strongest joint influences on a control point, normalized.
+typedef struct {
+  std::array<std::uint32_t, 4> joint_indices;
+  lava::v4 weights;
+} SkinWeights;
+
+fn read_skin_weights(FbxSkin *skin, std::vector<Joint> const &joints,
+                     size_t control_point_count)
+    ->std::vector<SkinWeights>;
+
+fn read_mesh(FbxNode *node,
+             std::vector<SkinWeights> const *skin_weights = nullptr)
+    ->lava::mesh_template_data<skin_vertex>;
+
+fn find_fbx_mesh(FbxNode *node,
+                 std::vector<SkinWeights> const *skin_weights = nullptr)
+    ->std::optional<lava::mesh_template_data<skin_vertex>>;
+
+// The first node with a mesh attribute, depth first.
+fn find_fbx_mesh_node(FbxNode *node)->FbxNode *;
+
+fn find_fbx_skin(FbxNode *node)->FbxSkin *;
+
 typedef struct {
   lava::v3 translation;
   alignas(16) glm::quat orientation;
@@ -39,13 +61,52 @@ typedef struct {
   std::vector<Transform> transforms;
 } Keyframe;
 
+// A translation on the ground plane, then a turn about the up axis.
+typedef struct {
+  lava::v3 translation;
+  float yaw;
+} RootMotion;
+
 typedef struct {
   double duration;
   std::vector<Keyframe> frames;
+  // Motion of the root into each frame from the one before, in the heading
+  // of the one before. Empty until extract_root_motion(), and the first
+  // frame's is zero.
+  std::vector<RootMotion> root_motion;
 } AnimationClip;
 
 void find_fbx_poses(FbxNode *node, std::vector<FbxPose *> *poses);
 
+fn find_fbx_bind_pose(FbxScene *scene)->FbxPose *;
+
+fn find_fbx_root_skeleton(FbxPose *bind_pose)->FbxSkeleton *;
+
+// Every skeleton node under the root, depth first, so parents come before
+// their children.
+fn read_joints(FbxSkeleton *root_skeleton)->std::vector<Joint>;
+
+constexpr auto clip_frame_rate = FbxTime::EMode::eFrames24;
+
+// Size a clip for the current animation stack, so its frames can be written
+// in place.
+fn allocate_animation_clip(FbxScene *scene, size_t joint_count)
+    ->AnimationClip;
+
+// Global joint transforms at every frame of the current animation stack,
+// at 24 fps. Frame 0 is the bind pose, so sampling starts at 1.
+fn sample_animation_clip(FbxScene *scene, std::vector<Joint> const &joints)
+    ->AnimationClip;
+
+// Same as sample_animation_clip(), with the frames split into contiguous
+// ranges across threads. Threads past the first import their own copy of
+// the file at path, so this only pays off on long clips; short clips use
+// fewer threads.
+fn sample_animation_clip_parallel(FbxScene *scene,
+                                  std::vector<Joint> const &joints,
+                                  std::string const &path,
+                                  size_t thread_count)->AnimationClip;
+
 fn fbxvec_to_glmvec(FbxVector4 vec)->glm::vec3;
 
 fn fbxmat_to_lavamat(FbxAMatrix mat)->lava::mat4;
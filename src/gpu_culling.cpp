@@ -0,0 +1,52 @@
+#include "gpu_culling.h"
+
+fn make_crowd_instances(size_t count, float spacing)
+    ->std::vector<InstanceData> {
+  std::vector<InstanceData> instances;
+  instances.reserve(count);
+  size_t const side = std::ceil(std::sqrt(static_cast<float>(count)));
+  for (size_t i = 0; i < count; i++) {
+    // Walk outwards from the center, alternating sides.
+    auto offset = [](size_t n) {
+      return (n % 2 == 0 ? 1.0f : -1.0f) * static_cast<float>((n + 1) / 2);
+    };
+    lava::mat4 model(1);
+    model[3] = lava::v4(offset(i % side) * spacing, 0,
+                        -offset(i / side) * spacing, 1);
+    instances.push_back({model, 0, {}, lava::v4(0)});
+  }
+  return instances;
+}
+
+fn pose_sphere(Aabb const& pose_bounds)->lava::v4 {
+  return lava::v4((pose_bounds.min + pose_bounds.max) * 0.5f,
+                  glm::length(pose_bounds.max - pose_bounds.min) * 0.5f);
+}
+
+fn instance_sphere(InstanceData const& instance, Aabb const& pose_bounds)
+    ->lava::v4 {
+  lava::v4 const sphere = pose_sphere(pose_bounds);
+  lava::v3 center = lava::v3(instance.model * lava::v4(lava::v3(sphere), 1));
+  center.y = -center.y;
+  float const scale =
+      std::max({glm::length(lava::v3(instance.model[0])),
+                glm::length(lava::v3(instance.model[1])),
+                glm::length(lava::v3(instance.model[2]))});
+  return lava::v4(center, sphere.w * scale);
+}
+
+fn add_gpu_culling_features(lava::device::create_param& param)->bool {
+  VkPhysicalDeviceFeatures supported;
+  vkGetPhysicalDeviceFeatures(param.physical_device->get(), &supported);
+  if (!supported.multiDrawIndirect ||
+      !param.physical_device->supported(
+          VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+    std::cout << "Multi-draw indirect is unsupported, so characters are "
+                 "culled and drawn on the CPU."
+              << std::endl;
+    return false;
+  }
+  param.features.multiDrawIndirect = VK_TRUE;
+  param.extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+  return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "culling.h"
+#include "includes.h"
+
+constexpr size_t max_instances = 4096;
+
+// Matches Instance in vert.glsl and instance_cull.comp (std430).
+typedef struct {
+  lava::mat4 model;
+  // Index into the material buffer.
+  uint32_t material;
+  std::array<uint32_t, 3> padding;
+  // Model-space bounds of the instance's current pose: xyz center, w
+  // radius.
+  lava::v4 pose_sphere;
+} InstanceData;
+
+// Matches Ubo_InstanceCull in instance_cull.comp (std140).
+typedef struct {
+  std::array<lava::v4, 6> frustum_planes;
+  lava::v4 camera_pos;
+  uint32_t instance_count;
+  uint32_t lod_count;
+  // 1 / tan(fov_y / 2), scaled by the LOD bias.
+  float lod_scale;
+  int32_t forced_lod;
+} InstanceCullData;
+
+// A visible instance and its LOD, when culling on the CPU.
+typedef struct {
+  uint32_t instance;
+  uint32_t lod;
+} InstanceDraw;
+
+// Lay instances out on a square grid around the origin, starting with the
+// origin itself.
+fn make_crowd_instances(size_t count, float spacing)
+    ->std::vector<InstanceData>;
+
+// Model-space bounding sphere of a pose, as stored in InstanceData.
+fn pose_sphere(Aabb const& pose_bounds)->lava::v4;
+
+// World-space (y-flipped, see vert.glsl) bounding sphere of an instance.
+fn instance_sphere(InstanceData const& instance, Aabb const& pose_bounds)
+    ->lava::v4;
+
+// Enables multi-draw indirect, and drawing with a GPU-written draw count,
+// where the device supports both. Call from on_create_param. Returns whether
+// they were enabled.
+fn add_gpu_culling_features(lava::device::create_param& param)->bool;
@@ -0,0 +1,232 @@
+#include "gpu_profiler.h"
+
+#include <imgui.h>
+
+namespace {
+
+constexpr VkQueryPipelineStatisticFlags statistic_flags =
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+// One value per statistic bit, in bit order, then availability.
+constexpr uint32_t statistic_count = 4;
+
+// Weight of the newest frame in the averaged timings.
+constexpr double timing_smoothing = 0.1;
+
+fn current_slot(GpuProfiler const& profiler)->uint32_t {
+  return profiler.frame % gpu_profiler_frame_count;
+}
+
+fn first_timestamp(uint32_t slot, uint32_t zone)->uint32_t {
+  return (slot * gpu_profiler_max_zones + zone) * 2;
+}
+
+fn first_statistic(uint32_t slot, uint32_t zone)->uint32_t {
+  return slot * gpu_profiler_max_zones + zone;
+}
+
+fn collect_zone(GpuProfiler& profiler, uint32_t slot, uint32_t zone)->void {
+  VkDevice const device = profiler.device->get();
+  GpuZone& result = profiler.zones[zone];
+
+  // Each result is followed by its availability.
+  std::array<uint64_t, 4> timestamps{};
+  if (vkGetQueryPoolResults(
+          device, profiler.timestamp_pool, first_timestamp(slot, zone), 2,
+          sizeof(timestamps), timestamps.data(), 2 * sizeof(uint64_t),
+          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT) ==
+          VK_SUCCESS &&
+      timestamps[1] && timestamps[3]) {
+    uint64_t const ticks =
+        (timestamps[2] - timestamps[0]) & profiler.timestamp_mask;
+    double const ms = ticks * profiler.timestamp_period_ms;
+    result.gpu_ms = result.gpu_ms == 0
+                        ? ms
+                        : glm::mix(result.gpu_ms, ms, timing_smoothing);
+  }
+
+  std::array<uint64_t, statistic_count + 1> statistics{};
+  if (profiler.statistics_pool &&
+      vkGetQueryPoolResults(
+          device, profiler.statistics_pool, first_statistic(slot, zone), 1,
+          sizeof(statistics), statistics.data(), sizeof(statistics),
+          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT) ==
+          VK_SUCCESS &&
+      statistics[statistic_count]) {
+    result.vertex_invocations = statistics[0];
+    result.clipping_primitives = statistics[1];
+    result.fragment_invocations = statistics[2];
+    result.compute_invocations = statistics[3];
+  }
+}
+
+}  // namespace
+
+fn add_gpu_profiler_features(lava::device::create_param& param)->bool {
+  VkPhysicalDeviceFeatures supported;
+  vkGetPhysicalDeviceFeatures(param.physical_device->get(), &supported);
+  // Zones span secondary command buffers, which must inherit the queries.
+  if (!supported.pipelineStatisticsQuery || !supported.inheritedQueries) {
+    std::cout << "Pipeline statistics queries are unsupported, so the "
+                 "profiler only records timings."
+              << std::endl;
+    return false;
+  }
+  param.features.pipelineStatisticsQuery = VK_TRUE;
+  param.features.inheritedQueries = VK_TRUE;
+  return true;
+}
+
+fn create_gpu_profiler(GpuProfiler& profiler, lava::device_ptr device,
+                       uint32_t queue_family, bool statistics)->bool {
+  profiler.device = device;
+  profiler.frame = 0;
+  profiler.recorded.fill(0);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device->get_vk_physical_device(), &properties);
+  profiler.timestamp_period_ms = properties.limits.timestampPeriod * 1e-6;
+
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device->get_vk_physical_device(),
+                                           &family_count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(device->get_vk_physical_device(),
+                                           &family_count, families.data());
+  uint32_t const valid_bits = families[queue_family].timestampValidBits;
+  if (valid_bits == 0) {
+    std::cout << "Queue family has no timestamp support." << std::endl;
+    return false;
+  }
+  profiler.timestamp_mask =
+      valid_bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << valid_bits) - 1;
+
+  VkQueryPoolCreateInfo const timestamp_info{
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = gpu_profiler_frame_count * gpu_profiler_max_zones * 2,
+  };
+  VkQueryPoolCreateInfo const statistics_info{
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+      .queryCount = gpu_profiler_frame_count * gpu_profiler_max_zones,
+      .pipelineStatistics = statistic_flags,
+  };
+  profiler.statistics_pool = VK_NULL_HANDLE;
+  if (vkCreateQueryPool(device->get(), &timestamp_info, nullptr,
+                        &profiler.timestamp_pool) != VK_SUCCESS ||
+      (statistics &&
+       vkCreateQueryPool(device->get(), &statistics_info, nullptr,
+                         &profiler.statistics_pool) != VK_SUCCESS)) {
+    std::cout << "Failed to create profiler query pools." << std::endl;
+    destroy_gpu_profiler(profiler);
+    return false;
+  }
+  return true;
+}
+
+fn destroy_gpu_profiler(GpuProfiler& profiler)->void {
+  if (!profiler.device) {
+    return;
+  }
+  vkDestroyQueryPool(profiler.device->get(), profiler.timestamp_pool, nullptr);
+  vkDestroyQueryPool(profiler.device->get(), profiler.statistics_pool,
+                     nullptr);
+  profiler.timestamp_pool = VK_NULL_HANDLE;
+  profiler.statistics_pool = VK_NULL_HANDLE;
+  profiler.device = nullptr;
+}
+
+fn gpu_profiler_inherited_statistics(GpuProfiler const& profiler)
+    ->VkQueryPipelineStatisticFlags {
+  return profiler.statistics_pool ? statistic_flags : 0;
+}
+
+fn add_gpu_zone(GpuProfiler& profiler, std::string const& name)->uint32_t {
+  assert(profiler.zones.size() < gpu_profiler_max_zones);
+  profiler.zones.push_back({.name = name});
+  return profiler.zones.size() - 1;
+}
+
+fn begin_gpu_profiler_frame(GpuProfiler& profiler, VkCommandBuffer cmd_buf)
+    ->void {
+  if (!profiler.timestamp_pool) {
+    return;
+  }
+  profiler.frame++;
+  uint32_t const slot = current_slot(profiler);
+  for (uint32_t zone = 0; zone < profiler.zones.size(); zone++) {
+    if (profiler.recorded[slot] & (1u << zone)) {
+      collect_zone(profiler, slot, zone);
+    } else {
+      // Skipped passes, like the skeleton while drawing the mesh.
+      profiler.zones[zone] = {.name = profiler.zones[zone].name};
+    }
+  }
+  profiler.recorded[slot] = 0;
+  vkCmdResetQueryPool(cmd_buf, profiler.timestamp_pool,
+                      first_timestamp(slot, 0), gpu_profiler_max_zones * 2);
+  if (profiler.statistics_pool) {
+    vkCmdResetQueryPool(cmd_buf, profiler.statistics_pool,
+                        first_statistic(slot, 0), gpu_profiler_max_zones);
+  }
+}
+
+fn begin_gpu_zone(GpuProfiler& profiler, VkCommandBuffer cmd_buf,
+                  uint32_t zone)->void {
+  if (!profiler.timestamp_pool) {
+    return;
+  }
+  uint32_t const slot = current_slot(profiler);
+  vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      profiler.timestamp_pool, first_timestamp(slot, zone));
+  if (profiler.statistics_pool) {
+    vkCmdBeginQuery(cmd_buf, profiler.statistics_pool,
+                    first_statistic(slot, zone), 0);
+  }
+}
+
+fn end_gpu_zone(GpuProfiler& profiler, VkCommandBuffer cmd_buf,
+                uint32_t zone)->void {
+  if (!profiler.timestamp_pool) {
+    return;
+  }
+  uint32_t const slot = current_slot(profiler);
+  if (profiler.statistics_pool) {
+    vkCmdEndQuery(cmd_buf, profiler.statistics_pool,
+                  first_statistic(slot, zone));
+  }
+  vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      profiler.timestamp_pool,
+                      first_timestamp(slot, zone) + 1);
+  profiler.recorded[slot] |= 1u << zone;
+}
+
+fn draw_gpu_profiler(GpuProfiler const& profiler)->void {
+  if (!profiler.timestamp_pool) {
+    ImGui::Text("GPU profiler unavailable");
+    return;
+  }
+  double total_ms = 0;
+  for (auto const& zone : profiler.zones) {
+    ImGui::Text("%-10s %6.3f ms", zone.name.c_str(), zone.gpu_ms);
+    if (zone.compute_invocations > 0) {
+      ImGui::Text("  %llu compute invocations",
+                  static_cast<unsigned long long>(zone.compute_invocations));
+    }
+    if (zone.vertex_invocations > 0) {
+      ImGui::Text("  %llu vertex, %llu fragment invocations",
+                  static_cast<unsigned long long>(zone.vertex_invocations),
+                  static_cast<unsigned long long>(zone.fragment_invocations));
+      ImGui::Text("  %llu primitives",
+                  static_cast<unsigned long long>(zone.clipping_primitives));
+    }
+    total_ms += zone.gpu_ms;
+  }
+  ImGui::Text("%-10s %6.3f ms", "total", total_ms);
+  if (!profiler.statistics_pool) {
+    ImGui::Text("Pipeline statistics unavailable");
+  }
+}
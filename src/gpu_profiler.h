@@ -0,0 +1,69 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+
+// Query slots are reused after this many frames, which must be more than the
+// renderer keeps in flight. Results are shown that many frames late.
+constexpr uint32_t gpu_profiler_frame_count = 4;
+constexpr uint32_t gpu_profiler_max_zones = 16;
+
+typedef struct {
+  std::string name;
+  // Averaged over recent frames, and zero while the zone isn't recorded.
+  double gpu_ms;
+  // From the latest frame the zone was recorded in.
+  uint64_t vertex_invocations;
+  uint64_t clipping_primitives;
+  uint64_t fragment_invocations;
+  uint64_t compute_invocations;
+} GpuZone;
+
+// Times zones of a frame with timestamp queries and counts their shader
+// invocations with pipeline statistics queries, where the device has them.
+// Zones must not nest.
+typedef struct {
+  lava::device_ptr device;
+  VkQueryPool timestamp_pool;
+  // Null without pipeline statistics, leaving the counts at zero.
+  VkQueryPool statistics_pool;
+  double timestamp_period_ms;
+  uint64_t timestamp_mask;
+  std::vector<GpuZone> zones;
+  // Bit per zone recorded into each frame slot.
+  std::array<uint32_t, gpu_profiler_frame_count> recorded;
+  uint64_t frame;
+} GpuProfiler;
+
+// Enables pipeline statistics queries, and their inheritance by secondary
+// command buffers, where the device supports both. Call from
+// on_create_param. Returns whether they were enabled.
+fn add_gpu_profiler_features(lava::device::create_param& param)->bool;
+
+// Timestamps need no feature, so statistics only decides whether shader
+// invocations are counted too.
+fn create_gpu_profiler(GpuProfiler& profiler, lava::device_ptr device,
+                       uint32_t queue_family, bool statistics)->bool;
+
+fn destroy_gpu_profiler(GpuProfiler& profiler)->void;
+
+// For the inheritance info of secondary command buffers executed in a zone.
+fn gpu_profiler_inherited_statistics(GpuProfiler const& profiler)
+    ->VkQueryPipelineStatisticFlags;
+
+fn add_gpu_zone(GpuProfiler& profiler, std::string const& name)->uint32_t;
+
+// Collect the results of the frame that last used this slot, and reset its
+// queries. Record outside of a render pass, before any zone of the frame.
+fn begin_gpu_profiler_frame(GpuProfiler& profiler, VkCommandBuffer cmd_buf)
+    ->void;
+
+fn begin_gpu_zone(GpuProfiler& profiler, VkCommandBuffer cmd_buf,
+                  uint32_t zone)->void;
+
+fn end_gpu_zone(GpuProfiler& profiler, VkCommandBuffer cmd_buf,
+                uint32_t zone)->void;
+
+// Per-zone table for the ImGui window.
+fn draw_gpu_profiler(GpuProfiler const& profiler)->void;
@@ -0,0 +1,150 @@
+#include "job_system.h"
+
+#include "trace.h"
+
+namespace {
+
+// Workers own queue 1 and up of the system that started them. Threads of
+// any other system share queue 0.
+thread_local JobSystem const* current_system = nullptr;
+thread_local size_t current_queue = 0;
+
+fn queue_index(JobSystem const& jobs)->size_t {
+  return current_system == &jobs ? current_queue : 0;
+}
+
+fn pop_job(JobQueue& queue)->std::optional<Job> {
+  std::lock_guard lock(queue.mutex);
+  if (queue.jobs.empty()) {
+    return std::nullopt;
+  }
+  Job job = std::move(queue.jobs.back());
+  queue.jobs.pop_back();
+  return job;
+}
+
+fn steal_job(JobQueue& queue)->std::optional<Job> {
+  std::lock_guard lock(queue.mutex);
+  if (queue.jobs.empty()) {
+    return std::nullopt;
+  }
+  Job job = std::move(queue.jobs.front());
+  queue.jobs.pop_front();
+  return job;
+}
+
+// The calling thread's own queue first, then every other queue in turn.
+fn take_job(JobSystem& jobs)->std::optional<Job> {
+  if (jobs.queued == 0) {
+    return std::nullopt;
+  }
+  size_t const own = queue_index(jobs);
+  std::optional<Job> job = pop_job(*jobs.queues[own]);
+  for (size_t i = 1; !job && i < jobs.queues.size(); i++) {
+    job = steal_job(*jobs.queues[(own + i) % jobs.queues.size()]);
+  }
+  if (job) {
+    jobs.queued--;
+  }
+  return job;
+}
+
+fn execute_job(Job& job)->void {
+  job.work();
+  if (job.counter) {
+    job.counter->fetch_sub(1, std::memory_order_acq_rel);
+  }
+}
+
+fn run_worker(JobSystem& jobs, size_t queue)->void {
+  current_system = &jobs;
+  current_queue = queue;
+  set_trace_thread_name("job worker");
+  while (true) {
+    if (std::optional<Job> job = take_job(jobs)) {
+      execute_job(*job);
+      continue;
+    }
+    std::unique_lock lock(jobs.sleep_mutex);
+    jobs.wake.wait(lock, [&]() { return jobs.stopping || jobs.queued > 0; });
+    if (jobs.stopping) {
+      return;
+    }
+  }
+}
+
+}  // namespace
+
+fn start_job_system(JobSystem& jobs, size_t worker_count)->void {
+  jobs.queued = 0;
+  jobs.stopping = false;
+  for (size_t i = 0; i <= worker_count; i++) {
+    jobs.queues.push_back(std::make_unique<JobQueue>());
+  }
+  for (size_t i = 1; i <= worker_count; i++) {
+    jobs.workers.emplace_back(run_worker, std::ref(jobs), i);
+  }
+  std::cout << "Running jobs on " << worker_count << " workers.\n";
+}
+
+fn stop_job_system(JobSystem& jobs)->void {
+  {
+    std::lock_guard lock(jobs.sleep_mutex);
+    jobs.stopping = true;
+  }
+  jobs.wake.notify_all();
+  for (auto& worker : jobs.workers) {
+    worker.join();
+  }
+  jobs.workers.clear();
+  jobs.queues.clear();
+}
+
+fn job_thread_count(JobSystem const& jobs)->size_t {
+  return jobs.workers.size() + 1;
+}
+
+fn current_job_thread(JobSystem const& jobs)->size_t {
+  return queue_index(jobs);
+}
+
+fn run_job(JobSystem& jobs, std::function<void()> work, JobCounter* counter)
+    ->void {
+  if (counter) {
+    counter->fetch_add(1, std::memory_order_relaxed);
+  }
+  {
+    JobQueue& queue = *jobs.queues[queue_index(jobs)];
+    std::lock_guard lock(queue.mutex);
+    queue.jobs.push_back({std::move(work), counter});
+  }
+  {
+    // Taken so a worker can't miss the wake-up between its check and wait.
+    std::lock_guard lock(jobs.sleep_mutex);
+    jobs.queued++;
+  }
+  jobs.wake.notify_one();
+}
+
+fn wait_for_counter(JobSystem& jobs, JobCounter& counter)->void {
+  while (counter.load(std::memory_order_acquire) > 0) {
+    if (std::optional<Job> job = take_job(jobs)) {
+      execute_job(*job);
+    } else {
+      // The remaining jobs are running on other threads.
+      std::this_thread::yield();
+    }
+  }
+}
+
+fn parallel_for(JobSystem& jobs, size_t count, size_t batch_size,
+                std::function<void(size_t, size_t)> const& body)->void {
+  batch_size = std::max<size_t>(batch_size, 1);
+  JobCounter counter = 0;
+  for (size_t first = 0; first < count; first += batch_size) {
+    size_t const last = std::min(first + batch_size, count);
+    run_job(
+        jobs, [&body, first, last]() { body(first, last); }, &counter);
+  }
+  wait_for_counter(jobs, counter);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <liblava/lava.hpp>
+#include <mutex>
+#include <thread>
+
+#include "includes.h"
+
+// Jobs still running or queued under a counter. Waiting on it runs other
+// jobs until it drops to zero, so jobs may wait on counters themselves.
+typedef std::atomic<size_t> JobCounter;
+
+typedef struct {
+  std::function<void()> work;
+  JobCounter* counter;
+} Job;
+
+// The owning thread pushes and pops at the back, thieves take from the
+// front, so stolen jobs are the oldest and usually the largest.
+typedef struct {
+  std::mutex mutex;
+  std::deque<Job> jobs;
+} JobQueue;
+
+// Runs jobs on worker threads, each with its own queue. Queue 0 belongs to
+// every thread that isn't a worker, such as the main thread.
+typedef struct {
+  std::vector<std::unique_ptr<JobQueue>> queues;
+  std::vector<std::thread> workers;
+  // Jobs pushed and not yet taken, so idle workers know when to sleep.
+  std::atomic<size_t> queued;
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  bool stopping;
+} JobSystem;
+
+fn start_job_system(JobSystem& jobs, size_t worker_count)->void;
+
+fn stop_job_system(JobSystem& jobs)->void;
+
+// Threads that run jobs, including the one waiting on them.
+fn job_thread_count(JobSystem const& jobs)->size_t;
+
+// The calling thread's queue in jobs: 0 outside its workers, then 1 and up.
+// Lets jobs index per-thread resources sized by job_thread_count().
+fn current_job_thread(JobSystem const& jobs)->size_t;
+
+// Queue a job on the calling thread's queue. counter may be null.
+fn run_job(JobSystem& jobs, std::function<void()> work, JobCounter* counter)
+    ->void;
+
+// Run jobs, stolen or not, until the counter drops to zero.
+fn wait_for_counter(JobSystem& jobs, JobCounter& counter)->void;
+
+// Call body(first, last) over [0, count) in batches of at most batch_size,
+// and wait for every batch.
+fn parallel_for(JobSystem& jobs, size_t count, size_t batch_size,
+                std::function<void(size_t, size_t)> const& body)->void;
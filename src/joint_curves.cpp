@@ -0,0 +1,189 @@
+#include "joint_curves.h"
+
+#include "trace.h"
+
+namespace {
+
+constexpr std::array<char const *, 3> curve_components = {
+    FBXSDK_CURVENODE_COMPONENT_X,
+    FBXSDK_CURVENODE_COMPONENT_Y,
+    FBXSDK_CURVENODE_COMPONENT_Z,
+};
+
+fn to_vector(FbxDouble3 const &value)->FbxVector4 {
+  return FbxVector4(value[0], value[1], value[2]);
+}
+
+fn translation_matrix(FbxVector4 const &translation)->FbxAMatrix {
+  FbxAMatrix matrix;
+  matrix.SetT(translation);
+  return matrix;
+}
+
+fn read_joint_curves(FbxNode *node, FbxAnimLayer *layer, int parent_index)
+    ->std::optional<JointCurves> {
+  JointCurves joint{};
+  joint.parent_index = parent_index;
+  std::array<FbxPropertyT<FbxDouble3> *, curve_channel_count> const
+      properties = {&node->LclTranslation, &node->LclRotation,
+                    &node->LclScaling};
+  for (size_t channel = 0; channel < curve_channel_count; channel++) {
+    joint.static_values[channel] = properties[channel]->Get();
+    for (size_t axis = 0; axis < 3; axis++) {
+      joint.curves[channel][axis] =
+          properties[channel]->GetCurve(layer, curve_components[axis]);
+    }
+  }
+
+  // Without RotationActive, the SDK ignores the rotation order and the pre
+  // and post rotations.
+  bool const rotation_active = node->RotationActive.Get();
+  joint.rotation_order = rotation_active ? node->RotationOrder.Get()
+                                         : FbxEuler::eOrderXYZ;
+  if (joint.rotation_order == FbxEuler::eOrderSphericXYZ) {
+    return std::nullopt;
+  }
+  FbxAMatrix pre_rotation;
+  FbxAMatrix post_rotation;
+  if (rotation_active) {
+    pre_rotation.SetR(to_vector(node->PreRotation.Get()));
+    post_rotation.SetR(to_vector(node->PostRotation.Get()));
+  }
+  FbxAMatrix const rotation_pivot =
+      translation_matrix(to_vector(node->RotationPivot.Get()));
+  FbxAMatrix const scaling_pivot =
+      translation_matrix(to_vector(node->ScalingPivot.Get()));
+  joint.pre_rotation =
+      translation_matrix(to_vector(node->RotationOffset.Get())) *
+      rotation_pivot * pre_rotation;
+  joint.post_rotation =
+      post_rotation.Inverse() * rotation_pivot.Inverse() *
+      translation_matrix(to_vector(node->ScalingOffset.Get())) *
+      scaling_pivot;
+  joint.scaling_pivot_inverse = scaling_pivot.Inverse();
+  return joint;
+}
+
+// Curves are evaluated as floats, like the SDK does.
+fn evaluate_channel(JointCurves const &joint, size_t channel, FbxTime time,
+                    std::array<int, 3> &last_keys)->FbxVector4 {
+  FbxVector4 value = to_vector(joint.static_values[channel]);
+  for (size_t axis = 0; axis < 3; axis++) {
+    if (FbxAnimCurve *curve = joint.curves[channel][axis]) {
+      value[axis] = curve->Evaluate(time, &last_keys[axis]);
+    }
+  }
+  return value;
+}
+
+fn to_transform(FbxAMatrix const &matrix)->Transform {
+  lava::mat4 const global = fbxmat_to_lavamat(matrix);
+  return Transform{lava::v3(global[3]), glm::quat_cast(global)};
+}
+
+}  // namespace
+
+fn read_skeleton_curves(FbxScene *scene, std::vector<Joint> const &joints)
+    ->std::optional<SkeletonCurves> {
+  TRACE_SCOPE("read_skeleton_curves");
+  FbxAnimStack *anim_stack = scene->GetCurrentAnimationStack();
+  if (!anim_stack || anim_stack->GetMemberCount<FbxAnimLayer>() != 1) {
+    return std::nullopt;
+  }
+  FbxAnimLayer *layer = anim_stack->GetMember<FbxAnimLayer>(0);
+  SkeletonCurves curves{};
+  curves.joints.reserve(joints.size());
+  for (auto const &joint : joints) {
+    std::optional<JointCurves> joint_curves =
+        read_joint_curves(joint.node, layer, joint.parent_index);
+    if (!joint_curves) {
+      return std::nullopt;
+    }
+    curves.joints.push_back(*joint_curves);
+  }
+  curves.root_parent = joints.empty() ? nullptr : joints[0].node->GetParent();
+  return curves;
+}
+
+fn sample_animation_clip_curves(FbxScene *scene,
+                                SkeletonCurves const &curves)->AnimationClip {
+  TRACE_SCOPE("sample_animation_clip_curves");
+  AnimationClip anim_clip =
+      allocate_animation_clip(scene, curves.joints.size());
+  // Key indices of the previous evaluation, so consecutive frames don't
+  // search each curve from the start.
+  std::vector<std::array<std::array<int, 3>, curve_channel_count>> last_keys(
+      curves.joints.size());
+  std::vector<FbxAMatrix> globals(curves.joints.size());
+  FbxTime time;
+  for (auto &keyframe : anim_clip.frames) {
+    time.SetFrame(keyframe.time, clip_frame_rate);
+    FbxAMatrix const root_parent =
+        curves.root_parent ? curves.root_parent->EvaluateGlobalTransform(time)
+                           : FbxAMatrix();
+    for (size_t j = 0; j < curves.joints.size(); j++) {
+      JointCurves const &joint = curves.joints[j];
+      auto &keys = last_keys[j];
+      FbxAMatrix rotation;
+      FbxRotationOrder(joint.rotation_order)
+          .V2M(rotation,
+               evaluate_channel(joint, rotation_channel, time,
+                                keys[rotation_channel]));
+      FbxAMatrix scaling;
+      scaling.SetS(evaluate_channel(joint, scaling_channel, time,
+                                    keys[scaling_channel]));
+      FbxAMatrix const local =
+          translation_matrix(evaluate_channel(joint, translation_channel, time,
+                                              keys[translation_channel])) *
+          joint.pre_rotation * rotation * joint.post_rotation * scaling *
+          joint.scaling_pivot_inverse;
+      globals[j] = (joint.parent_index < 0 ? root_parent
+                                           : globals[joint.parent_index]) *
+                   local;
+      keyframe.transforms[j] = to_transform(globals[j]);
+    }
+  }
+  return anim_clip;
+}
+
+fn validate_animation_clip(AnimationClip const &anim_clip,
+                           std::vector<Joint> const &joints,
+                           size_t sample_count)->CurveValidation {
+  TRACE_SCOPE("validate_animation_clip");
+  CurveValidation validation{};
+  size_t const frame_count = anim_clip.frames.size();
+  sample_count = std::min(sample_count, frame_count);
+  FbxTime time;
+  for (size_t i = 0; i < sample_count; i++) {
+    Keyframe const &keyframe = anim_clip.frames[frame_count * i / sample_count];
+    time.SetFrame(keyframe.time, clip_frame_rate);
+    for (size_t j = 0; j < joints.size(); j++) {
+      Transform const expected =
+          to_transform(joints[j].node->EvaluateGlobalTransform(time));
+      Transform const &actual = keyframe.transforms[j];
+      validation.max_translation_error = std::max<double>(
+          validation.max_translation_error,
+          glm::distance(expected.translation, actual.translation));
+      // q and -q are the same rotation.
+      float const cos_half_angle = std::min(
+          1.0f, std::abs(glm::dot(expected.orientation, actual.orientation)));
+      validation.max_rotation_error = std::max<double>(
+          validation.max_rotation_error, 2 * std::acos(cos_half_angle));
+    }
+    validation.frames_checked++;
+  }
+  return validation;
+}
+
+fn curve_validation_passed(CurveValidation const &validation,
+                           AnimationClip const &anim_clip)->bool {
+  float extent = 1;
+  for (auto const &keyframe : anim_clip.frames) {
+    for (auto const &transform : keyframe.transforms) {
+      extent = std::max(extent, glm::length(transform.translation));
+    }
+  }
+  return validation.max_translation_error <=
+             curve_translation_tolerance * extent &&
+         validation.max_rotation_error <= curve_rotation_tolerance;
+}
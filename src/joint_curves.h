@@ -0,0 +1,73 @@
+#pragma once
+
+#include <fbxsdk.h>
+
+#include "fbx_loading.h"
+#include "includes.h"
+
+enum CurveChannel {
+  translation_channel,
+  rotation_channel,
+  scaling_channel,
+  curve_channel_count,
+};
+
+// A joint's local transform, read once from its node so that baking
+// evaluates curves directly instead of going through the SDK's evaluator.
+typedef struct {
+  // Curves per channel and axis, or null where the axis isn't animated.
+  std::array<std::array<FbxAnimCurve *, 3>, curve_channel_count> curves;
+  // Values of the Lcl properties, used for axes without a curve.
+  std::array<FbxDouble3, curve_channel_count> static_values;
+  FbxEuler::EOrder rotation_order;
+  // Roff * Rp * Rpre, applied between translation and rotation.
+  FbxAMatrix pre_rotation;
+  // Rpost^-1 * Rp^-1 * Soff * Sp, applied between rotation and scaling.
+  FbxAMatrix post_rotation;
+  // Sp^-1, applied after scaling.
+  FbxAMatrix scaling_pivot_inverse;
+  int parent_index;
+} JointCurves;
+
+typedef struct {
+  std::vector<JointCurves> joints;
+  // The node above the root joint. Its global transform still comes from the
+  // SDK, once per frame.
+  FbxNode *root_parent;
+} SkeletonCurves;
+
+// Largest differences between a clip and the SDK's evaluation of the same
+// frames.
+typedef struct {
+  double max_translation_error;
+  // In radians.
+  double max_rotation_error;
+  size_t frames_checked;
+} CurveValidation;
+
+// Translation error allowed, relative to the largest joint distance from the
+// origin, and rotation error allowed, in radians.
+constexpr double curve_translation_tolerance = 1e-4;
+constexpr double curve_rotation_tolerance = 1e-3;
+
+// Read the curves of the current animation stack. Fails on stacks with more
+// than one layer, and on spheric rotation orders, which need the SDK's
+// evaluator.
+fn read_skeleton_curves(FbxScene *scene, std::vector<Joint> const &joints)
+    ->std::optional<SkeletonCurves>;
+
+// Same frames as sample_animation_clip(). Local transforms are evaluated
+// from the curves and composed into globals in one pass in joint order, so
+// parents are done before their children. Children inherit their parent's
+// scale as a matrix (eInheritRSrs).
+fn sample_animation_clip_curves(FbxScene *scene,
+                                SkeletonCurves const &curves)->AnimationClip;
+
+// Compare up to sample_count evenly spaced frames of the clip against
+// EvaluateGlobalTransform().
+fn validate_animation_clip(AnimationClip const &anim_clip,
+                           std::vector<Joint> const &joints,
+                           size_t sample_count)->CurveValidation;
+
+fn curve_validation_passed(CurveValidation const &validation,
+                           AnimationClip const &anim_clip)->bool;
@@ -4,15 +4,40 @@
 #include <fbxsdk.h>
 #include <imgui.h>
 
+#include <chrono>
 #include <cstddef>
+#include <filesystem>
+#include <future>
 #include <glm/gtx/string_cast.hpp>
 #include <iostream>
 #include <liblava/lava.hpp>
+#include <thread>
 #include <typeinfo>
 
+#include "baked_asset.h"
+#include "blend_shapes.h"
+#include "characters.h"
 #include "fbx_loading.h"
+#include "gpu_culling.h"
+#include "gpu_profiler.h"
 #include "includes.h"
+#include "job_system.h"
+#include "joint_curves.h"
+#include "materials.h"
+#include "mesh_lod.h"
+#include "mesh_optimize.h"
+#include "meshlets.h"
+#include "offscreen_pass.h"
+#include "parallel_recording.h"
+#include "pipeline_cache.h"
 #include "pipelines.h"
+#include "render_graph.h"
+#include "retargeting.h"
+#include "root_motion.h"
+#include "shader_permutations.h"
+#include "shaders.h"
+#include "texture_streaming.h"
+#include "trace.h"
 
 using fbxsdk::FbxNode;
 
@@ -22,11 +47,33 @@ static RenderMode render_mode;  // Initialized in main()
 static size_t current_keyframe_index = 0;
 static double current_keyframe_time;
 static bool animating = true;
+static bool meshlet_culling = true;
+static bool meshlet_cone_culling = false;
+static int forced_lod = -1;
+static float lod_bias = 1.0f;
+static size_t current_lod = 0;
+static SkinningMethod skinning_method = SkinningMethod::linear;
+static bool frustum_culling = true;
+static bool gpu_driven = true;
+// Record the CPU-culled draws on the job threads.
+static bool parallel_recording = true;
+static int instance_count = 1;
+static bool meshlets_active = false;
+static bool animation_lod = true;
+static int animation_joint_budget = 0;
+static bool root_motion = true;
+// 0 plays the character's own clip, and the rest clips retargeted from
+// other files.
+static int crowd_clip = 0;
+static double crowd_clip_time;
+static std::vector<InstanceDraw> visible_draws;
 
 int main(int argc, char *argv[]) {
   // Load and read the mesh from an FBX.
   // std::string path = "../res/Teddy/Teddy_Idle.fbx";
   std::string path = "../res/Idle.fbx";
+  set_trace_thread_name("main");
+  TraceZone import_zone("fbx import");
   FbxManager *fbx_manager = FbxManager::Create();
   FbxIOSettings *io_settings = FbxIOSettings::Create(fbx_manager, IOSROOT);
   fbx_manager->SetIOSettings(io_settings);
@@ -36,66 +83,16 @@ int main(int argc, char *argv[]) {
           "Failed to import");
   importer->Import(scene);
   importer->Destroy();
+  import_zone.end();
   FbxNode *root_node = scene->GetRootNode();
-  lava::mesh_template_data<skin_vertex> loaded_data =
-      find_fbx_mesh(root_node).value();
   FbxSkin *skin = find_fbx_skin(root_node);
 
   // Load the skeleton.
-  std::vector<FbxPose *> poses;
-  // Fill out poses.
-  find_fbx_poses(root_node, &poses);
-  FbxPose *bind_pose = nullptr;
-  std::cout << "Poses: " << poses.size() << std::endl;
-  for (size_t i = 0; i < poses.size(); i++) {
-    if (poses[i]->IsBindPose()) {
-      std::cout << "Found a bind pose.\n";
-      bind_pose = poses[i];
-      break;
-    }
-  }
-  auto pose_count = scene->GetPoseCount();
-  for (size_t i = 0; i < pose_count; i++) {
-    auto cur_pose = scene->GetPose(i);
-    if (cur_pose->IsBindPose()) {
-      bind_pose = cur_pose;
-      break;
-    }
-  }
+  FbxPose *bind_pose = find_fbx_bind_pose(scene);
   success(bind_pose, "Failed to find a bind pose.\n");
-
-  // Find skeleton.
-  FbxSkeleton *root_skel = nullptr;
-  for (size_t i = 0; i < bind_pose->GetCount(); i++) {
-    auto cur_skel = bind_pose->GetNode(i)->GetSkeleton();
-    if (cur_skel && cur_skel->IsSkeletonRoot()) {
-      root_skel = cur_skel;
-    }
-  }
+  FbxSkeleton *root_skel = find_fbx_root_skeleton(bind_pose);
   success(root_skel, "Failed to find a root skeleton.");
-
-  std::vector<Joint> joints;
-  auto make_joint = [&](FbxNode *node, int index) -> Joint {
-    return Joint{.node = node,
-                 .parent_index = index,
-                 .transform = node->EvaluateGlobalTransform()};
-  };
-  std::function<void(Joint, int, size_t)> get_joints =
-      [&](Joint parent_joint, int parent_index, size_t parent_breadth) {
-        size_t children = parent_joint.node->GetChildCount();
-        for (size_t i = 0; i < children; i++) {
-          auto cur_node = parent_joint.node->GetChild(i);
-          if (cur_node && cur_node->GetNodeAttribute() &&
-              cur_node->GetNodeAttribute()->GetAttributeType() ==
-                  FbxNodeAttribute::eSkeleton) {
-            auto new_joint = make_joint(cur_node, parent_index);
-            joints.push_back(new_joint);
-            get_joints(new_joint, joints.size() - 1, children);
-          }
-        }
-      };
-
-  get_joints(make_joint(root_skel->GetNode(), -1), 0, 0);
+  std::vector<Joint> joints = read_joints(root_skel);
   std::cout << "SKEL NODES: " << root_skel->GetNodeCount() << '\n';
   std::cout << "JOINTS SIZE: " << joints.size() << '\n';
 
@@ -104,6 +101,18 @@ int main(int argc, char *argv[]) {
   app.config.surface.formats = {VK_FORMAT_B8G8R8A8_SRGB};
   app.camera.rotation_speed = 250;
   app.camera.movement_speed += 10;
+  bool timeline_semaphores = false;
+  bool bindless_textures = false;
+  bool pipeline_statistics = false;
+  // Meshlet and instance culling both issue multi-draw indirect calls, and
+  // the instance culling pass also writes the draw count.
+  bool multi_draw_indirect = false;
+  app.manager.on_create_param = [&](lava::device::create_param &param) {
+    multi_draw_indirect = add_gpu_culling_features(param);
+    timeline_semaphores = add_texture_streaming_features(param);
+    bindless_textures = add_bindless_texture_features(param);
+    pipeline_statistics = add_gpu_profiler_features(param);
+  };
   success(app.setup(), "Failed to setup app.");
 
   app.camera.position = lava::v3(0.0f, -4.036f, 8.304f);
@@ -136,7 +145,8 @@ int main(int argc, char *argv[]) {
         .color = lava::v4(1, 1, 1, 1),
     });
     bone_mesh_data.indices.push_back(i);
-    bone_mesh_data.indices.push_back(current_joint.parent_index);
+    bone_mesh_data.indices.push_back(
+        current_joint.parent_index < 0 ? i : current_joint.parent_index);
 
     bones_inverse_bind_mats.push_back(glm::inverse(current_matrix));
 
@@ -151,106 +161,218 @@ int main(int argc, char *argv[]) {
   bones_mesh->add_data(bone_mesh_data);
   bones_mesh->create(app.device);
 
-  // Skinning clusters
-  struct skin_control_point {
-    std::array<int, 4> joint_indices;
-    std::array<float, 4> joint_weights{0, 0, 0, 0};
-    fn normalize() {
-      float weight_sum = 0;
-      for (auto &weight : joint_weights) {
-        weight_sum += weight;
-      }
-      for (auto &weight : joint_weights) {
-        weight /= weight_sum;
-      }
+  // Extracting, optimizing and splitting the mesh is slow, so the result is
+  // baked next to the FBX and reused until the FBX changes. File times only
+  // rule out stale bakes cheaply: a bake is only used if it records the
+  // FBX's size and hash too.
+  std::string baked_path =
+      std::filesystem::path(path).replace_extension(".bake").string();
+  lava::mesh_template_data<skin_vertex> loaded_data;
+  MeshletData meshlet_data;
+  bool baked = false;
+  std::optional<AssetSource> const fbx_source = read_asset_source(path);
+  std::error_code bake_time_error;
+  std::error_code fbx_time_error;
+  auto const bake_time =
+      std::filesystem::last_write_time(baked_path, bake_time_error);
+  auto const fbx_time = std::filesystem::last_write_time(path, fbx_time_error);
+  std::optional<BakedAsset> baked_asset;
+  if (fbx_source && !bake_time_error && !fbx_time_error &&
+      bake_time > fbx_time) {
+    baked_asset = read_baked_asset(baked_path);
+  }
+  if (baked_asset) {
+    auto const source =
+        get_asset_chunk<AssetSource>(*baked_asset, asset_chunk_source);
+    if (!source || source->size() != 1 ||
+        (*source)[0].size != fbx_source->size ||
+        (*source)[0].hash != fbx_source->hash) {
+      std::cout << "Baked mesh " << baked_path
+                << " is from another version of the FBX.\n";
+      baked_asset.reset();
     }
-  };
-  std::vector<skin_control_point> skin_control_points;
-
-  for (size_t i = 0; i < skin->GetClusterCount(); i++) {
-    FbxCluster *current_cluster = skin->GetCluster(i);
-    FbxNode *current_node = current_cluster->GetLink();
-    double *weights = current_cluster->GetControlPointWeights();
-    int *control_points = current_cluster->GetControlPointIndices();
-    int joint_index;
-    for (size_t i = 0; i < joints.size(); i++) {
-      if (joints[i].node == current_node) {
-        joint_index = i;
-        break;
-      }
+  }
+  if (baked_asset) {
+    auto vertices =
+        get_asset_chunk<skin_vertex>(*baked_asset, asset_chunk_vertices);
+    auto indices =
+        get_asset_chunk<lava::index>(*baked_asset, asset_chunk_indices);
+    auto meshlets =
+        get_asset_chunk<Meshlet>(*baked_asset, asset_chunk_meshlets);
+    auto meshlet_vertices = get_asset_chunk<lava::index>(
+        *baked_asset, asset_chunk_meshlet_vertices);
+    auto meshlet_triangles = get_asset_chunk<uint8_t>(
+        *baked_asset, asset_chunk_meshlet_triangles);
+    auto meshlet_joints = get_asset_chunk<MeshletJoint>(
+        *baked_asset, asset_chunk_meshlet_joints);
+    baked = vertices && indices && meshlets && meshlet_vertices &&
+            meshlet_triangles && meshlet_joints;
+    if (baked) {
+      loaded_data.vertices = std::move(*vertices);
+      loaded_data.indices = std::move(*indices);
+      meshlet_data = {std::move(*meshlets), std::move(*meshlet_vertices),
+                      std::move(*meshlet_triangles),
+                      std::move(*meshlet_joints)};
+      std::cout << "Loaded baked mesh " << baked_path << '\n';
     }
-    skin_control_point current_control_point;
-    for (size_t i = 0; i < current_cluster->GetControlPointIndicesCount();
-         i++) {
-      if (i > 4) {
-        // TODO: Grab the four greatest weights, not the first four.
-        break;
-      }
-      current_control_point.joint_weights[i] = weights[i];
-      current_control_point.joint_indices[i] = control_points[i];
+  }
+  if (!baked) {
+    // Skinning clusters
+    std::vector<SkinWeights> skin_weights = read_skin_weights(
+        skin, joints, skin->GetGeometry()->GetControlPointsCount());
+    loaded_data = find_fbx_mesh(root_node, &skin_weights).value();
+
+    // Index the mesh and reorder it for vertex cache and fetch locality.
+    optimize_mesh(loaded_data);
+
+    // Split the mesh into clusters for the culling pre-pass.
+    meshlet_data = build_meshlets(loaded_data);
+
+    BakedAsset bake;
+    add_asset_chunk(bake, asset_chunk_vertices, loaded_data.vertices);
+    add_asset_chunk(bake, asset_chunk_indices, loaded_data.indices);
+    add_asset_chunk(bake, asset_chunk_meshlets, meshlet_data.meshlets);
+    add_asset_chunk(bake, asset_chunk_meshlet_vertices,
+                    meshlet_data.vertices);
+    add_asset_chunk(bake, asset_chunk_meshlet_triangles,
+                    meshlet_data.triangles);
+    add_asset_chunk(bake, asset_chunk_meshlet_joints, meshlet_data.joints);
+    if (fbx_source) {
+      add_asset_chunk(bake, asset_chunk_source,
+                      std::vector<AssetSource>{*fbx_source});
+    }
+    if (!write_baked_asset(baked_path, bake)) {
+      std::cout << "Failed to write baked asset " << baked_path << '\n';
     }
-    current_control_point.normalize();
-    skin_control_points.push_back(current_control_point);
   }
+  std::cout << "Meshlets: " << meshlet_data.meshlets.size() << '\n';
 
-  // Put skin data into mesh data.
-  for (size_t i = 0; i < loaded_data.vertices.size(); i++) {
-    auto current_vertex = &loaded_data.vertices[i];
-    for (size_t j = 0; j < skin_control_points.size(); j++) {
-      auto indices = skin_control_points[j].joint_indices;
-      if (std::find(std::begin(indices), std::end(indices), i)) {
-      }
+  // Simplified meshes and reduced skeletons for distant characters.
+  LodChain lod_chain = build_lod_chain(loaded_data, joints);
+
+  // Joint-space bounds of the skin, posed every frame for culling.
+  std::vector<JointBounds> joint_bounds =
+      compute_joint_bounds(loaded_data, bones_inverse_bind_mats);
+
+  // Load animation. Evaluate the curves directly where they reproduce the
+  // SDK's transforms, and fall back to the SDK's evaluator otherwise.
+  std::optional<AnimationClip> curve_clip;
+  if (std::optional<SkeletonCurves> curves =
+          read_skeleton_curves(scene, joints)) {
+    curve_clip = sample_animation_clip_curves(scene, *curves);
+    CurveValidation const validation =
+        validate_animation_clip(*curve_clip, joints, 8);
+    std::cout << "Curve evaluation: max error "
+              << validation.max_translation_error << " units, "
+              << validation.max_rotation_error << " rad over "
+              << validation.frames_checked << " frames\n";
+    if (!curve_validation_passed(validation, *curve_clip)) {
+      curve_clip.reset();
     }
-    // current_vertex->weight_indices;
   }
+  if (!curve_clip) {
+    std::cout << "Baking keyframes with the SDK's evaluator." << std::endl;
+  }
+  AnimationClip anim_clip =
+      curve_clip ? std::move(*curve_clip)
+                 : sample_animation_clip_parallel(
+                       scene, joints, path,
+                       std::thread::hardware_concurrency());
+  // Play the clip in place, and move the characters by its root motion.
+  extract_root_motion(anim_clip, find_root_motion_joint(joints));
+  RootMotion const loop_motion =
+      root_motion_between(anim_clip, 0, anim_clip.frames.size());
+  std::cout << "Root motion per loop: "
+            << glm::length(loop_motion.translation) << " units, "
+            << loop_motion.yaw << " rad\n";
+  MorphSet const morph_set =
+      read_morph_set(scene, find_fbx_mesh_node(root_node)->GetMesh(),
+                     anim_clip);
 
-  // Load animation.
-  auto fps = FbxTime::EMode::eFrames24;
-  FbxAnimStack *anim_stack = scene->GetCurrentAnimationStack();
-  FbxTimeSpan time_span = anim_stack->GetLocalTimeSpan();
-  FbxTime real_time = time_span.GetDuration();
-  AnimationClip anim_clip{};
-  anim_clip.duration = real_time.GetFrameCount(fps);
-
-  // Make an array of joint transforms for every keyframe in the animation
-  // clip. Start at 1, because 0 is the bind pose frame.
-  for (double i = 1; i < anim_clip.duration; i++) {
-    Keyframe current_keyframe;
-    real_time.SetFrame(i, fps);
-    current_keyframe.time = i;
-    current_keyframe.transforms.reserve(joints.size());
-    for (auto joint : joints) {
-      lava::mat4 current_matrix =
-          fbxmat_to_lavamat(joint.node->EvaluateGlobalTransform(real_time));
-      glm::quat current_quaternion = glm::quat_cast(current_matrix);
-      lava::v3 current_translation = current_matrix[3];
-      current_keyframe.transforms.push_back(
-          Transform{current_translation, current_quaternion});
-    }
-    anim_clip.frames.push_back(current_keyframe);
+  // Clips of the same rig family, played on this skeleton by joint name.
+  std::vector<RetargetedClip> retargeted_clips;
+  for (char const *clip_path :
+       {"../res/Walk.fbx", "../res/Run.fbx", "../res/Jump.fbx"}) {
+    if (std::optional<RetargetedClip> clip = load_retargeted_clip(
+            fbx_manager, clip_path, joints, bind_pose,
+            std::thread::hardware_concurrency())) {
+      retargeted_clips.push_back(std::move(*clip));
+    }
+  }
+  std::vector<char const *> crowd_clip_names{"Own clip"};
+  for (RetargetedClip const &clip : retargeted_clips) {
+    crowd_clip_names.push_back(clip.name.c_str());
+  }
+
+  // Materials of the character, with textures shared by content.
+  MaterialTable material_table{};
+  std::vector<size_t> mesh_materials =
+      add_fbx_materials(material_table, find_fbx_mesh_node(root_node), path);
+  if (mesh_materials.empty()) {
+    // Every slot falls back to its placeholder.
+    material_table.materials.push_back({"default", {-1, -1, -1, -1}});
+    mesh_materials.push_back(material_table.materials.size() - 1);
+  }
+  bool const mesh_normal_mapped =
+      std::any_of(mesh_materials.begin(), mesh_materials.end(),
+                  [&](size_t material) {
+                    return material_table.materials[material]
+                               .textures[normal_slot] >= 0;
+                  });
+  // Without bindless textures, every material has a set of its own slots.
+  uint32_t const texture_array_size =
+      bindless_textures ? bindless_texture_capacity(app.device)
+                        : material_slot_count;
+  if (!bindless_textures || !multi_draw_indirect) {
+    gpu_driven = false;
+  }
+  if (!multi_draw_indirect) {
+    meshlet_culling = false;
   }
+  std::vector<GpuMaterial> gpu_materials =
+      make_gpu_materials(material_table, texture_array_size);
+  lava::buffer material_buffer;
+  material_buffer.create(app.device, gpu_materials.data(),
+                         gpu_materials.size() * sizeof(GpuMaterial),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
-  // Load textures
-  // TODO: Abstract as function
-  lava::texture::ptr diffuse_texture =
-      lava::load_texture(app.device, "../res/Idle.fbm/PPG_3D_Player_D.png");
-  lava::texture::ptr emissive_texture = lava::load_texture(
-      app.device, "../res/Idle.fbm/PPG_3D_Player_emissive.png");
-  lava::texture::ptr normal_texture =
-      lava::load_texture(app.device, "../res/Idle.fbm/PPG_3D_Player_N.png");
-  lava::texture::ptr specular_texture =
-      lava::load_texture(app.device, "../res/Idle.fbm/PPG_3D_Player_spec.png");
-  app.staging.add(diffuse_texture);
-  app.staging.add(emissive_texture);
-  app.staging.add(normal_texture);
-  app.staging.add(specular_texture);
-  std::array<VkDescriptorImageInfo, 4> textures_descriptor_info{{
-      *diffuse_texture->get_descriptor_info(),
-      *emissive_texture->get_descriptor_info(),
-      *normal_texture->get_descriptor_info(),
-      *specular_texture->get_descriptor_info(),
-  }};
+  // Stream textures in the background, with placeholders bound until every
+  // texture has settled.
+  // Mid grey diffuse, no emission, a flat normal and no specular.
+  PlaceholderTextures const placeholder_textures = {
+      make_placeholder_texture(app.device, {128, 128, 128, 255}),
+      make_placeholder_texture(app.device, {0, 0, 0, 255}),
+      make_placeholder_texture(app.device, {128, 128, 255, 255}),
+      make_placeholder_texture(app.device, {0, 0, 0, 255}),
+  };
+  for (auto const& placeholder : placeholder_textures) {
+    app.staging.add(placeholder);
+  }
+  // Parallel to the material table's textures, null until streamed in.
+  std::vector<lava::texture::ptr> streamed_textures(
+      material_table.textures.size());
 
+  TextureStreamer texture_streamer;
+  // Uploads on a transfer queue wait on a timeline semaphore, so without
+  // one they go through the graphics queue.
+  lava::queue const* transfer_queue =
+      !timeline_semaphores || app.device->get_transfer_queues().empty()
+          ? nullptr
+          : &app.device->get_transfer_queue();
+  start_texture_streamer(texture_streamer, app.device, transfer_queue,
+                         app.device->get_graphics_queue().family,
+                         std::min(4u, std::thread::hardware_concurrency()));
+  // Streamer handles, parallel to the material table's textures.
+  std::vector<size_t> texture_handles;
+  for (size_t i = 0;
+       i < material_table.textures.size() &&
+       (!bindless_textures || bindless_texture_index(i) < texture_array_size);
+       i++) {
+    MaterialTexture const& texture = material_table.textures[i];
+    texture_handles.push_back(
+        request_texture(texture_streamer, texture.path, texture.usage));
+  }
+  app.add_run_end([&]() { stop_texture_streamer(texture_streamer); });
   typedef struct {
     lava::mat4 view_proj;
     alignas(16) lava::v3 cam_pos;
@@ -258,20 +380,107 @@ int main(int argc, char *argv[]) {
 
   CameraBuffer camera_buffer_data = {lava::mat4(1), app.camera.position};
 
-  lava::buffer camera_buffer;
-  camera_buffer.create_mapped(
-      app.device, &camera_buffer_data,
-      sizeof(lava::mat4) + sizeof(app.camera.position),
-      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-
-  // Load mesh.
+  // Load mesh. Every LOD is packed into one mesh, with LOD 0 first so that
+  // meshlet draws can index it directly.
+  lava::mesh_template_data<skin_vertex> packed_lods;
+  std::vector<LodRange> lod_ranges = pack_lod_chain(lod_chain, packed_lods);
   auto made_mesh = lava::make_mesh<skin_vertex>();
-  made_mesh->add_data(loaded_data);
+  made_mesh->add_data(packed_lods);
   made_mesh->create(app.device);
-  lava::buffer object_buffer;
-  object_buffer.create_mapped(app.device, &mesh_model_mat,
-                              sizeof(mesh_model_mat),
-                              VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+
+  // Blend shape deltas of the packed vertices. Buffers can't be empty, so
+  // the deltas get a placeholder when there are none.
+  GpuMorphTargets morph_targets =
+      build_gpu_morph_targets(morph_set, packed_lods.vertices);
+  if (morph_targets.deltas.empty()) {
+    morph_targets.deltas.push_back({});
+  }
+  lava::buffer morph_range_buffer;
+  morph_range_buffer.create_mapped(
+      app.device, morph_targets.ranges.data(),
+      morph_targets.ranges.size() * sizeof(MorphRange),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  lava::buffer morph_delta_buffer;
+  morph_delta_buffer.create_mapped(
+      app.device, morph_targets.deltas.data(),
+      morph_targets.deltas.size() * sizeof(GpuMorphDelta),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  // The channel count, then the weights of every instance. Channels that
+  // are never animated stay at zero.
+  std::vector<uint32_t> morph_weight_data(
+      1 + max_instances * morph_set.channels.size(), 0);
+  morph_weight_data[0] = morph_set.channels.size();
+  // Buffers written every frame have a copy per frame in flight, plus one,
+  // since on_update runs before the renderer waits for the oldest frame.
+  // Each frame writes and binds the next copy in turn.
+  uint32_t const frame_copy_count = app.target->get_frame_count() + 1;
+  uint32_t frame_copy = 0;
+  std::vector<lava::buffer> camera_buffers(frame_copy_count);
+  for (lava::buffer &buffer : camera_buffers) {
+    buffer.create_mapped(
+        app.device, &camera_buffer_data,
+        sizeof(lava::mat4) + sizeof(app.camera.position),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  }
+  std::vector<lava::buffer> morph_weight_buffers(frame_copy_count);
+  std::vector<float *> instance_morph_weights;
+  for (lava::buffer &buffer : morph_weight_buffers) {
+    buffer.create_mapped(app.device, morph_weight_data.data(),
+                         morph_weight_data.size() * sizeof(uint32_t),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    instance_morph_weights.push_back(reinterpret_cast<float *>(
+        static_cast<uint32_t *>(buffer.get_mapped_data()) + 1));
+  }
+
+  // Crowd instances. Instance 0 is the original character.
+  std::vector<InstanceData> instances =
+      make_crowd_instances(max_instances, 2.0f);
+  instances[0].model = mesh_model_mat;
+  for (auto& instance : instances) {
+    instance.material = mesh_materials[0];
+  }
+  std::vector<lava::buffer> instance_buffers(frame_copy_count);
+  for (lava::buffer &buffer : instance_buffers) {
+    buffer.create_mapped(app.device, instances.data(),
+                         instances.size() * sizeof(InstanceData),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  }
+
+  // Every instance animates on its own, on the job system.
+  std::vector<Character> characters =
+      make_characters(max_instances, anim_clip.frames.size());
+  std::vector<AnimationLodJoints> const animation_lod_joints =
+      build_animation_lod_joints(lod_chain, joint_bounds,
+                                 bones_inverse_bind_mats);
+  uint64_t animation_frame = 0;
+  AnimationLodStats animation_lod_stats{};
+  std::vector<lava::buffer> palette_buffers(frame_copy_count);
+  for (lava::buffer &buffer : palette_buffers) {
+    buffer.create_mapped(
+        app.device, nullptr,
+        max_instances * bones_inverse_bind_mats.size() * sizeof(lava::mat4),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  }
+  JobSystem character_jobs;
+  start_job_system(character_jobs,
+                   std::max(std::thread::hardware_concurrency(), 2u) - 1);
+  app.add_run_end([&]() { stop_job_system(character_jobs); });
+  double character_update_ms = 0;
+
+  // Secondary command buffers of the CPU-culled draws, recorded on the job
+  // threads. Each frame copy has its own pools, so they're reset once the
+  // GPU is done with them.
+  ParallelRecorder crowd_recorder{};
+  success(create_parallel_recorder(crowd_recorder, app.device->get(),
+                                   app.device->get_graphics_queue().family,
+                                   frame_copy_count,
+                                   job_thread_count(character_jobs)),
+          "Failed to create the parallel recorder.");
+  app.add_run_end([&]() { destroy_parallel_recorder(crowd_recorder); });
+  // Set when this frame's CPU-culled draws are recorded on the job threads.
+  bool crowd_parallel = false;
+  double crowd_recording_ms = 0;
+  size_t crowd_secondary_count = 0;
 
   // Make bone buffers
   lava::buffer bone_object_buffer;
@@ -285,251 +494,776 @@ int main(int argc, char *argv[]) {
       bones_inverse_bind_mats.size() * sizeof(lava::mat4),
       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
-  lava::buffer keyframe_cur_trans_buffer;
-  keyframe_cur_trans_buffer.create_mapped(
-      app.device, &bones_keyframe_cur_global_transforms[0],
-      bones_keyframe_cur_global_transforms.size() * sizeof(Transform),
-      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  std::vector<lava::buffer> keyframe_cur_trans_buffers(frame_copy_count);
+  std::vector<lava::buffer> keyframe_next_trans_buffers(frame_copy_count);
+  std::vector<lava::buffer> animation_keyframe_buffers(frame_copy_count);
+  for (uint32_t copy = 0; copy < frame_copy_count; copy++) {
+    keyframe_cur_trans_buffers[copy].create_mapped(
+        app.device, &bones_keyframe_cur_global_transforms[0],
+        bones_keyframe_cur_global_transforms.size() * sizeof(Transform),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    keyframe_next_trans_buffers[copy].create_mapped(
+        app.device, &bones_keyframe_next_global_transforms[0],
+        bones_keyframe_next_global_transforms.size() * sizeof(Transform),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    animation_keyframe_buffers[copy].create_mapped(
+        app.device, &current_keyframe_time, 1 * sizeof(float),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  }
 
-  lava::buffer keyframe_next_trans_buffer;
-  keyframe_next_trans_buffer.create_mapped(
-      app.device, &bones_keyframe_next_global_transforms[0],
-      bones_keyframe_next_global_transforms.size() * sizeof(Transform),
+  // Meshlet culling buffers. Blend shapes move vertices before skinning, so
+  // the joint spheres grow by the furthest every delta could add up to.
+  std::vector<float> morph_offsets(loaded_data.vertices.size(), 0);
+  for (size_t i = 0; i < morph_offsets.size(); i++) {
+    MorphRange const range = morph_targets.ranges[i];
+    for (uint32_t j = range.first; j < range.first + range.count; j++) {
+      morph_offsets[i] += glm::length(morph_targets.deltas[j].position);
+    }
+  }
+  pad_meshlet_joints(meshlet_data, morph_offsets);
+  lava::buffer meshlet_buffer;
+  meshlet_buffer.create(app.device, meshlet_data.meshlets.data(),
+                        meshlet_data.meshlets.size() * sizeof(Meshlet),
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+  lava::buffer meshlet_joint_buffer;
+  meshlet_joint_buffer.create(
+      app.device, meshlet_data.joints.data(),
+      meshlet_data.joints.size() * sizeof(MeshletJoint),
       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
-  lava::buffer animation_keyframe_buffer;
-  animation_keyframe_buffer.create_mapped(app.device, &current_keyframe_time,
-                                          1 * sizeof(float),
-                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  MeshletCullData meshlet_cull_data{};
+  std::vector<lava::buffer> meshlet_cull_buffers(frame_copy_count);
+  for (lava::buffer &buffer : meshlet_cull_buffers) {
+    buffer.create_mapped(app.device, &meshlet_cull_data,
+                         sizeof(MeshletCullData),
+                         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+  }
 
-  lava::graphics_pipeline::ptr mesh_pipeline;
-  lava::descriptor::ptr mesh_descriptor_layout_global;
-  lava::descriptor::ptr mesh_descriptor_layout_textures;
-  lava::descriptor::ptr mesh_descriptor_layout_object;
+  // Instance culling buffers.
+  lava::buffer lod_range_buffer;
+  lod_range_buffer.create(app.device, lod_ranges.data(),
+                          lod_ranges.size() * sizeof(LodRange),
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+  InstanceCullData instance_cull_data{};
+  std::vector<lava::buffer> instance_cull_buffers(frame_copy_count);
+  for (lava::buffer &buffer : instance_cull_buffers) {
+    buffer.create_mapped(app.device, &instance_cull_data,
+                         sizeof(InstanceCullData),
+                         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+  }
+
+  // Persisted across launches, and kept for every recreation of the
+  // pipelines below.
+  std::string const pipeline_cache_path = "pipeline_cache.bin";
+  VkPipelineCache pipeline_cache =
+      load_pipeline_cache(app.device, pipeline_cache_path);
+  app.add_run_end([&]() {
+    success(save_pipeline_cache(app.device, pipeline_cache,
+                                pipeline_cache_path),
+            "Failed to save the pipeline cache.");
+    vkDestroyPipelineCache(app.device->get(), pipeline_cache, nullptr);
+  });
+
+  using shader_module_t = std::tuple<lava::cdata, VkShaderStageFlagBits>;
+  std::vector<shader_module_t> const mesh_shader_modules = {
+      {shader_code(vert_spv), VK_SHADER_STAGE_VERTEX_BIT},
+      {bindless_textures ? shader_code(frag_spv)
+                         : shader_code(frag_material_spv),
+       VK_SHADER_STAGE_FRAGMENT_BIT},
+  };
+  // TODO: Better line shaders
+  std::vector<shader_module_t> const bone_shader_modules = {
+      {shader_code(line_vert_spv), VK_SHADER_STAGE_VERTEX_BIT},
+      {shader_code(line_frag_spv), VK_SHADER_STAGE_FRAGMENT_BIT},
+  };
+  std::vector<shader_module_t> const composite_shader_modules = {
+      {shader_code(composite_vert_spv), VK_SHADER_STAGE_VERTEX_BIT},
+      {shader_code(composite_frag_spv), VK_SHADER_STAGE_FRAGMENT_BIT},
+  };
+  lava::VkVertexInputAttributeDescriptions const mesh_vertex_attributes = {
+      {0, 0, VK_FORMAT_R32G32B32_SFLOAT, (offsetof(skin_vertex, position))},
+      {1, 0, VK_FORMAT_R32G32B32A32_SFLOAT, (offsetof(skin_vertex, color))},
+      {2, 0, VK_FORMAT_R32G32_SFLOAT, (offsetof(skin_vertex, uv))},
+      {3, 0, VK_FORMAT_R32G32B32_SFLOAT, (offsetof(skin_vertex, normal))},
+      {4, 0, VK_FORMAT_R32G32B32A32_UINT,
+       (offsetof(skin_vertex, weight_indices))},
+      {5, 0, VK_FORMAT_R32G32B32A32_SFLOAT,
+       (offsetof(skin_vertex, bone_weights))},
+  };
   lava::pipeline_layout::ptr mesh_pipeline_layout;
-  VkDescriptorSet mesh_descriptor_set_global = VK_NULL_HANDLE;
-  VkDescriptorSet mesh_descriptor_set_textures = VK_NULL_HANDLE;
-  VkDescriptorSet mesh_descriptor_set_object = VK_NULL_HANDLE;
-  VkDescriptorSet mesh_descriptor_set_animation = VK_NULL_HANDLE;
+  auto create_mesh_pipeline = [&](ShaderPermutation const& permutation) {
+    ShaderConstants const constants = make_shader_constants(permutation);
+    return create_graphics_pipeline<skin_vertex>(
+        app, mesh_pipeline_layout, mesh_shader_modules, mesh_vertex_attributes,
+        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, pipeline_cache, &constants);
+  };
+
+  // The shader permutations created so far, keyed by permutation_key(). The
+  // draws bind the permutation of each LOD.
+  std::unordered_map<uint32_t, lava::graphics_pipeline::ptr> mesh_pipelines;
+  std::vector<lava::graphics_pipeline::ptr> lod_pipelines(lod_ranges.size());
+  // Permutations missing from mesh_pipelines are created here. Every one was
+  // prewarmed into the pipeline cache, so that doesn't stall on a compile.
+  auto select_lod_pipelines = [&]() {
+    for (size_t i = 0; i < lod_pipelines.size(); i++) {
+      ShaderPermutation const permutation =
+          select_shader_permutation(lod_chain.lods[i].max_influences,
+                                    skinning_method, mesh_normal_mapped);
+      lava::graphics_pipeline::ptr& pipeline =
+          mesh_pipelines[permutation_key(permutation)];
+      if (!pipeline) {
+        pipeline = create_mesh_pipeline(permutation);
+      }
+      if (!pipeline) {
+        std::cout << "Failed to create the " << permutation_name(permutation)
+                  << " mesh permutation.\n";
+        mesh_pipelines.erase(permutation_key(permutation));
+        return false;
+      }
+      lod_pipelines[i] = pipeline;
+    }
+    return true;
+  };
+  // One set of the whole bindless array, or one per material without it.
+  std::vector<VkDescriptorSet> mesh_descriptor_sets_textures;
+  // Written once the streamed textures settle, then swapped in, since the
+  // bound sets may still be in flight.
+  std::vector<VkDescriptorSet> streamed_descriptor_sets_textures;
+  bool textures_streamed = false;
+  // One of each per frame copy.
+  std::vector<VkDescriptorSet> mesh_descriptor_sets_global;
+  std::vector<VkDescriptorSet> mesh_descriptor_sets_object;
+  std::vector<VkDescriptorSet> mesh_descriptor_sets_animation;
 
   lava::graphics_pipeline::ptr bone_pipeline;
   lava::pipeline_layout::ptr bone_pipeline_layout;
-  VkDescriptorSet bone_descriptor_set_global = VK_NULL_HANDLE;
-  VkDescriptorSet bone_descriptor_set_object = VK_NULL_HANDLE;
+  // One of each per frame copy.
+  std::vector<VkDescriptorSet> bone_descriptor_sets_global;
+  std::vector<VkDescriptorSet> bone_descriptor_sets_object;
+
+  lava::compute_pipeline::ptr meshlet_cull_pipeline;
+  lava::pipeline_layout::ptr meshlet_cull_pipeline_layout;
+  std::vector<VkDescriptorSet> meshlet_cull_descriptor_sets;
+
+  lava::compute_pipeline::ptr instance_cull_pipeline;
+  lava::pipeline_layout::ptr instance_cull_pipeline_layout;
+  std::vector<VkDescriptorSet> instance_cull_descriptor_sets;
 
+  // Parallel-recorded draws render offscreen, and this draws them into the
+  // shading pass. Both are recreated with the render target.
+  OffscreenPass offscreen_pass{};
+  lava::graphics_pipeline::ptr composite_pipeline;
+  lava::pipeline_layout::ptr composite_pipeline_layout;
+  VkDescriptorSet composite_descriptor_set = VK_NULL_HANDLE;
+
+  // Every set is allocated once, here, and lives until the app ends.
+  // Texture sets come in pairs, the bound one and the one streamed textures
+  // are written to. Every other set but the composite one has one per frame
+  // copy.
+  uint32_t const texture_set_count =
+      2 * (bindless_textures ? 1 : material_table.materials.size());
   lava::descriptor::pool::ptr descriptor_pool;
   descriptor_pool = lava::make_descriptor_pool();
-  descriptor_pool->create(app.device,
-                          {
-                              {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 50},
-                              {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 50},
-                              {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 40},
-                          },
-                          90);
+  descriptor_pool->create(
+      app.device,
+      {
+          {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4 * frame_copy_count},
+          {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+           19 * frame_copy_count + texture_set_count},
+          {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+           1 + texture_array_size * texture_set_count},
+      },
+      1 + 7 * frame_copy_count + texture_set_count);
 
-  app.on_create = [&]() {
-    // TODO: Push descriptors to this, then update all here.
-    // std::vector<VkWriteDescriptorSet> descriptor_writes;
-    auto [mesh_descriptor_layout_global, mesh_descriptor_layout_textures,
-          mesh_descriptor_layout_object, mesh_descriptor_layout_animation] =
-        create_mesh_descriptor_layout(app);
-    mesh_pipeline_layout = lava::make_pipeline_layout();
-    mesh_pipeline_layout->add(mesh_descriptor_layout_global);
-    mesh_pipeline_layout->add(mesh_descriptor_layout_textures);
-    mesh_pipeline_layout->add(mesh_descriptor_layout_object);
-    mesh_pipeline_layout->add(mesh_descriptor_layout_animation);
-    mesh_pipeline_layout->create(app.device);
-    mesh_descriptor_set_global =
-        mesh_descriptor_layout_global->allocate(descriptor_pool->get());
-    mesh_descriptor_set_textures =
-        mesh_descriptor_layout_textures->allocate(descriptor_pool->get());
-    mesh_descriptor_set_object =
-        mesh_descriptor_layout_object->allocate(descriptor_pool->get());
-    mesh_descriptor_set_animation =
-        mesh_descriptor_layout_animation->allocate(descriptor_pool->get());
-
-    auto [bone_descriptor_layout_global, bone_descriptor_layout_object] =
-        create_bone_descriptors_layout(app);
-    bone_pipeline_layout = lava::make_pipeline_layout();
-    bone_pipeline_layout->add(bone_descriptor_layout_global);
-    bone_pipeline_layout->add(bone_descriptor_layout_object);
-    bone_pipeline_layout->create(app.device);
-
-    bone_descriptor_set_global =
-        bone_descriptor_layout_global->allocate(descriptor_pool->get());
-    bone_descriptor_set_object =
-        bone_descriptor_layout_object->allocate(descriptor_pool->get());
-
-    // TODO: Move descriptor writes into a new func that also does descriptor
-    // layout allocation.
-    {
-      VkWriteDescriptorSet const descriptor_global{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = mesh_descriptor_set_global,
-          .dstBinding = 0,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-          .pBufferInfo = camera_buffer.get_descriptor_info(),
-      };
-      VkWriteDescriptorSet const descriptor_textures{
+  // GPU time and shader invocations of each pass. The mesh zone includes
+  // skinning, which runs in its vertex shader.
+  GpuProfiler gpu_profiler{};
+  if (create_gpu_profiler(gpu_profiler, app.device,
+                          app.device->get_graphics_queue().family,
+                          pipeline_statistics)) {
+    app.add_run_end([&]() { destroy_gpu_profiler(gpu_profiler); });
+  }
+  uint32_t const culling_zone = add_gpu_zone(gpu_profiler, "culling");
+  uint32_t const mesh_zone = add_gpu_zone(gpu_profiler, "mesh");
+  uint32_t const skeleton_zone = add_gpu_zone(gpu_profiler, "skeleton");
+  uint32_t const ui_zone = add_gpu_zone(gpu_profiler, "ui");
+  lava::graphics_pipeline::ptr profiled_ui_pipeline;
+
+  // Binds the mesh and the sets every draw shares.
+  auto const bind_mesh_sets = [&](VkCommandBuffer cmd_buf) {
+    mesh_pipeline_layout->bind(cmd_buf,
+                               mesh_descriptor_sets_global[frame_copy]);
+    mesh_pipeline_layout->bind(cmd_buf,
+                               mesh_descriptor_sets_object[frame_copy], 2);
+    mesh_pipeline_layout->bind(cmd_buf,
+                               mesh_descriptor_sets_animation[frame_copy], 3);
+    made_mesh->bind(cmd_buf);
+  };
+  // The bindless set, or the set of a draw's material.
+  auto const bind_textures = [&](VkCommandBuffer cmd_buf, uint32_t material) {
+    mesh_pipeline_layout->bind(
+        cmd_buf,
+        mesh_descriptor_sets_textures[bindless_textures ? 0 : material], 1);
+  };
+  // Draws [first, last) of visible_draws. Called from job threads too, so it
+  // only reads shared state.
+  auto const record_visible_draws = [&](VkCommandBuffer cmd_buf, size_t first,
+                                        size_t last) {
+    bind_mesh_sets(cmd_buf);
+    uint32_t bound_lod = UINT32_MAX;
+    uint32_t bound_material = UINT32_MAX;
+    for (size_t i = first; i < last; i++) {
+      InstanceDraw const& draw = visible_draws[i];
+      if (draw.lod != bound_lod) {
+        lod_pipelines[draw.lod]->bind(cmd_buf);
+        bound_lod = draw.lod;
+      }
+      uint32_t const material = instances[draw.instance].material;
+      if (material != bound_material) {
+        bind_textures(cmd_buf, material);
+        bound_material = material;
+      }
+      LodRange const& range = lod_ranges[draw.lod];
+      vkCmdDrawIndexed(cmd_buf, range.index_count, 1, range.first_index,
+                       range.vertex_offset, draw.instance);
+    }
+  };
+
+  // The culling passes, and the crowd's draws that read their output. The
+  // draws render offscreen, and the shading pass composites the result. The
+  // graph places the barriers between them, and skips a culling pass when
+  // its draws are disabled. The indirect draws, counts and offscreen targets
+  // only live within a frame, so the graph owns them, and lets those whose
+  // passes don't overlap share memory.
+  RenderGraph render_graph{};
+  uint32_t const draw_counts_resource = add_transient_graph_buffer(
+      render_graph, "draw counts", lod_ranges.size() * sizeof(uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  // Draws are bucketed by LOD, so every LOD has room for every instance.
+  uint32_t const instance_draws_resource = add_transient_graph_buffer(
+      render_graph, "instance draws",
+      lod_ranges.size() * max_instances * sizeof(VkDrawIndexedIndirectCommand),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+  uint32_t const meshlet_draws_resource = add_transient_graph_buffer(
+      render_graph, "meshlet draws",
+      meshlet_data.meshlets.size() * sizeof(VkDrawIndexedIndirectCommand),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+  // Same formats as the shading pass, so the mesh pipelines draw into them.
+  VkFormat const crowd_color_format = app.target->get_format();
+  auto const depth_format =
+      lava::find_supported_depth_format(app.device->get_vk_physical_device());
+  success(depth_format, "No supported depth format.");
+  VkFormat const crowd_depth_format =
+      depth_format.value_or(VK_FORMAT_UNDEFINED);
+  uint32_t const crowd_color_resource = add_transient_graph_image(
+      render_graph, "crowd color", crowd_color_format,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+  uint32_t const crowd_depth_resource = add_transient_graph_image(
+      render_graph, "crowd depth", crowd_depth_format,
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+  // Every draw pass clears and draws the whole target, so only one of them
+  // is enabled in a frame.
+  std::vector<GraphAccess> const crowd_target_writes = {
+      {crowd_color_resource, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+       VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT},
+      {crowd_depth_resource,
+       VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+           VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+       VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT},
+  };
+  add_graph_pass(
+      render_graph,
+      {
+          .name = "reset draw counts",
+          .writes = {{draw_counts_resource, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                      VK_ACCESS_TRANSFER_WRITE_BIT}},
+          .record =
+              [&](VkCommandBuffer cmd_buf) {
+                vkCmdFillBuffer(cmd_buf,
+                                graph_buffer(render_graph,
+                                             draw_counts_resource),
+                                0, VK_WHOLE_SIZE, 0);
+              },
+          .enabled = true,
+      });
+  add_graph_pass(
+      render_graph,
+      {
+          .name = "instance cull",
+          .reads = {{draw_counts_resource,
+                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                     VK_ACCESS_SHADER_READ_BIT}},
+          .writes = {{draw_counts_resource,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_SHADER_WRITE_BIT},
+                     {instance_draws_resource,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_SHADER_WRITE_BIT}},
+          .record =
+              [&](VkCommandBuffer cmd_buf) {
+                begin_gpu_zone(gpu_profiler, cmd_buf, culling_zone);
+                instance_cull_pipeline->bind(cmd_buf);
+                instance_cull_pipeline_layout->bind(
+                    cmd_buf, instance_cull_descriptor_sets[frame_copy], 0,
+                    {}, VK_PIPELINE_BIND_POINT_COMPUTE);
+                vkCmdDispatch(cmd_buf, (instance_count + 63) / 64, 1, 1);
+                end_gpu_zone(gpu_profiler, cmd_buf, culling_zone);
+              },
+          .enabled = true,
+      });
+  uint32_t const instance_draws_pass = add_graph_pass(
+      render_graph,
+      {
+          .name = "instance draws",
+          .reads = {{draw_counts_resource,
+                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                     VK_ACCESS_INDIRECT_COMMAND_READ_BIT},
+                    {instance_draws_resource,
+                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                     VK_ACCESS_INDIRECT_COMMAND_READ_BIT}},
+          .writes = crowd_target_writes,
+          .record =
+              [&](VkCommandBuffer cmd_buf) {
+                begin_gpu_zone(gpu_profiler, cmd_buf, mesh_zone);
+                begin_offscreen_pass(offscreen_pass, cmd_buf,
+                                     VK_SUBPASS_CONTENTS_INLINE);
+                bind_mesh_sets(cmd_buf);
+                bind_textures(cmd_buf, 0);
+                VkBuffer const draws =
+                    graph_buffer(render_graph, instance_draws_resource);
+                VkBuffer const counts =
+                    graph_buffer(render_graph, draw_counts_resource);
+                // One indirect draw per LOD bucket, each with its
+                // permutation.
+                for (size_t lod = 0; lod < lod_ranges.size(); lod++) {
+                  lod_pipelines[lod]->bind(cmd_buf);
+                  vkCmdDrawIndexedIndirectCountKHR(
+                      cmd_buf, draws,
+                      lod * max_instances *
+                          sizeof(VkDrawIndexedIndirectCommand),
+                      counts, lod * sizeof(uint32_t), instance_count,
+                      sizeof(VkDrawIndexedIndirectCommand));
+                }
+                vkCmdEndRenderPass(cmd_buf);
+                end_gpu_zone(gpu_profiler, cmd_buf, mesh_zone);
+              },
+      });
+  add_graph_pass(
+      render_graph,
+      {
+          .name = "meshlet cull",
+          .writes = {{meshlet_draws_resource,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_SHADER_WRITE_BIT}},
+          .record =
+              [&](VkCommandBuffer cmd_buf) {
+                begin_gpu_zone(gpu_profiler, cmd_buf, culling_zone);
+                meshlet_cull_pipeline->bind(cmd_buf);
+                meshlet_cull_pipeline_layout->bind(
+                    cmd_buf, meshlet_cull_descriptor_sets[frame_copy], 0,
+                    {}, VK_PIPELINE_BIND_POINT_COMPUTE);
+                vkCmdDispatch(cmd_buf,
+                              (meshlet_data.meshlets.size() + 63) / 64, 1,
+                              1);
+                end_gpu_zone(gpu_profiler, cmd_buf, culling_zone);
+              },
+          .enabled = true,
+      });
+  uint32_t const meshlet_draws_pass = add_graph_pass(
+      render_graph,
+      {
+          .name = "meshlet draws",
+          .reads = {{meshlet_draws_resource,
+                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                     VK_ACCESS_INDIRECT_COMMAND_READ_BIT}},
+          .writes = crowd_target_writes,
+          .record =
+              [&](VkCommandBuffer cmd_buf) {
+                begin_gpu_zone(gpu_profiler, cmd_buf, mesh_zone);
+                begin_offscreen_pass(offscreen_pass, cmd_buf,
+                                     VK_SUBPASS_CONTENTS_INLINE);
+                bind_mesh_sets(cmd_buf);
+                bind_textures(cmd_buf, instances[0].material);
+                lod_pipelines[0]->bind(cmd_buf);
+                vkCmdDrawIndexedIndirect(
+                    cmd_buf, graph_buffer(render_graph, meshlet_draws_resource),
+                    0, meshlet_data.meshlets.size(),
+                    sizeof(VkDrawIndexedIndirectCommand));
+                vkCmdEndRenderPass(cmd_buf);
+                end_gpu_zone(gpu_profiler, cmd_buf, mesh_zone);
+              },
+      });
+  // The characters culled on the CPU, recorded inline or on the job threads.
+  uint32_t const crowd_draws_pass = add_graph_pass(
+      render_graph,
+      {
+          .name = "crowd draws",
+          .writes = crowd_target_writes,
+          .record =
+              [&](VkCommandBuffer cmd_buf) {
+                if (!crowd_parallel) {
+                  begin_gpu_zone(gpu_profiler, cmd_buf, mesh_zone);
+                  begin_offscreen_pass(offscreen_pass, cmd_buf,
+                                       VK_SUBPASS_CONTENTS_INLINE);
+                  record_visible_draws(cmd_buf, 0, visible_draws.size());
+                  vkCmdEndRenderPass(cmd_buf);
+                  end_gpu_zone(gpu_profiler, cmd_buf, mesh_zone);
+                  return;
+                }
+                auto const recording_start = std::chrono::steady_clock::now();
+                begin_parallel_recording(crowd_recorder, frame_copy);
+                VkCommandBufferInheritanceInfo inheritance =
+                    offscreen_pass_inheritance(offscreen_pass);
+                inheritance.pipelineStatistics =
+                    gpu_profiler_inherited_statistics(gpu_profiler);
+                std::vector<VkCommandBuffer> const secondaries =
+                    record_parallel(
+                        crowd_recorder, character_jobs, frame_copy,
+                        inheritance, visible_draws.size(),
+                        default_recording_chunk_size,
+                        [&](VkCommandBuffer chunk_buf, size_t first,
+                            size_t last) {
+                          set_offscreen_viewport(offscreen_pass, chunk_buf);
+                          record_visible_draws(chunk_buf, first, last);
+                        });
+                crowd_recording_ms = std::chrono::duration<double, std::milli>(
+                                         std::chrono::steady_clock::now() -
+                                         recording_start)
+                                         .count();
+                crowd_secondary_count = secondaries.size();
+                begin_gpu_zone(gpu_profiler, cmd_buf, mesh_zone);
+                execute_offscreen_pass(offscreen_pass, cmd_buf, secondaries);
+                end_gpu_zone(gpu_profiler, cmd_buf, mesh_zone);
+              },
+      });
+  // Sampled by the composite in the shading pass.
+  add_graph_output(render_graph,
+                   {crowd_color_resource, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                    VK_ACCESS_SHADER_READ_BIT});
+  success(compile_render_graph(render_graph, app.device,
+                               app.target->get_size()),
+          "Failed to compile the render graph.");
+  app.add_run_end([&]() { destroy_render_graph(render_graph); });
+
+  // TODO: Push descriptors to this, then update all here.
+  // std::vector<VkWriteDescriptorSet> descriptor_writes;
+  auto [mesh_descriptor_layout_global, mesh_descriptor_layout_textures,
+        mesh_descriptor_layout_object, mesh_descriptor_layout_animation] =
+      create_mesh_descriptor_layout(app, texture_array_size);
+  mesh_pipeline_layout = lava::make_pipeline_layout();
+  mesh_pipeline_layout->add(mesh_descriptor_layout_global);
+  mesh_pipeline_layout->add(mesh_descriptor_layout_textures);
+  mesh_pipeline_layout->add(mesh_descriptor_layout_object);
+  mesh_pipeline_layout->add(mesh_descriptor_layout_animation);
+  mesh_pipeline_layout->create(app.device);
+  for (uint32_t i = 0; i < texture_set_count / 2; i++) {
+    mesh_descriptor_sets_textures.push_back(
+        mesh_descriptor_layout_textures->allocate(descriptor_pool->get()));
+    streamed_descriptor_sets_textures.push_back(
+        mesh_descriptor_layout_textures->allocate(descriptor_pool->get()));
+  }
+
+  auto [bone_descriptor_layout_global, bone_descriptor_layout_object] =
+      create_bone_descriptors_layout(app);
+  bone_pipeline_layout = lava::make_pipeline_layout();
+  bone_pipeline_layout->add(bone_descriptor_layout_global);
+  bone_pipeline_layout->add(bone_descriptor_layout_object);
+  bone_pipeline_layout->create(app.device);
+
+  lava::descriptor::ptr meshlet_cull_descriptor_layout =
+      create_meshlet_cull_descriptor_layout(app);
+  meshlet_cull_pipeline_layout = lava::make_pipeline_layout();
+  meshlet_cull_pipeline_layout->add(meshlet_cull_descriptor_layout);
+  meshlet_cull_pipeline_layout->create(app.device);
+
+  lava::descriptor::ptr instance_cull_descriptor_layout =
+      create_instance_cull_descriptor_layout(app);
+  instance_cull_pipeline_layout = lava::make_pipeline_layout();
+  instance_cull_pipeline_layout->add(instance_cull_descriptor_layout);
+  instance_cull_pipeline_layout->create(app.device);
+
+  lava::descriptor::ptr composite_descriptor_layout =
+      create_composite_descriptor_layout(app);
+  composite_pipeline_layout = lava::make_pipeline_layout();
+  composite_pipeline_layout->add(composite_descriptor_layout);
+  composite_pipeline_layout->create(app.device);
+  composite_descriptor_set =
+      composite_descriptor_layout->allocate(descriptor_pool->get());
+  for (uint32_t copy = 0; copy < frame_copy_count; copy++) {
+    mesh_descriptor_sets_global.push_back(
+        mesh_descriptor_layout_global->allocate(descriptor_pool->get()));
+    bone_descriptor_sets_global.push_back(
+        bone_descriptor_layout_global->allocate(descriptor_pool->get()));
+    bone_descriptor_sets_object.push_back(
+        bone_descriptor_layout_object->allocate(descriptor_pool->get()));
+    mesh_descriptor_sets_object.push_back(
+        mesh_descriptor_layout_object->allocate(descriptor_pool->get()));
+    mesh_descriptor_sets_animation.push_back(
+        mesh_descriptor_layout_animation->allocate(descriptor_pool->get()));
+    meshlet_cull_descriptor_sets.push_back(
+        meshlet_cull_descriptor_layout->allocate(descriptor_pool->get()));
+    instance_cull_descriptor_sets.push_back(
+        instance_cull_descriptor_layout->allocate(descriptor_pool->get()));
+  }
+  std::vector<lava::descriptor::ptr> const descriptor_layouts = {
+      mesh_descriptor_layout_global,  mesh_descriptor_layout_textures,
+      mesh_descriptor_layout_object,  mesh_descriptor_layout_animation,
+      bone_descriptor_layout_global,  bone_descriptor_layout_object,
+      meshlet_cull_descriptor_layout, instance_cull_descriptor_layout,
+      composite_descriptor_layout,
+  };
+  app.add_run_end([&]() {
+    mesh_pipeline_layout->destroy();
+    bone_pipeline_layout->destroy();
+    meshlet_cull_pipeline_layout->destroy();
+    instance_cull_pipeline_layout->destroy();
+    composite_pipeline_layout->destroy();
+    for (auto const& layout : descriptor_layouts) {
+      layout->destroy();
+    }
+    descriptor_pool->destroy();
+  });
+
+  // Point texture sets at the streamed textures, or placeholders for those
+  // still streaming, and at the material buffer.
+  auto write_texture_sets = [&](std::vector<VkDescriptorSet> const& sets) {
+    std::vector<std::vector<VkDescriptorImageInfo>> infos;
+    if (bindless_textures) {
+      infos.push_back(bindless_texture_infos(material_table,
+                                             streamed_textures,
+                                             placeholder_textures,
+                                             texture_array_size));
+    } else {
+      for (size_t i = 0; i < material_table.materials.size(); i++) {
+        auto const slots = material_texture_infos(
+            material_table, i, streamed_textures, placeholder_textures);
+        infos.emplace_back(slots.begin(), slots.end());
+      }
+    }
+    std::vector<VkWriteDescriptorSet> writes;
+    for (size_t i = 0; i < sets.size(); i++) {
+      writes.push_back({
           .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = mesh_descriptor_set_textures,
+          .dstSet = sets[i],
           .dstBinding = 0,
-          .descriptorCount = 4,
+          .descriptorCount = static_cast<uint32_t>(infos[i].size()),
           .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-          .pImageInfo = &textures_descriptor_info.front(),
-      };
-      VkWriteDescriptorSet const descriptor_object{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = mesh_descriptor_set_object,
-          .dstBinding = 0,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-          .pBufferInfo = object_buffer.get_descriptor_info(),
-      };
-      VkWriteDescriptorSet const descriptor_animation_mesh_inversebind{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = mesh_descriptor_set_animation,
-          .dstBinding = 0,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-          .pBufferInfo = bone_inverse_bind_mats_buffer.get_descriptor_info(),
-      };
-      VkWriteDescriptorSet const descriptor_animation_mesh_keyframe_trans_curr{
+          .pImageInfo = infos[i].data(),
+      });
+      writes.push_back({
           .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = mesh_descriptor_set_animation,
+          .dstSet = sets[i],
           .dstBinding = 1,
           .descriptorCount = 1,
           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-          .pBufferInfo = keyframe_cur_trans_buffer.get_descriptor_info(),
-      };
-      VkWriteDescriptorSet const descriptor_animation_mesh_keyframe_trans_next{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = mesh_descriptor_set_animation,
-          .dstBinding = 2,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-          .pBufferInfo = keyframe_next_trans_buffer.get_descriptor_info(),
-      };
-      VkWriteDescriptorSet const descriptor_animation_mesh_keyframe_time{
+          .pBufferInfo = material_buffer.get_descriptor_info(),
+      });
+    }
+    app.device->vkUpdateDescriptorSets(writes.size(), writes.data());
+  };
+  write_texture_sets(mesh_descriptor_sets_textures);
+
+  // The sets reading each copy of the buffers written every frame.
+  for (uint32_t copy = 0; copy < frame_copy_count; copy++) {
+    auto storage_write = [&](VkDescriptorSet set, uint32_t binding,
+                             lava::buffer& buffer) {
+      return VkWriteDescriptorSet{
           .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = mesh_descriptor_set_animation,
-          .dstBinding = 3,
+          .dstSet = set,
+          .dstBinding = binding,
           .descriptorCount = 1,
           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-          .pBufferInfo = animation_keyframe_buffer.get_descriptor_info(),
+          .pBufferInfo = buffer.get_descriptor_info(),
       };
-
-      VkWriteDescriptorSet const descriptor_global_bone{
+    };
+    auto uniform_write = [&](VkDescriptorSet set, lava::buffer& buffer) {
+      return VkWriteDescriptorSet{
           .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = bone_descriptor_set_global,
+          .dstSet = set,
           .dstBinding = 0,
           .descriptorCount = 1,
           .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-          .pBufferInfo = camera_buffer.get_descriptor_info(),
+          .pBufferInfo = buffer.get_descriptor_info(),
       };
-      VkWriteDescriptorSet const descriptor_object_bone_model{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = bone_descriptor_set_object,
-          .dstBinding = 0,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-          .pBufferInfo = bone_object_buffer.get_descriptor_info(),
-      };
-      VkWriteDescriptorSet const descriptor_object_bone_inversebind{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = bone_descriptor_set_object,
-          .dstBinding = 1,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-          .pBufferInfo = bone_inverse_bind_mats_buffer.get_descriptor_info(),
-      };
-      VkWriteDescriptorSet const descriptor_object_bone_keyframe_trans_curr{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = bone_descriptor_set_object,
-          .dstBinding = 2,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-          .pBufferInfo = keyframe_cur_trans_buffer.get_descriptor_info(),
-      };
-      VkWriteDescriptorSet const descriptor_object_bone_keyframe_trans_next{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = bone_descriptor_set_object,
-          .dstBinding = 3,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-          .pBufferInfo = keyframe_next_trans_buffer.get_descriptor_info(),
-      };
-      VkWriteDescriptorSet const descriptor_object_bone_keyframe_time{
+    };
+    VkDescriptorSet const object_set = mesh_descriptor_sets_object[copy];
+    VkDescriptorSet const animation_set =
+        mesh_descriptor_sets_animation[copy];
+    VkDescriptorSet const meshlet_cull_set =
+        meshlet_cull_descriptor_sets[copy];
+    VkDescriptorSet const instance_cull_set =
+        instance_cull_descriptor_sets[copy];
+    VkDescriptorSet const bone_object_set = bone_descriptor_sets_object[copy];
+    app.device->vkUpdateDescriptorSets({
+        uniform_write(mesh_descriptor_sets_global[copy], camera_buffers[copy]),
+        uniform_write(bone_descriptor_sets_global[copy], camera_buffers[copy]),
+        storage_write(bone_object_set, 0, bone_object_buffer),
+        storage_write(bone_object_set, 1, bone_inverse_bind_mats_buffer),
+        storage_write(bone_object_set, 2, keyframe_cur_trans_buffers[copy]),
+        storage_write(bone_object_set, 3, keyframe_next_trans_buffers[copy]),
+        storage_write(bone_object_set, 4, animation_keyframe_buffers[copy]),
+        storage_write(object_set, 0, instance_buffers[copy]),
+        storage_write(animation_set, 0, bone_inverse_bind_mats_buffer),
+        storage_write(animation_set, 1, palette_buffers[copy]),
+        storage_write(animation_set, 2, morph_range_buffer),
+        storage_write(animation_set, 3, morph_delta_buffer),
+        storage_write(animation_set, 4, morph_weight_buffers[copy]),
+        uniform_write(meshlet_cull_set, meshlet_cull_buffers[copy]),
+        storage_write(meshlet_cull_set, 1, meshlet_buffer),
+        storage_write(meshlet_cull_set, 3, meshlet_joint_buffer),
+        storage_write(meshlet_cull_set, 4, palette_buffers[copy]),
+        uniform_write(instance_cull_set, instance_cull_buffers[copy]),
+        storage_write(instance_cull_set, 1, instance_buffers[copy]),
+        storage_write(instance_cull_set, 2, lod_range_buffer),
+    });
+  }
+
+  // Point the culling sets at the graph's buffers, which are recreated with
+  // the render target. They're bound whole.
+  auto write_graph_sets = [&]() {
+    VkDescriptorBufferInfo const meshlet_draws_info{
+        graph_buffer(render_graph, meshlet_draws_resource), 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo const instance_draws_info{
+        graph_buffer(render_graph, instance_draws_resource), 0,
+        VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo const draw_count_info{
+        graph_buffer(render_graph, draw_counts_resource), 0, VK_WHOLE_SIZE};
+    auto graph_write = [&](VkDescriptorSet set, uint32_t binding,
+                           VkDescriptorBufferInfo const& info) {
+      return VkWriteDescriptorSet{
           .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = bone_descriptor_set_object,
-          .dstBinding = 4,
+          .dstSet = set,
+          .dstBinding = binding,
           .descriptorCount = 1,
           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-          .pBufferInfo = animation_keyframe_buffer.get_descriptor_info(),
+          .pBufferInfo = &info,
       };
-
-      app.device->vkUpdateDescriptorSets({
-          descriptor_global,
-          descriptor_textures,
-          descriptor_object,
-          descriptor_animation_mesh_inversebind,
-          descriptor_animation_mesh_keyframe_trans_curr,
-          descriptor_animation_mesh_keyframe_trans_next,
-          descriptor_animation_mesh_keyframe_time,
-          descriptor_global_bone,
-          descriptor_object_bone_model,
-          descriptor_object_bone_inversebind,
-          descriptor_object_bone_keyframe_trans_curr,
-          descriptor_object_bone_keyframe_trans_next,
-          descriptor_object_bone_keyframe_time,
-      });
-
-      // Loading shaders
-      {
-        using shader_module_t = std::tuple<std::string, VkShaderStageFlagBits>;
-        auto shader_modules = std::vector<shader_module_t>();
-        shader_modules.push_back(
-            shader_module_t("../res/vert.spv", VK_SHADER_STAGE_VERTEX_BIT));
-        shader_modules.push_back(
-            shader_module_t("../res/frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT));
-        mesh_pipeline = create_graphics_pipeline<skin_vertex>(
-            app, mesh_pipeline_layout, shader_modules,
-            {
-                {0, 0, VK_FORMAT_R32G32B32_SFLOAT,
-                 (offsetof(skin_vertex, position))},
-                {1, 0, VK_FORMAT_R32G32B32A32_SFLOAT,
-                 (offsetof(skin_vertex, color))},
-                {2, 0, VK_FORMAT_R32G32_SFLOAT, (offsetof(skin_vertex, uv))},
-                {3, 0, VK_FORMAT_R32G32B32_SFLOAT,
-                 (offsetof(skin_vertex, normal))},
-                {4, 0, VK_FORMAT_R32G32B32A32_UINT,
-                 (offsetof(skin_vertex, weight_indices))},
-                {5, 0, VK_FORMAT_R32G32B32A32_SFLOAT,
-                 (offsetof(skin_vertex, bone_weights))},
-            },
-            VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-      }
+    };
+    std::vector<VkWriteDescriptorSet> writes;
+    for (uint32_t copy = 0; copy < frame_copy_count; copy++) {
+      writes.push_back(graph_write(meshlet_cull_descriptor_sets[copy], 2,
+                                   meshlet_draws_info));
+      writes.push_back(graph_write(instance_cull_descriptor_sets[copy], 3,
+                                   instance_draws_info));
+      writes.push_back(graph_write(instance_cull_descriptor_sets[copy], 4,
+                                   draw_count_info));
     }
+    app.device->vkUpdateDescriptorSets(writes.size(), writes.data());
+  };
 
-    {
-      // TODO: Better line shaders
-      using shader_module_t = std::tuple<std::string, VkShaderStageFlagBits>;
-      auto shader_modules = std::vector<shader_module_t>();
-      shader_modules.push_back(
-          shader_module_t("../res/line_vert.spv", VK_SHADER_STAGE_VERTEX_BIT));
-      shader_modules.push_back(shader_module_t("../res/line_frag.spv",
-                                               VK_SHADER_STAGE_FRAGMENT_BIT));
-      bone_pipeline = create_graphics_pipeline<lava::vertex>(
-          app, bone_pipeline_layout, shader_modules,
+  // Set once every permutation has been through the pipeline cache.
+  bool pipelines_prewarmed = false;
+  app.on_create = [&]() {
+    // Build every pipeline on its own thread. They share the pipeline cache,
+    // so after the first launch (or on recreation) these are cache hits.
+    TraceZone pipelines_zone("pipeline creation");
+    auto const pipelines_start = std::chrono::steady_clock::now();
+    // The first time, build every permutation, so switching LODs or
+    // skinning methods never stalls on a pipeline compile. Recreations only
+    // need the permutations in use, and create the rest on demand.
+    std::vector<ShaderPermutation> const permutations =
+        pipelines_prewarmed ? std::vector<ShaderPermutation>{}
+                            : all_shader_permutations();
+    std::vector<std::future<lava::graphics_pipeline::ptr>>
+        mesh_pipeline_futures;
+    for (auto const& permutation : permutations) {
+      mesh_pipeline_futures.push_back(std::async(
+          std::launch::async,
+          [&, permutation]() { return create_mesh_pipeline(permutation); }));
+    }
+    auto bone_pipeline_future = std::async(std::launch::async, [&]() {
+      return create_graphics_pipeline<lava::vertex>(
+          app, bone_pipeline_layout, bone_shader_modules,
           {
               {0, 0, VK_FORMAT_R32G32B32_SFLOAT,
                (offsetof(lava::vertex, position))},
               {1, 0, VK_FORMAT_R32G32B32A32_SFLOAT,
                (offsetof(lava::vertex, color))},
           },
-          VK_PRIMITIVE_TOPOLOGY_LINE_LIST);
+          VK_PRIMITIVE_TOPOLOGY_LINE_LIST, pipeline_cache);
+    });
+    // A fullscreen triangle, with no vertex attributes.
+    auto composite_pipeline_future = std::async(std::launch::async, [&]() {
+      return create_graphics_pipeline<lava::vertex>(
+          app, composite_pipeline_layout, composite_shader_modules, {},
+          VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, pipeline_cache);
+    });
+    auto meshlet_cull_pipeline_future = std::async(std::launch::async, [&]() {
+      return create_compute_pipeline(app, meshlet_cull_pipeline_layout,
+                                     shader_code(meshlet_cull_spv),
+                                     pipeline_cache);
+    });
+    auto instance_cull_pipeline_future = std::async(std::launch::async, [&]() {
+      return create_compute_pipeline(app, instance_cull_pipeline_layout,
+                                     shader_code(instance_cull_spv),
+                                     pipeline_cache);
+    });
+    for (size_t i = 0; i < permutations.size(); i++) {
+      lava::graphics_pipeline::ptr pipeline = mesh_pipeline_futures[i].get();
+      if (!pipeline) {
+        std::cout << "Failed to create the "
+                  << permutation_name(permutations[i])
+                  << " mesh permutation.\n";
+        return false;
+      }
+      mesh_pipelines[permutation_key(permutations[i])] = pipeline;
     }
+    pipelines_prewarmed = true;
+    bone_pipeline = bone_pipeline_future.get();
+    composite_pipeline = composite_pipeline_future.get();
+    meshlet_cull_pipeline = meshlet_cull_pipeline_future.get();
+    instance_cull_pipeline = instance_cull_pipeline_future.get();
+    if (!select_lod_pipelines() || !bone_pipeline || !composite_pipeline) {
+      return false;
+    }
+    app.shading.get_pass()->add(bone_pipeline);
+    app.shading.get_pass()->add(composite_pipeline);
+
+    // The crowd's targets are sized like the render target.
+    if (render_graph.size != app.target->get_size() &&
+        !resize_render_graph(render_graph, app.target->get_size())) {
+      return false;
+    }
+    write_graph_sets();
+    if (!create_offscreen_pass(
+            offscreen_pass, app.device, crowd_color_format,
+            graph_image_view(render_graph, crowd_color_resource),
+            crowd_depth_format,
+            graph_image_view(render_graph, crowd_depth_resource),
+            app.target->get_size())) {
+      return false;
+    }
+    VkDescriptorImageInfo const composite_color =
+        offscreen_color_info(offscreen_pass);
+    VkWriteDescriptorSet const descriptor_composite{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = composite_descriptor_set,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &composite_color,
+    };
+    app.device->vkUpdateDescriptorSets({descriptor_composite});
+    // Time the UI by wrapping the ImGui pipeline's draw, once per pipeline.
+    lava::graphics_pipeline::ptr ui_pipeline = app.imgui.get_pipeline();
+    if (ui_pipeline && ui_pipeline != profiled_ui_pipeline) {
+      auto draw_ui = ui_pipeline->on_process;
+      ui_pipeline->on_process = [&, draw_ui](VkCommandBuffer cmd_buf) {
+        begin_gpu_zone(gpu_profiler, cmd_buf, ui_zone);
+        draw_ui(cmd_buf);
+        end_gpu_zone(gpu_profiler, cmd_buf, ui_zone);
+      };
+      profiled_ui_pipeline = ui_pipeline;
+    }
+    pipelines_zone.end();
+    std::cout << "Created " << mesh_pipelines.size() + 4 << " pipelines in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - pipelines_start)
+                     .count()
+              << " ms\n";
 
     // Default to rendering the mesh.
     render_mode = mesh;
@@ -537,6 +1271,36 @@ int main(int argc, char *argv[]) {
     return true;
   };
 
+  // Pipelines belong to the render pass they were built for, and the
+  // offscreen pass to the graph's targets, which are sized like the render
+  // target, so they're destroyed with it and rebuilt by on_create.
+  app.on_destroy = [&]() {
+    if (bone_pipeline) {
+      app.shading.get_pass()->remove(bone_pipeline);
+    }
+    if (composite_pipeline) {
+      app.shading.get_pass()->remove(composite_pipeline);
+    }
+    for (auto& [key, pipeline] : mesh_pipelines) {
+      pipeline->destroy();
+    }
+    mesh_pipelines.clear();
+    std::fill(lod_pipelines.begin(), lod_pipelines.end(), nullptr);
+    for (auto const& pipeline :
+         std::initializer_list<lava::pipeline::ptr>{
+             bone_pipeline, composite_pipeline, meshlet_cull_pipeline,
+             instance_cull_pipeline}) {
+      if (pipeline) {
+        pipeline->destroy();
+      }
+    }
+    bone_pipeline = nullptr;
+    composite_pipeline = nullptr;
+    meshlet_cull_pipeline = nullptr;
+    instance_cull_pipeline = nullptr;
+    destroy_offscreen_pass(offscreen_pass);
+  };
+
   app.imgui.on_draw = [&]() {
     ImGui::SetNextWindowPos({30, 30}, ImGuiCond_FirstUseEver);
     ImGui::SetNextWindowSize({330, 485}, ImGuiCond_FirstUseEver);
@@ -555,6 +1319,73 @@ int main(int argc, char *argv[]) {
     }
     ImGui::Separator();
     ImGui::Spacing();
+    ImGui::SliderInt("Instances", &instance_count, 1, max_instances);
+    // Indirect draws can't switch texture sets between materials.
+    if (bindless_textures && multi_draw_indirect) {
+      ImGui::Checkbox("GPU-driven culling", &gpu_driven);
+    }
+    ImGui::Checkbox("Frustum culling", &frustum_culling);
+    if (!gpu_driven) {
+      ImGui::Text("Visible instances: %zu", visible_draws.size());
+      ImGui::Checkbox("Parallel recording", &parallel_recording);
+      if (crowd_parallel) {
+        ImGui::Text("Recorded in %.3f ms, %zu command buffers",
+                    crowd_recording_ms, crowd_secondary_count);
+      }
+    }
+    ImGui::Text("Character update: %.3f ms on %zu threads",
+                character_update_ms, job_thread_count(character_jobs));
+    ImGui::Checkbox("Animation LOD", &animation_lod);
+    ImGui::Checkbox("Root motion", &root_motion);
+    if (ImGui::Combo("Crowd clip", &crowd_clip, crowd_clip_names.data(),
+                     crowd_clip_names.size())) {
+      // Start over on the new clip, whose times and root motion don't
+      // follow on from the old one's. Retargeted clips carry no blend
+      // shape weights.
+      for (Character &character : characters) {
+        character.posed = false;
+      }
+      crowd_clip_time = 0;
+      for (float *weights : instance_morph_weights) {
+        std::fill_n(weights, max_instances * morph_set.channels.size(), 0.f);
+      }
+    }
+    ImGui::SliderInt("Joint budget", &animation_joint_budget, 0,
+                     max_instances * bones_inverse_bind_mats.size());
+    ImGui::Text("Sampled %zu characters, %zu joints, %zu deferred",
+                animation_lod_stats.characters_sampled,
+                animation_lod_stats.joints_sampled,
+                animation_lod_stats.characters_deferred);
+    ImGui::Text("Render graph: %zu passes, %zu culled, %zu barriers",
+                render_graph.stats.passes_run,
+                render_graph.stats.passes_culled,
+                render_graph.stats.barriers);
+    if (multi_draw_indirect) {
+      ImGui::Checkbox("Meshlet culling", &meshlet_culling);
+      ImGui::Checkbox("Cone culling", &meshlet_cone_culling);
+    }
+    ImGui::SliderInt("Force LOD", &forced_lod, -1, lod_chain.lods.size() - 1);
+    ImGui::DragFloat("LOD bias", &lod_bias, 0.01f, 0.01f, 10.f);
+    ImGui::Text("LOD %zu: %zu triangles, %zu joints", current_lod,
+                lod_chain.lods[current_lod].data.indices.size() / 3,
+                lod_chain.lods[current_lod].kept_joint_count);
+    bool dual_quaternion = skinning_method == SkinningMethod::dual_quaternion;
+    if (ImGui::Checkbox("Dual quaternion skinning", &dual_quaternion)) {
+      skinning_method = dual_quaternion ? SkinningMethod::dual_quaternion
+                                        : SkinningMethod::linear;
+      if (!select_lod_pipelines()) {
+        skinning_method = dual_quaternion ? SkinningMethod::linear
+                                          : SkinningMethod::dual_quaternion;
+        select_lod_pipelines();
+      }
+    }
+    ImGui::Text("Shader: %s",
+                permutation_name(select_shader_permutation(
+                                     lod_chain.lods[current_lod].max_influences,
+                                     skinning_method, mesh_normal_mapped))
+                    .c_str());
+    ImGui::Separator();
+    ImGui::Spacing();
     if (ImGui::Button("Pause / Play")) animating = !animating;
     ImGui::Text("Keyframe %zu / %.3f", current_keyframe_index - 1,
                 anim_clip.duration - 1.f);
@@ -568,6 +1399,16 @@ int main(int argc, char *argv[]) {
     ImGui::SameLine();
     if (ImGui::Button("Next Frame"))
       current_keyframe_time = floor(current_keyframe_time + 1);
+    ImGui::Separator();
+    ImGui::Spacing();
+    if (ImGui::CollapsingHeader("GPU profiler",
+                                ImGuiTreeNodeFlags_DefaultOpen)) {
+      draw_gpu_profiler(gpu_profiler);
+    }
+    // Open in chrome://tracing or Perfetto.
+    if (ImGui::Button("Write CPU trace")) {
+      write_chrome_trace("trace.json");
+    }
     ImGui::End();
   };
 
@@ -583,12 +1424,17 @@ int main(int argc, char *argv[]) {
   });
 
   app.on_update = [&](lava::delta dt) {
+    TRACE_SCOPE("on_update");
     app.camera.update_view(dt, app.input.get_mouse_position());
     app.camera.update_projection();
-    mesh_pipeline->on_process = nullptr;
     bone_pipeline->on_process = nullptr;
+    composite_pipeline->on_process = nullptr;
+    crowd_parallel = false;
+    // Write and bind the next copy, which the GPU has finished reading.
+    frame_copy = (frame_copy + 1) % frame_copy_count;
 
-    current_keyframe_time += dt * 10.f * animating;
+    double const keyframe_step = dt * 10.f * animating;
+    current_keyframe_time += keyframe_step;
     if (current_keyframe_time > anim_clip.duration) {
       current_keyframe_time = 1;
     } else if (current_keyframe_time == 0) {
@@ -600,47 +1446,191 @@ int main(int argc, char *argv[]) {
     camera_buffer_data.view_proj = app.camera.get_view_projection();
     camera_buffer_data.cam_pos = app.camera.position;
 
-    memcpy(camera_buffer.get_mapped_data(), &camera_buffer_data,
-           // sizeof(camera_buffer_data));
+    memcpy(camera_buffers[frame_copy].get_mapped_data(), &camera_buffer_data,
            sizeof(lava::mat4) + sizeof(app.camera.position));
 
     if (render_mode == mesh) {
-      memcpy(object_buffer.get_mapped_data(), &mesh_model_mat,
-             sizeof(mesh_model_mat));
-
-      mesh_pipeline->on_process = [&](VkCommandBuffer cmd_buf) {
-        mesh_pipeline_layout->bind(cmd_buf, mesh_descriptor_set_global);
-        mesh_pipeline_layout->bind(cmd_buf, mesh_descriptor_set_textures, 1);
-        mesh_pipeline_layout->bind(cmd_buf, mesh_descriptor_set_object, 2);
-        mesh_pipeline_layout->bind(cmd_buf, mesh_descriptor_set_animation, 3);
-        made_mesh->bind_draw(cmd_buf);
+      // The render graph draws the crowd offscreen.
+      composite_pipeline->on_process = [&](VkCommandBuffer cmd_buf) {
+        composite_pipeline_layout->bind(cmd_buf, composite_descriptor_set);
+        vkCmdDraw(cmd_buf, 3, 1, 0, 0);
       };
+      Frustum frustum = extract_frustum(camera_buffer_data.view_proj);
+      if (!frustum_culling) {
+        // Planes that every point is in front of.
+        frustum.planes.fill(lava::v4(0, 0, 0, 1));
+      }
+
+      // Retargeted clips keep their own time, as their lengths differ from
+      // the character's clip.
+      RetargetedClip const *retargeted =
+          crowd_clip > 0 ? &retargeted_clips[crowd_clip - 1] : nullptr;
+      if (retargeted && !retargeted->clip.frames.empty()) {
+        crowd_clip_time = std::fmod(crowd_clip_time + keyframe_step,
+                                    retargeted->clip.frames.size());
+      }
+
+      // Animate, skin and cull every character across the job system.
+      CharacterFrame const character_frame{
+          .clip = retargeted ? &retargeted->clip : &anim_clip,
+          .inverse_bind = &bones_inverse_bind_mats,
+          .joint_bounds = &joint_bounds,
+          .lod_chain = &lod_chain,
+          .time = retargeted ? crowd_clip_time : current_keyframe_time,
+          .frustum = frustum,
+          .camera_position = app.camera.position,
+          .fov_y_degrees = app.camera.fov,
+          .lod_bias = lod_bias,
+          .forced_lod = forced_lod,
+          .animation_tiers =
+              animation_lod ? &default_animation_lod_tiers : nullptr,
+          .lod_joints = animation_lod ? &animation_lod_joints : nullptr,
+          .joint_budget = static_cast<size_t>(animation_joint_budget),
+          .frame_index = animation_frame++,
+          .time_step = keyframe_step,
+          .root_motion = root_motion,
+          .morph_set = retargeted ? nullptr : &morph_set,
+          .retarget = retargeted ? &retargeted->map : nullptr,
+          .palette_copy = frame_copy,
+      };
+      auto const update_start = std::chrono::steady_clock::now();
+      animation_lod_stats = update_characters(
+          character_jobs, character_frame, instances, characters,
+          instance_count,
+          static_cast<lava::mat4 *>(
+              palette_buffers[frame_copy].get_mapped_data()),
+          instance_morph_weights[frame_copy]);
+      auto *placed_instances = static_cast<InstanceData *>(
+          instance_buffers[frame_copy].get_mapped_data());
+      for (size_t i = 0; i < instance_count; i++) {
+        placed_instances[i].model = characters[i].model;
+        placed_instances[i].pose_sphere =
+            pose_sphere(characters[i].pose_bounds);
+      }
+      character_update_ms = std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() -
+                                update_start)
+                                .count();
+
+      if (gpu_driven) {
+        meshlets_active = false;
+        instance_cull_data.frustum_planes = frustum.planes;
+        instance_cull_data.camera_pos = lava::v4(app.camera.position, 1);
+        instance_cull_data.instance_count = instance_count;
+        instance_cull_data.lod_count = lod_ranges.size();
+        instance_cull_data.lod_scale =
+            lod_bias / std::tan(glm::radians(app.camera.fov) * 0.5f);
+        instance_cull_data.forced_lod = forced_lod;
+        memcpy(instance_cull_buffers[frame_copy].get_mapped_data(),
+               &instance_cull_data, sizeof(instance_cull_data));
+        return true;
+      }
+
+      // Otherwise, draw the characters culled on the CPU, with the same
+      // sphere test as instance_cull.comp.
+      visible_draws.clear();
+      for (size_t i = 0; i < instance_count; i++) {
+        if (characters[i].visible) {
+          visible_draws.push_back(
+              {static_cast<uint32_t>(i), characters[i].lod});
+        }
+      }
+      // Group draws by LOD, so each permutation is bound once, then by
+      // material for per-material texture sets.
+      std::stable_sort(visible_draws.begin(), visible_draws.end(),
+                       [&](InstanceDraw const& a, InstanceDraw const& b) {
+                         return std::make_pair(
+                                    a.lod, instances[a.instance].material) <
+                                std::make_pair(
+                                    b.lod, instances[b.instance].material);
+                       });
+      if (visible_draws.empty()) {
+        meshlets_active = false;
+        return true;
+      }
+      current_lod = visible_draws[0].lod;
+
+      // Meshlets only cover LOD 0 of a lone character.
+      meshlets_active = meshlet_culling && instance_count == 1 &&
+                        current_lod == 0;
+      if (meshlets_active) {
+        meshlet_cull_data.model = characters[0].model;
+        meshlet_cull_data.frustum_planes = frustum.planes;
+        meshlet_cull_data.camera_pos = lava::v4(app.camera.position, 1);
+        meshlet_cull_data.meshlet_count = meshlet_data.meshlets.size();
+        meshlet_cull_data.radius_scale =
+            std::max({glm::length(lava::v3(instances[0].model[0])),
+                      glm::length(lava::v3(instances[0].model[1])),
+                      glm::length(lava::v3(instances[0].model[2]))});
+        // The lone character's palette comes first.
+        meshlet_cull_data.palette_offset = 0;
+        meshlet_cull_data.cone_culling = meshlet_cone_culling;
+        memcpy(meshlet_cull_buffers[frame_copy].get_mapped_data(),
+               &meshlet_cull_data, sizeof(meshlet_cull_data));
+      }
+
+      // Meshlet draws are a single indirect draw, so only the CPU-culled
+      // draws are worth recording on the job threads.
+      crowd_parallel = parallel_recording && !meshlets_active;
     } else if (render_mode == skeleton) {
-      memcpy(keyframe_cur_trans_buffer.get_mapped_data(),
+      memcpy(keyframe_cur_trans_buffers[frame_copy].get_mapped_data(),
              &anim_clip.frames[current_keyframe_index].transforms[0],
              sizeof(anim_clip.frames[0].transforms[0]) *
                  anim_clip.frames[current_keyframe_index].transforms.size());
       memcpy(
-          keyframe_next_trans_buffer.get_mapped_data(),
+          keyframe_next_trans_buffers[frame_copy].get_mapped_data(),
           &anim_clip.frames[current_keyframe_index + 1].transforms[0],
           sizeof(anim_clip.frames[0].transforms[0]) *
               anim_clip.frames[current_keyframe_index + 1].transforms.size());
 
       float keyframe_time_remainder = fmod(current_keyframe_time, 1.f);
-      memcpy(animation_keyframe_buffer.get_mapped_data(),
+      memcpy(animation_keyframe_buffers[frame_copy].get_mapped_data(),
              &keyframe_time_remainder, sizeof(float));
 
       bone_pipeline->on_process = [&](VkCommandBuffer cmd_buf) {
-        bone_pipeline_layout->bind(cmd_buf, bone_descriptor_set_global);
+        bone_pipeline_layout->bind(cmd_buf,
+                                   bone_descriptor_sets_global[frame_copy]);
         // TODO: Figure out how to make this work with binding at 2 instead
         // of 1:
-        bone_pipeline_layout->bind(cmd_buf, bone_descriptor_set_object, 1);
+        bone_pipeline_layout->bind(cmd_buf,
+                                   bone_descriptor_sets_object[frame_copy], 1);
+        begin_gpu_zone(gpu_profiler, cmd_buf, skeleton_zone);
         bones_mesh->bind_draw(cmd_buf);
+        end_gpu_zone(gpu_profiler, cmd_buf, skeleton_zone);
       };
     }
     return true;
   };
 
+  // Run the culling passes and draw the crowd before the render pass
+  // begins.
+  app.on_process = [&](VkCommandBuffer cmd_buf, lava::index frame) {
+    begin_gpu_profiler_frame(gpu_profiler, cmd_buf);
+    if (!textures_streamed) {
+      acquire_streamed_textures(texture_streamer, cmd_buf);
+      if (all_textures_settled(texture_streamer)) {
+        for (size_t i = 0; i < texture_handles.size(); i++) {
+          streamed_textures[i] =
+              get_streamed_texture(texture_streamer, texture_handles[i]);
+        }
+        write_texture_sets(streamed_descriptor_sets_textures);
+        std::swap(mesh_descriptor_sets_textures,
+                  streamed_descriptor_sets_textures);
+        textures_streamed = true;
+      }
+    }
+    bool const instance_draws =
+        render_mode == mesh && gpu_driven && instance_cull_pipeline;
+    bool const meshlet_draws = render_mode == mesh && !gpu_driven &&
+                               meshlets_active && meshlet_cull_pipeline;
+    set_graph_pass_enabled(render_graph, instance_draws_pass, instance_draws);
+    set_graph_pass_enabled(render_graph, meshlet_draws_pass, meshlet_draws);
+    set_graph_pass_enabled(render_graph, crowd_draws_pass,
+                           render_mode == mesh && !gpu_driven &&
+                               !meshlet_draws);
+    execute_render_graph(render_graph, cmd_buf);
+  };
+
   fbx_manager->Destroy();
   return app.run();
 }
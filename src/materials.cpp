@@ -0,0 +1,260 @@
+#include "materials.h"
+
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+typedef struct {
+  MaterialSlot slot;
+  TextureUsage usage;
+  // Properties to try, in order.
+  std::array<char const *, 2> properties;
+} SlotProperties;
+
+std::array<SlotProperties, material_slot_count> const slot_properties = {{
+    {diffuse_slot, TextureUsage::color,
+     {FbxSurfaceMaterial::sDiffuse, nullptr}},
+    {emissive_slot, TextureUsage::color,
+     {FbxSurfaceMaterial::sEmissive, nullptr}},
+    {normal_slot, TextureUsage::normal,
+     {FbxSurfaceMaterial::sNormalMap, FbxSurfaceMaterial::sBump}},
+    {specular_slot, TextureUsage::specular,
+     {FbxSurfaceMaterial::sSpecular, FbxSurfaceMaterial::sSpecularFactor}},
+}};
+
+fn find_file_texture(FbxSurfaceMaterial *material, char const *property_name)
+    ->FbxFileTexture * {
+  FbxProperty property = material->FindProperty(property_name);
+  if (!property.IsValid()) {
+    return nullptr;
+  }
+  if (property.GetSrcObjectCount<FbxFileTexture>() > 0) {
+    return property.GetSrcObject<FbxFileTexture>(0);
+  }
+  // Use the bottom layer of a layered texture.
+  if (property.GetSrcObjectCount<FbxLayeredTexture>() > 0) {
+    FbxLayeredTexture *layered = property.GetSrcObject<FbxLayeredTexture>(0);
+    if (layered->GetSrcObjectCount<FbxFileTexture>() > 0) {
+      return layered->GetSrcObject<FbxFileTexture>(0);
+    }
+  }
+  return nullptr;
+}
+
+// An image used as color and as a normal map bakes to two formats, so it is
+// only shared within a usage.
+fn texture_key(uint64_t content_hash, TextureUsage usage)->uint64_t {
+  return content_hash ^
+         (static_cast<uint64_t>(usage) + 1) * 0x9e3779b97f4a7c15;
+}
+
+fn add_texture(MaterialTable &table, std::string const &path,
+               TextureUsage usage)->int32_t {
+  std::optional<uint64_t> hash = hash_file_contents(path);
+  if (!hash) {
+    return -1;
+  }
+  table.texture_reference_count++;
+  uint64_t const key = texture_key(*hash, usage);
+  auto found = table.texture_lookup.find(key);
+  if (found != table.texture_lookup.end()) {
+    return found->second;
+  }
+  table.textures.push_back({path, usage, *hash});
+  table.texture_lookup[key] = table.textures.size() - 1;
+  return table.textures.size() - 1;
+}
+
+// The slot whose placeholder stands in for a texture of this usage.
+fn usage_slot(TextureUsage usage)->MaterialSlot {
+  switch (usage) {
+    case TextureUsage::normal:
+      return normal_slot;
+    case TextureUsage::specular:
+      return specular_slot;
+    default:
+      return diffuse_slot;
+  }
+}
+
+}  // namespace
+
+fn hash_file_contents(std::string const &path)->std::optional<uint64_t> {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return std::nullopt;
+  }
+  // 64-bit FNV-1a.
+  uint64_t hash = 0xcbf29ce484222325;
+  std::array<char, 1 << 16> buffer;
+  while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+    for (std::streamsize i = 0; i < file.gcount(); i++) {
+      hash ^= static_cast<uint8_t>(buffer[i]);
+      hash *= 0x100000001b3;
+    }
+  }
+  return hash;
+}
+
+fn resolve_texture_path(FbxFileTexture *texture, std::string const &fbx_path)
+    ->std::optional<std::string> {
+  namespace fs = std::filesystem;
+  fs::path const fbx_file(fbx_path);
+  fs::path const file_name(texture->GetFileName());
+  std::array<fs::path, 3> const candidates = {
+      file_name,
+      fbx_file.parent_path() / texture->GetRelativeFileName(),
+      fbx_file.parent_path() / (fbx_file.stem().string() + ".fbm") /
+          file_name.filename(),
+  };
+  for (auto const &candidate : candidates) {
+    std::error_code error;
+    if (!candidate.empty() && fs::is_regular_file(candidate, error)) {
+      return candidate.string();
+    }
+  }
+  return std::nullopt;
+}
+
+fn add_fbx_materials(MaterialTable &table, FbxNode *node,
+                     std::string const &fbx_path)->std::vector<size_t> {
+  std::vector<size_t> indices;
+  for (int i = 0; i < node->GetMaterialCount(); i++) {
+    FbxSurfaceMaterial *fbx_material = node->GetMaterial(i);
+    Material material{fbx_material->GetName(), {}};
+    material.textures.fill(-1);
+    for (auto const &slot : slot_properties) {
+      for (char const *property_name : slot.properties) {
+        if (!property_name) {
+          continue;
+        }
+        FbxFileTexture *texture =
+            find_file_texture(fbx_material, property_name);
+        if (!texture) {
+          continue;
+        }
+        std::optional<std::string> path =
+            resolve_texture_path(texture, fbx_path);
+        if (!path) {
+          std::cout << "Missing texture " << texture->GetFileName() << '\n';
+          continue;
+        }
+        material.textures[slot.slot] = add_texture(table, *path, slot.usage);
+        break;
+      }
+    }
+    table.materials.push_back(material);
+    indices.push_back(table.materials.size() - 1);
+  }
+  std::cout << "Materials: " << table.materials.size() << ", textures: "
+            << table.textures.size() << " unique of "
+            << table.texture_reference_count << " referenced\n";
+  return indices;
+}
+
+fn add_bindless_texture_features(lava::device::create_param &param)->bool {
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported_indexing{
+      .sType =
+          VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+  };
+  VkPhysicalDeviceFeatures2 supported{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &supported_indexing,
+  };
+  vkGetPhysicalDeviceFeatures2(param.physical_device->get(), &supported);
+  if (!param.physical_device->supported(VK_KHR_MAINTENANCE3_EXTENSION_NAME) ||
+      !param.physical_device->supported(
+          VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) ||
+      !supported_indexing.shaderSampledImageArrayNonUniformIndexing ||
+      !supported_indexing.runtimeDescriptorArray) {
+    std::cout << "Descriptor indexing is unsupported, so every material "
+                 "binds its own textures.\n";
+    return false;
+  }
+
+  static VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features{
+      .sType =
+          VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+      .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+      .runtimeDescriptorArray = VK_TRUE,
+  };
+  indexing_features.pNext = const_cast<void *>(param.next);
+  param.next = &indexing_features;
+  param.extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+  param.extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+  return true;
+}
+
+fn bindless_texture_capacity(lava::device_ptr device)->uint32_t {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device->get_vk_physical_device(), &properties);
+  return std::min({max_bindless_textures,
+                   properties.limits.maxPerStageDescriptorSamplers,
+                   properties.limits.maxPerStageDescriptorSampledImages,
+                   properties.limits.maxDescriptorSetSamplers,
+                   properties.limits.maxDescriptorSetSampledImages});
+}
+
+fn bindless_texture_index(size_t texture)->uint32_t {
+  return material_slot_count + texture;
+}
+
+fn make_gpu_materials(MaterialTable const &table, uint32_t capacity)
+    ->std::vector<GpuMaterial> {
+  std::vector<GpuMaterial> gpu_materials;
+  gpu_materials.reserve(table.materials.size());
+  for (auto const &material : table.materials) {
+    GpuMaterial gpu_material;
+    for (uint32_t slot = 0; slot < material_slot_count; slot++) {
+      int32_t const texture = material.textures[slot];
+      bool const bound =
+          texture >= 0 && bindless_texture_index(texture) < capacity;
+      gpu_material.textures[slot] =
+          bound ? bindless_texture_index(texture) : slot;
+    }
+    gpu_materials.push_back(gpu_material);
+  }
+  return gpu_materials;
+}
+
+fn bindless_texture_infos(MaterialTable const &table,
+                          std::vector<lava::texture::ptr> const &textures,
+                          PlaceholderTextures const &placeholders,
+                          uint32_t capacity)
+    ->std::vector<VkDescriptorImageInfo> {
+  // Entries past the table's textures hold the diffuse placeholder.
+  std::vector<VkDescriptorImageInfo> infos(
+      capacity, *placeholders[diffuse_slot]->get_descriptor_info());
+  for (size_t i = 0; i < placeholders.size() && i < capacity; i++) {
+    infos[i] = *placeholders[i]->get_descriptor_info();
+  }
+  for (size_t i = 0;
+       i < table.textures.size() && bindless_texture_index(i) < capacity;
+       i++) {
+    lava::texture::ptr const texture =
+        i < textures.size() ? textures[i] : nullptr;
+    infos[bindless_texture_index(i)] =
+        texture ? *texture->get_descriptor_info()
+                : *placeholders[usage_slot(table.textures[i].usage)]
+                       ->get_descriptor_info();
+  }
+  return infos;
+}
+
+fn material_texture_infos(MaterialTable const &table, size_t material,
+                          std::vector<lava::texture::ptr> const &textures,
+                          PlaceholderTextures const &placeholders)
+    ->std::array<VkDescriptorImageInfo, material_slot_count> {
+  std::array<VkDescriptorImageInfo, material_slot_count> infos;
+  for (uint32_t slot = 0; slot < material_slot_count; slot++) {
+    int32_t const texture = table.materials[material].textures[slot];
+    lava::texture::ptr const loaded =
+        texture >= 0 && static_cast<size_t>(texture) < textures.size()
+            ? textures[texture]
+            : nullptr;
+    infos[slot] = loaded ? *loaded->get_descriptor_info()
+                         : *placeholders[slot]->get_descriptor_info();
+  }
+  return infos;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <fbxsdk.h>
+
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+#include "texture_baking.h"
+
+// Texture slots of a material, in the order frag.glsl samples them.
+enum MaterialSlot {
+  diffuse_slot,
+  emissive_slot,
+  normal_slot,
+  specular_slot,
+  material_slot_count,
+};
+
+typedef struct {
+  std::string path;
+  TextureUsage usage;
+  uint64_t content_hash;
+} MaterialTexture;
+
+typedef struct {
+  std::string name;
+  // Indices into MaterialTable::textures, or -1 for an unused slot.
+  std::array<int32_t, material_slot_count> textures;
+} Material;
+
+// Upper bound on the bindless texture array in frag.glsl. The array starts
+// with one placeholder per slot, followed by the material table's textures,
+// and the rest of it holds placeholders until textures are added.
+constexpr uint32_t max_bindless_textures = 4096;
+
+// Matches Material in frag.glsl (std430).
+typedef struct {
+  std::array<uint32_t, material_slot_count> textures;
+} GpuMaterial;
+
+// Textures are shared between every material and file that references the
+// same image contents with the same usage.
+typedef struct {
+  std::vector<MaterialTexture> textures;
+  std::vector<Material> materials;
+  // Keyed by content hash and usage.
+  std::unordered_map<uint64_t, size_t> texture_lookup;
+  size_t texture_reference_count;
+} MaterialTable;
+
+fn hash_file_contents(std::string const &path)->std::optional<uint64_t>;
+
+// Find the file a texture refers to. Exporters store absolute paths from the
+// authoring machine, so this falls back to the relative path and then the
+// .fbm folder the SDK extracts embedded media into.
+fn resolve_texture_path(FbxFileTexture *texture, std::string const &fbx_path)
+    ->std::optional<std::string>;
+
+// Add the materials of a node to the table, and return their indices.
+fn add_fbx_materials(MaterialTable &table, FbxNode *node,
+                     std::string const &fbx_path)->std::vector<size_t>;
+
+// Placeholder textures, one per slot, bound while real textures stream in.
+using PlaceholderTextures = std::array<lava::texture::ptr, material_slot_count>;
+
+// Enables non-uniform indexing into a runtime-sized texture array, where the
+// device supports it. Call from on_create_param. Returns false otherwise, and
+// materials must use per-material texture sets instead.
+fn add_bindless_texture_features(lava::device::create_param &param)->bool;
+
+// Size of the bindless texture array: max_bindless_textures, or less where
+// the device limits samplers per stage.
+fn bindless_texture_capacity(lava::device_ptr device)->uint32_t;
+
+// Position of a material table texture in the bindless array.
+fn bindless_texture_index(size_t texture)->uint32_t;
+
+// Resolve every material to bindless indices. Unused slots, and textures past
+// the array's capacity, point at the slot's placeholder.
+fn make_gpu_materials(MaterialTable const &table, uint32_t capacity)
+    ->std::vector<GpuMaterial>;
+
+// Descriptors of the whole bindless array. Textures are parallel to the
+// table's, and null ones, still streaming, get their usage's placeholder.
+fn bindless_texture_infos(MaterialTable const &table,
+                          std::vector<lava::texture::ptr> const &textures,
+                          PlaceholderTextures const &placeholders,
+                          uint32_t capacity)
+    ->std::vector<VkDescriptorImageInfo>;
+
+// Descriptors of one material's slots, for devices without bindless
+// textures.
+fn material_texture_infos(MaterialTable const &table, size_t material,
+                          std::vector<lava::texture::ptr> const &textures,
+                          PlaceholderTextures const &placeholders)
+    ->std::array<VkDescriptorImageInfo, material_slot_count>;
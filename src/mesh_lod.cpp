@@ -0,0 +1,470 @@
+#include "mesh_lod.h"
+
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <string_view>
+#include <unordered_map>
+
+#include "mesh_optimize.h"
+#include "trace.h"
+
+namespace {
+
+// Symmetric 4x4 plane quadric: a2 ab ac ad b2 bc bd c2 cd d2.
+typedef struct {
+  std::array<double, 10> q;
+} Quadric;
+
+fn make_plane_quadric(lava::v3 normal, float distance, double weight)
+    ->Quadric {
+  double const a = normal.x, b = normal.y, c = normal.z, d = distance;
+  return {{a * a * weight, a * b * weight, a * c * weight, a * d * weight,
+           b * b * weight, b * c * weight, b * d * weight, c * c * weight,
+           c * d * weight, d * d * weight}};
+}
+
+fn add_quadric(Quadric& into, Quadric const& other)->void {
+  for (size_t i = 0; i < into.q.size(); i++) {
+    into.q[i] += other.q[i];
+  }
+}
+
+fn quadric_error(Quadric const& quadric, lava::v3 position)->double {
+  auto const& q = quadric.q;
+  double const x = position.x, y = position.y, z = position.z;
+  double const error = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z +
+                       2 * q[3] * x + q[4] * y * y + 2 * q[5] * y * z +
+                       2 * q[6] * y + q[7] * z * z + 2 * q[8] * z + q[9];
+  return std::max(error, 0.0);
+}
+
+fn skin_weight_distance(skin_vertex const& a, skin_vertex const& b)->float {
+  auto weight_of = [](skin_vertex const& vertex, std::uint32_t joint) {
+    float weight = 0;
+    for (size_t i = 0; i < 4; i++) {
+      if (vertex.weight_indices[i] == joint) {
+        weight += vertex.bone_weights[i];
+      }
+    }
+    return weight;
+  };
+  float distance = 0;
+  for (size_t i = 0; i < 4; i++) {
+    if (a.bone_weights[i] > 0) {
+      distance +=
+          std::abs(a.bone_weights[i] - weight_of(b, a.weight_indices[i]));
+    }
+    if (b.bone_weights[i] > 0 && weight_of(a, b.weight_indices[i]) == 0) {
+      distance += b.bone_weights[i];
+    }
+  }
+  return distance;
+}
+
+fn triangle_normal(lava::v3 a, lava::v3 b, lava::v3 c)->lava::v3 {
+  return glm::cross(b - a, c - a);
+}
+
+fn edge_key(lava::index a, lava::index b)->uint64_t {
+  return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+}
+
+typedef struct {
+  lava::index from;
+  lava::index to;
+  double cost;
+} Collapse;
+
+}  // namespace
+
+fn simplify_mesh(lava::mesh_template_data<skin_vertex> const& data,
+                 size_t target_index_count, float max_weight_distance,
+                 float* out_error)
+    ->std::vector<lava::index> {
+  std::vector<lava::index> indices = data.indices;
+  size_t const vertex_count = data.vertices.size();
+  auto position = [&](lava::index vertex) {
+    return data.vertices[vertex].position;
+  };
+
+  // Vertices that share a position but not attributes lie on a UV or normal
+  // seam. Moving them would tear the seam open, so they stay put.
+  std::vector<bool> locked(vertex_count, false);
+  {
+    std::unordered_map<std::string_view, size_t> position_counts;
+    for (size_t i = 0; i < vertex_count; i++) {
+      position_counts[std::string_view(
+          reinterpret_cast<char const*>(&data.vertices[i].position),
+          sizeof(lava::v3))]++;
+    }
+    for (size_t i = 0; i < vertex_count; i++) {
+      locked[i] = position_counts[std::string_view(
+                      reinterpret_cast<char const*>(&data.vertices[i].position),
+                      sizeof(lava::v3))] > 1;
+    }
+  }
+
+  lava::v3 min_pos(std::numeric_limits<float>::max());
+  lava::v3 max_pos(std::numeric_limits<float>::lowest());
+  for (auto const& vertex : data.vertices) {
+    min_pos = glm::min(min_pos, vertex.position);
+    max_pos = glm::max(max_pos, vertex.position);
+  }
+  double const extent = std::max(glm::length(max_pos - min_pos), 1e-6f);
+  // Skin weight differences are scaled to be comparable with squared
+  // distances across the mesh.
+  double const weight_penalty = extent * extent * 0.01;
+
+  std::vector<Quadric> quadrics(vertex_count, Quadric{});
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    lava::v3 const p0 = position(indices[i]);
+    lava::v3 normal =
+        triangle_normal(p0, position(indices[i + 1]), position(indices[i + 2]));
+    float const length = glm::length(normal);
+    if (length == 0) {
+      continue;
+    }
+    normal /= length;
+    Quadric const plane =
+        make_plane_quadric(normal, -glm::dot(normal, p0), length * 0.5);
+    for (size_t j = 0; j < 3; j++) {
+      add_quadric(quadrics[indices[i + j]], plane);
+    }
+  }
+
+  std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<Collapse> collapses;
+  std::vector<bool> dirty(vertex_count);
+  double max_error = 0;
+
+  // Each pass collapses a batch of independent edges, cheapest first.
+  while (indices.size() > target_index_count) {
+    // Edges used by only one triangle are on a border or seam.
+    std::vector<bool> pass_locked = locked;
+    std::unordered_map<uint64_t, uint32_t> edge_counts;
+    edge_counts.reserve(indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      for (size_t j = 0; j < 3; j++) {
+        edge_counts[edge_key(indices[i + j], indices[i + (j + 1) % 3])]++;
+      }
+    }
+    for (auto [key, count] : edge_counts) {
+      if (count == 1) {
+        pass_locked[key >> 32] = true;
+        pass_locked[key & 0xffffffff] = true;
+      }
+    }
+
+    std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+    for (auto index : indices) {
+      adjacency_offsets[index + 1]++;
+    }
+    std::partial_sum(adjacency_offsets.begin(), adjacency_offsets.end(),
+                     adjacency_offsets.begin());
+    adjacency.resize(indices.size());
+    std::vector<uint32_t> adjacency_fill(adjacency_offsets.begin(),
+                                         adjacency_offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+      adjacency[adjacency_fill[indices[i]]++] = i / 3;
+    }
+
+    collapses.clear();
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      for (size_t j = 0; j < 3; j++) {
+        lava::index const a = indices[i + j];
+        lava::index const b = indices[i + (j + 1) % 3];
+        for (auto [from, to] : {std::pair{a, b}, std::pair{b, a}}) {
+          if (pass_locked[from]) {
+            continue;
+          }
+          float const weight_distance =
+              skin_weight_distance(data.vertices[from], data.vertices[to]);
+          if (weight_distance > max_weight_distance) {
+            continue;
+          }
+          collapses.push_back(
+              {from, to,
+               quadric_error(quadrics[from], position(to)) +
+                   weight_distance * weight_penalty});
+        }
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](auto const& a, auto const& b) { return a.cost < b.cost; });
+
+    std::fill(dirty.begin(), dirty.end(), false);
+    std::vector<lava::index> remap(vertex_count);
+    std::iota(remap.begin(), remap.end(), 0);
+    size_t const tris_to_remove = (indices.size() - target_index_count) / 3;
+    size_t removed = 0;
+    for (auto const& collapse : collapses) {
+      if (removed >= tris_to_remove) {
+        break;
+      }
+      if (dirty[collapse.from] || dirty[collapse.to]) {
+        continue;
+      }
+
+      // Reject collapses that would flip a surviving triangle.
+      bool flips = false;
+      size_t shared_tris = 0;
+      for (size_t i = adjacency_offsets[collapse.from];
+           i < adjacency_offsets[collapse.from + 1]; i++) {
+        lava::index const* tri = &indices[adjacency[i] * 3];
+        if (tri[0] == collapse.to || tri[1] == collapse.to ||
+            tri[2] == collapse.to) {
+          shared_tris++;
+          continue;
+        }
+        std::array<lava::v3, 3> corners;
+        for (size_t j = 0; j < 3; j++) {
+          corners[j] = position(tri[j] == collapse.from ? collapse.to : tri[j]);
+        }
+        lava::v3 const old_normal = triangle_normal(
+            position(tri[0]), position(tri[1]), position(tri[2]));
+        lava::v3 const new_normal =
+            triangle_normal(corners[0], corners[1], corners[2]);
+        if (glm::dot(old_normal, new_normal) <= 0) {
+          flips = true;
+          break;
+        }
+      }
+      if (flips) {
+        continue;
+      }
+
+      remap[collapse.from] = collapse.to;
+      add_quadric(quadrics[collapse.to], quadrics[collapse.from]);
+      for (size_t i = adjacency_offsets[collapse.from];
+           i < adjacency_offsets[collapse.from + 1]; i++) {
+        for (size_t j = 0; j < 3; j++) {
+          dirty[indices[adjacency[i] * 3 + j]] = true;
+        }
+      }
+      removed += shared_tris;
+      max_error = std::max(max_error, collapse.cost);
+    }
+    if (removed == 0) {
+      break;
+    }
+
+    size_t write = 0;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      lava::index const a = remap[indices[i]];
+      lava::index const b = remap[indices[i + 1]];
+      lava::index const c = remap[indices[i + 2]];
+      if (a != b && b != c && a != c) {
+        indices[write++] = a;
+        indices[write++] = b;
+        indices[write++] = c;
+      }
+    }
+    indices.resize(write);
+  }
+
+  if (out_error) {
+    *out_error = static_cast<float>(std::sqrt(max_error) / extent);
+  }
+  return indices;
+}
+
+fn reduce_skeleton(std::vector<Joint> const& joints, int level)
+    ->std::vector<int> {
+  std::vector<int> remap(joints.size());
+  std::iota(remap.begin(), remap.end(), 0);
+  if (level <= 0) {
+    return remap;
+  }
+
+  constexpr std::array<std::string_view, 11> detail_joint_names = {
+      "Thumb", "Index", "Middle", "Ring", "Pinky", "Eye",
+      "Jaw",   "Tongue", "Brow",  "Lip",  "_End",
+  };
+  std::vector<bool> dropped(joints.size(), false);
+  for (size_t i = 1; i < joints.size(); i++) {
+    std::string_view const name = joints[i].node->GetName();
+    for (auto detail_name : detail_joint_names) {
+      if (name.find(detail_name) != std::string_view::npos) {
+        dropped[i] = true;
+      }
+    }
+  }
+  for (int i = 1; i < level; i++) {
+    std::vector<bool> has_kept_child(joints.size(), false);
+    for (size_t j = 0; j < joints.size(); j++) {
+      if (!dropped[j] && joints[j].parent_index >= 0) {
+        has_kept_child[joints[j].parent_index] = true;
+      }
+    }
+    // The root is never dropped.
+    for (size_t j = 1; j < joints.size(); j++) {
+      if (!has_kept_child[j]) {
+        dropped[j] = true;
+      }
+    }
+  }
+
+  // Parents always come before their children in the joint list.
+  for (size_t i = 0; i < joints.size(); i++) {
+    if (dropped[i] && joints[i].parent_index >= 0) {
+      remap[i] = remap[joints[i].parent_index];
+    }
+  }
+  return remap;
+}
+
+fn remap_skin_joints(lava::mesh_template_data<skin_vertex>& data,
+                     std::vector<int> const& joint_remap)->void {
+  for (auto& vertex : data.vertices) {
+    std::array<std::pair<std::uint32_t, float>, 4> influences{};
+    size_t count = 0;
+    for (size_t i = 0; i < 4; i++) {
+      if (vertex.bone_weights[i] <= 0) {
+        continue;
+      }
+      std::uint32_t const joint = joint_remap[vertex.weight_indices[i]];
+      auto existing =
+          std::find_if(influences.begin(), influences.begin() + count,
+                       [&](auto const& influence) {
+                         return influence.first == joint;
+                       });
+      if (existing != influences.begin() + count) {
+        existing->second += vertex.bone_weights[i];
+      } else {
+        influences[count++] = {joint, vertex.bone_weights[i]};
+      }
+    }
+    // Unused slots have zero weight, so they sort last.
+    std::sort(influences.begin(), influences.end(),
+              [](auto const& a, auto const& b) { return a.second > b.second; });
+    for (size_t i = 0; i < 4; i++) {
+      vertex.weight_indices[i] = influences[i].first;
+      vertex.bone_weights[i] = influences[i].second;
+    }
+  }
+}
+
+fn limit_skin_influences(lava::mesh_template_data<skin_vertex>& data,
+                         uint32_t max_influences)->uint32_t {
+  uint32_t used = 0;
+  for (auto& vertex : data.vertices) {
+    float total = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+      if (i >= max_influences) {
+        vertex.bone_weights[i] = 0;
+      }
+      total += vertex.bone_weights[i];
+      if (vertex.bone_weights[i] > 0) {
+        used = std::max(used, i + 1);
+      }
+    }
+    if (total > 0) {
+      vertex.bone_weights /= total;
+    }
+  }
+  return used;
+}
+
+fn build_lod_chain(lava::mesh_template_data<skin_vertex> const& data,
+                   std::vector<Joint> const& joints,
+                   std::vector<LodSettings> const& settings)->LodChain {
+  TRACE_SCOPE("build_lod_chain");
+  LodChain chain{};
+  lava::v3 min_pos(std::numeric_limits<float>::max());
+  lava::v3 max_pos(std::numeric_limits<float>::lowest());
+  for (auto const& vertex : data.vertices) {
+    min_pos = glm::min(min_pos, vertex.position);
+    max_pos = glm::max(max_pos, vertex.position);
+  }
+  chain.center = (min_pos + max_pos) * 0.5f;
+  for (auto const& vertex : data.vertices) {
+    chain.radius =
+        std::max(chain.radius, glm::length(vertex.position - chain.center));
+  }
+
+  for (auto const& lod_settings : settings) {
+    MeshLod lod{
+        .data = data,
+        .min_screen_size = lod_settings.min_screen_size,
+        .error = 0,
+    };
+    // Simplify from the previous LOD, since it is already smaller.
+    if (!chain.lods.empty() && lod_settings.target_ratio < 1.0f) {
+      lod.data = chain.lods.back().data;
+      size_t const target_index_count =
+          static_cast<size_t>(data.indices.size() / 3 *
+                              lod_settings.target_ratio) *
+          3;
+      lod.data.indices =
+          simplify_mesh(lod.data, target_index_count, 0.5f, &lod.error);
+      lod.error = std::max(lod.error, chain.lods.back().error);
+    }
+
+    lod.joint_remap = reduce_skeleton(joints, lod_settings.skeleton_level);
+    lod.kept_joint_count = 0;
+    for (size_t i = 0; i < lod.joint_remap.size(); i++) {
+      lod.kept_joint_count += lod.joint_remap[i] == static_cast<int>(i);
+    }
+    remap_skin_joints(lod.data, lod.joint_remap);
+    lod.max_influences =
+        limit_skin_influences(lod.data, lod_settings.max_influences);
+
+    if (!chain.lods.empty()) {
+      optimize_vertex_cache(lod.data.indices, lod.data.vertices.size());
+      optimize_overdraw(lod.data.indices, lod.data.vertices);
+      optimize_vertex_fetch(lod.data);
+    }
+    std::cout << "LOD " << chain.lods.size() << ": "
+              << lod.data.indices.size() / 3 << " triangles, "
+              << lod.data.vertices.size() << " vertices, "
+              << lod.kept_joint_count << " joints, " << lod.max_influences
+              << " influences, error " << lod.error << '\n';
+    chain.lods.push_back(std::move(lod));
+  }
+  return chain;
+}
+
+fn select_lod(LodChain const& chain, lava::mat4 const& model,
+              lava::v3 camera_position, float fov_y_degrees, float lod_bias)
+    ->size_t {
+  lava::v3 center = lava::v3(model * lava::v4(chain.center, 1));
+  // Match the y-flip in vert.glsl.
+  center.y = -center.y;
+  float const radius =
+      chain.radius * std::max({glm::length(lava::v3(model[0])),
+                               glm::length(lava::v3(model[1])),
+                               glm::length(lava::v3(model[2]))});
+  float const distance = std::max(glm::length(center - camera_position), 1e-4f);
+  float const screen_size =
+      lod_bias * radius /
+      (distance * std::tan(glm::radians(fov_y_degrees) * 0.5f));
+  for (size_t i = 0; i < chain.lods.size(); i++) {
+    if (screen_size >= chain.lods[i].min_screen_size) {
+      return i;
+    }
+  }
+  return chain.lods.size() - 1;
+}
+
+fn pack_lod_chain(LodChain const& chain,
+                  lava::mesh_template_data<skin_vertex>& packed)
+    ->std::vector<LodRange> {
+  std::vector<LodRange> ranges;
+  packed.vertices.clear();
+  packed.indices.clear();
+  for (auto const& lod : chain.lods) {
+    ranges.push_back({
+        .first_index = static_cast<lava::index>(packed.indices.size()),
+        .index_count = static_cast<lava::index>(lod.data.indices.size()),
+        .vertex_offset = static_cast<int32_t>(packed.vertices.size()),
+        .min_screen_size = lod.min_screen_size,
+    });
+    packed.vertices.insert(packed.vertices.end(), lod.data.vertices.begin(),
+                           lod.data.vertices.end());
+    packed.indices.insert(packed.indices.end(), lod.data.indices.begin(),
+                          lod.data.indices.end());
+  }
+  return ranges;
+}
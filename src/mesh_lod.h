@@ -0,0 +1,92 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "fbx_loading.h"
+#include "includes.h"
+
+typedef struct {
+  // Fraction of the LOD 0 triangle count to keep.
+  float target_ratio;
+  // Smallest projected screen size (see select_lod()) this LOD is used at.
+  float min_screen_size;
+  // 0 keeps every joint, 1 drops finger, face and end joints, and every
+  // level past that also drops the remaining leaf joints.
+  int skeleton_level;
+  // Joint influences kept per vertex: 1, 2 or 4.
+  uint32_t max_influences;
+} LodSettings;
+
+typedef struct {
+  lava::mesh_template_data<skin_vertex> data;
+  // Maps every joint to itself, or to its nearest kept ancestor.
+  std::vector<int> joint_remap;
+  size_t kept_joint_count;
+  // Most joint influences on any vertex, which picks the shader permutation.
+  uint32_t max_influences;
+  float min_screen_size;
+  // Largest collapse error, relative to the mesh extents.
+  float error;
+} MeshLod;
+
+typedef struct {
+  std::vector<MeshLod> lods;
+  // Bounding sphere of LOD 0 in model space.
+  lava::v3 center;
+  float radius;
+} LodChain;
+
+inline std::vector<LodSettings> const default_lod_settings = {
+    {1.0f, 0.5f, 0, 4},
+    {0.5f, 0.25f, 0, 4},
+    {0.25f, 0.12f, 1, 2},
+    {0.1f, 0.0f, 2, 1},
+};
+
+// Quadric error edge-collapse simplification. Border and seam vertices are
+// locked, and collapses between vertices whose skin weights differ by more
+// than max_weight_distance (L1 over joints) are rejected.
+fn simplify_mesh(lava::mesh_template_data<skin_vertex> const& data,
+                 size_t target_index_count, float max_weight_distance = 0.5f,
+                 float* out_error = nullptr)
+    ->std::vector<lava::index>;
+
+fn reduce_skeleton(std::vector<Joint> const& joints, int level)
+    ->std::vector<int>;
+
+// Point vertex influences at remapped joints, merging duplicates.
+fn remap_skin_joints(lava::mesh_template_data<skin_vertex>& data,
+                     std::vector<int> const& joint_remap)->void;
+
+// Keep the strongest influences on each vertex and renormalize. Influences
+// must already be sorted strongest first (see remap_skin_joints()). Returns
+// the most influences left on any vertex.
+fn limit_skin_influences(lava::mesh_template_data<skin_vertex>& data,
+                         uint32_t max_influences)->uint32_t;
+
+fn build_lod_chain(lava::mesh_template_data<skin_vertex> const& data,
+                   std::vector<Joint> const& joints,
+                   std::vector<LodSettings> const& settings =
+                       default_lod_settings)
+    ->LodChain;
+
+// Pick a LOD from the fraction of the screen height that the chain's
+// bounding sphere covers.
+fn select_lod(LodChain const& chain, lava::mat4 const& model,
+              lava::v3 camera_position, float fov_y_degrees,
+              float lod_bias = 1.0f)
+    ->size_t;
+
+// Matches LodRange in instance_cull.comp (std430).
+typedef struct {
+  lava::index first_index;
+  lava::index index_count;
+  int32_t vertex_offset;
+  float min_screen_size;
+} LodRange;
+
+// Append every LOD into one mesh, so any LOD can be drawn from the same
+// vertex and index buffers.
+fn pack_lod_chain(LodChain const& chain,
+                  lava::mesh_template_data<skin_vertex>& packed)
+    ->std::vector<LodRange>;
@@ -0,0 +1,384 @@
+#include "mesh_optimize.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include "trace.h"
+
+namespace {
+
+// Tuning values from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+constexpr size_t forsyth_cache_size = 32;
+constexpr float forsyth_cache_decay = 1.5f;
+constexpr float forsyth_last_tri_score = 0.75f;
+constexpr float forsyth_valence_scale = 2.0f;
+constexpr float forsyth_valence_power = 0.5f;
+
+fn forsyth_vertex_score(int cache_position, uint32_t live_tris)->float {
+  // Vertices with no triangles left to emit should never be picked.
+  if (live_tris == 0) {
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      // The triangle that was just emitted.
+      score = forsyth_last_tri_score;
+    } else {
+      float const scaler = 1.0f / (forsyth_cache_size - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scaler,
+                       forsyth_cache_decay);
+    }
+  }
+  // Favor vertices with few triangles left, so they do not get stranded.
+  score += forsyth_valence_scale *
+           std::pow(static_cast<float>(live_tris), -forsyth_valence_power);
+  return score;
+}
+
+struct skin_vertex_hash {
+  fn operator()(skin_vertex const& vertex) const->size_t {
+    // FNV-1a over the raw bytes.
+    auto bytes = reinterpret_cast<unsigned char const*>(&vertex);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < sizeof(skin_vertex); i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+  }
+};
+
+struct skin_vertex_equal {
+  fn operator()(skin_vertex const& a, skin_vertex const& b) const->bool {
+    return std::memcmp(&a, &b, sizeof(skin_vertex)) == 0;
+  }
+};
+
+}  // namespace
+
+fn weld_vertices(lava::mesh_template_data<skin_vertex>& data)->void {
+  // An empty index list means the vertices are a plain triangle list.
+  if (data.indices.empty()) {
+    data.indices.resize(data.vertices.size());
+    for (size_t i = 0; i < data.vertices.size(); i++) {
+      data.indices[i] = i;
+    }
+  }
+
+  std::unordered_map<skin_vertex, lava::index, skin_vertex_hash,
+                     skin_vertex_equal>
+      unique_vertices;
+  unique_vertices.reserve(data.vertices.size());
+  std::vector<skin_vertex> welded_vertices;
+  welded_vertices.reserve(data.vertices.size());
+  for (auto& index : data.indices) {
+    auto [it, inserted] = unique_vertices.try_emplace(
+        data.vertices[index], static_cast<lava::index>(welded_vertices.size()));
+    if (inserted) {
+      welded_vertices.push_back(data.vertices[index]);
+    }
+    index = it->second;
+  }
+  data.vertices = std::move(welded_vertices);
+}
+
+fn analyze_vertex_cache(std::vector<lava::index> const& indices,
+                        size_t vertex_count, size_t cache_size)
+    ->VertexCacheStats {
+  size_t const tri_count = indices.size() / 3;
+  if (tri_count == 0 || vertex_count == 0) {
+    return {0, 0};
+  }
+
+  // A vertex is in the FIFO if fewer than cache_size misses happened since it
+  // was last transformed.
+  std::vector<size_t> timestamps(vertex_count, 0);
+  size_t timestamp = cache_size + 1;
+  size_t misses = 0;
+  for (auto index : indices) {
+    if (timestamp - timestamps[index] > cache_size) {
+      timestamps[index] = timestamp++;
+      misses++;
+    }
+  }
+  return {static_cast<float>(misses) / tri_count,
+          static_cast<float>(misses) / vertex_count};
+}
+
+fn optimize_vertex_cache(std::vector<lava::index>& indices,
+                         size_t vertex_count)->void {
+  size_t const tri_count = indices.size() / 3;
+  if (tri_count == 0) {
+    return;
+  }
+
+  // Triangles adjacent to each vertex, packed into one array. The first
+  // live_tris[v] entries of a vertex's range have not been emitted yet.
+  std::vector<uint32_t> live_tris(vertex_count, 0);
+  for (auto index : indices) {
+    live_tris[index]++;
+  }
+  std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+  for (size_t i = 0; i < vertex_count; i++) {
+    adjacency_offsets[i + 1] = adjacency_offsets[i] + live_tris[i];
+  }
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> adjacency_fill(adjacency_offsets.begin(),
+                                       adjacency_offsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++) {
+    adjacency[adjacency_fill[indices[i]]++] = i / 3;
+  }
+
+  std::vector<int> cache_positions(vertex_count, -1);
+  std::vector<float> vertex_scores(vertex_count);
+  for (size_t i = 0; i < vertex_count; i++) {
+    vertex_scores[i] = forsyth_vertex_score(-1, live_tris[i]);
+  }
+  std::vector<float> tri_scores(tri_count);
+  std::vector<bool> emitted(tri_count, false);
+  int best_tri = 0;
+  for (size_t i = 0; i < tri_count; i++) {
+    tri_scores[i] = vertex_scores[indices[i * 3]] +
+                    vertex_scores[indices[i * 3 + 1]] +
+                    vertex_scores[indices[i * 3 + 2]];
+    if (tri_scores[i] > tri_scores[best_tri]) {
+      best_tri = i;
+    }
+  }
+
+  std::vector<lava::index> output;
+  output.reserve(indices.size());
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> next_cache;
+  cache.reserve(forsyth_cache_size + 3);
+  next_cache.reserve(forsyth_cache_size + 3);
+  size_t scan_cursor = 0;
+
+  auto update_vertex = [&](uint32_t vertex, int cache_position) {
+    cache_positions[vertex] = cache_position;
+    float const score = forsyth_vertex_score(cache_position, live_tris[vertex]);
+    float const delta = score - vertex_scores[vertex];
+    vertex_scores[vertex] = score;
+    for (size_t i = 0; i < live_tris[vertex]; i++) {
+      tri_scores[adjacency[adjacency_offsets[vertex] + i]] += delta;
+    }
+  };
+
+  while (output.size() < tri_count * 3) {
+    if (best_tri < 0) {
+      // Nothing in the cache touches a live triangle, so restart from the
+      // next triangle in the original order.
+      while (emitted[scan_cursor]) {
+        scan_cursor++;
+      }
+      best_tri = scan_cursor;
+    }
+    emitted[best_tri] = true;
+
+    next_cache.clear();
+    for (size_t i = 0; i < 3; i++) {
+      uint32_t const vertex = indices[best_tri * 3 + i];
+      output.push_back(vertex);
+      next_cache.push_back(vertex);
+
+      // Retire the triangle from the vertex's live list.
+      auto begin = adjacency.begin() + adjacency_offsets[vertex];
+      auto end = begin + live_tris[vertex];
+      std::iter_swap(std::find(begin, end, best_tri), end - 1);
+      live_tris[vertex]--;
+    }
+    for (auto vertex : cache) {
+      if (std::find(next_cache.begin(), next_cache.begin() + 3, vertex) ==
+          next_cache.begin() + 3) {
+        next_cache.push_back(vertex);
+      }
+    }
+
+    // Rescore everything that moved, including vertices pushed out.
+    for (size_t i = 0; i < next_cache.size(); i++) {
+      update_vertex(next_cache[i],
+                    i < forsyth_cache_size ? static_cast<int>(i) : -1);
+    }
+    if (next_cache.size() > forsyth_cache_size) {
+      next_cache.resize(forsyth_cache_size);
+    }
+    std::swap(cache, next_cache);
+
+    best_tri = -1;
+    float best_score = -1.0f;
+    for (auto vertex : cache) {
+      for (size_t i = 0; i < live_tris[vertex]; i++) {
+        uint32_t const tri = adjacency[adjacency_offsets[vertex] + i];
+        if (tri_scores[tri] > best_score) {
+          best_score = tri_scores[tri];
+          best_tri = tri;
+        }
+      }
+    }
+  }
+  indices = std::move(output);
+}
+
+fn optimize_overdraw(std::vector<lava::index>& indices,
+                     std::vector<skin_vertex> const& vertices, float threshold)
+    ->size_t {
+  TRACE_SCOPE("optimize_overdraw");
+  size_t const tri_count = indices.size() / 3;
+  if (tri_count == 0) {
+    return 0;
+  }
+
+  // Misses of each triangle in a FIFO cache that is flushed wherever
+  // flush_at is set, like analyze_vertex_cache().
+  constexpr size_t cache_size = 16;
+  std::vector<size_t> timestamps(vertices.size(), 0);
+  size_t timestamp = cache_size + 1;
+  auto triangle_misses = [&](size_t tri) {
+    size_t misses = 0;
+    for (size_t i = 0; i < 3; i++) {
+      lava::index const index = indices[tri * 3 + i];
+      if (timestamp - timestamps[index] > cache_size) {
+        timestamps[index] = timestamp++;
+        misses++;
+      }
+    }
+    return misses;
+  };
+  auto flush_cache = [&]() { timestamp += cache_size + 1; };
+
+  // Hard boundaries: triangles sharing no vertex with the cache, where the
+  // cache optimization started over.
+  std::vector<size_t> hard_starts;
+  for (size_t tri = 0; tri < tri_count; tri++) {
+    if (triangle_misses(tri) == 3) {
+      hard_starts.push_back(tri);
+    }
+  }
+  if (hard_starts.empty() || hard_starts[0] != 0) {
+    hard_starts.insert(hard_starts.begin(), 0);
+  }
+  hard_starts.push_back(tri_count);
+
+  // Soft boundaries: split each run where the ACMR since the last split
+  // gets close enough to the run's own.
+  std::vector<size_t> cluster_starts;
+  for (size_t run = 0; run + 1 < hard_starts.size(); run++) {
+    size_t const first = hard_starts[run];
+    size_t const last = hard_starts[run + 1];
+    flush_cache();
+    size_t run_misses = 0;
+    for (size_t tri = first; tri < last; tri++) {
+      run_misses += triangle_misses(tri);
+    }
+    float const run_threshold =
+        threshold * static_cast<float>(run_misses) / (last - first);
+
+    flush_cache();
+    cluster_starts.push_back(first);
+    size_t misses = 0;
+    size_t tris = 0;
+    for (size_t tri = first; tri < last; tri++) {
+      misses += triangle_misses(tri);
+      tris++;
+      if (tri + 1 < last &&
+          static_cast<float>(misses) / tris <= run_threshold) {
+        cluster_starts.push_back(tri + 1);
+        flush_cache();
+        misses = 0;
+        tris = 0;
+      }
+    }
+  }
+  cluster_starts.push_back(tri_count);
+  size_t const cluster_count = cluster_starts.size() - 1;
+
+  // Area-weighted centroid and normal of each cluster, and of the mesh.
+  std::vector<lava::v3> centroids(cluster_count, lava::v3(0));
+  std::vector<lava::v3> normals(cluster_count, lava::v3(0));
+  std::vector<float> areas(cluster_count, 0);
+  lava::v3 mesh_centroid(0);
+  float mesh_area = 0;
+  for (size_t cluster = 0; cluster < cluster_count; cluster++) {
+    for (size_t tri = cluster_starts[cluster];
+         tri < cluster_starts[cluster + 1]; tri++) {
+      lava::v3 const a = vertices[indices[tri * 3]].position;
+      lava::v3 const b = vertices[indices[tri * 3 + 1]].position;
+      lava::v3 const c = vertices[indices[tri * 3 + 2]].position;
+      lava::v3 const normal = glm::cross(b - a, c - a);
+      float const area = glm::length(normal);
+      centroids[cluster] += (a + b + c) * (area / 3);
+      normals[cluster] += normal;
+      areas[cluster] += area;
+    }
+    mesh_centroid += centroids[cluster];
+    mesh_area += areas[cluster];
+  }
+  if (mesh_area > 0) {
+    mesh_centroid /= mesh_area;
+  }
+
+  std::vector<float> sort_keys(cluster_count, 0);
+  for (size_t cluster = 0; cluster < cluster_count; cluster++) {
+    float const normal_length = glm::length(normals[cluster]);
+    if (areas[cluster] > 0 && normal_length > 0) {
+      sort_keys[cluster] =
+          glm::dot(centroids[cluster] / areas[cluster] - mesh_centroid,
+                   normals[cluster] / normal_length);
+    }
+  }
+  std::vector<size_t> order(cluster_count);
+  for (size_t i = 0; i < cluster_count; i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return sort_keys[a] > sort_keys[b];
+  });
+
+  std::vector<lava::index> output;
+  output.reserve(indices.size());
+  for (size_t cluster : order) {
+    output.insert(output.end(), indices.begin() + cluster_starts[cluster] * 3,
+                  indices.begin() + cluster_starts[cluster + 1] * 3);
+  }
+  indices = std::move(output);
+  return cluster_count;
+}
+
+fn optimize_vertex_fetch(lava::mesh_template_data<skin_vertex>& data)->void {
+  constexpr lava::index unused = std::numeric_limits<lava::index>::max();
+  std::vector<lava::index> remap(data.vertices.size(), unused);
+  std::vector<skin_vertex> vertices;
+  vertices.reserve(data.vertices.size());
+  for (auto& index : data.indices) {
+    if (remap[index] == unused) {
+      remap[index] = vertices.size();
+      vertices.push_back(data.vertices[index]);
+    }
+    index = remap[index];
+  }
+  data.vertices = std::move(vertices);
+}
+
+fn optimize_mesh(lava::mesh_template_data<skin_vertex>& data)->void {
+  TRACE_SCOPE("optimize_mesh");
+  size_t const unwelded_count = data.vertices.size();
+  weld_vertices(data);
+  VertexCacheStats const before =
+      analyze_vertex_cache(data.indices, data.vertices.size());
+  optimize_vertex_cache(data.indices, data.vertices.size());
+  VertexCacheStats const cache_optimized =
+      analyze_vertex_cache(data.indices, data.vertices.size());
+  size_t const clusters = optimize_overdraw(data.indices, data.vertices);
+  optimize_vertex_fetch(data);
+  VertexCacheStats const after =
+      analyze_vertex_cache(data.indices, data.vertices.size());
+
+  std::cout << "Welded " << unwelded_count << " vertices into "
+            << data.vertices.size() << '\n';
+  std::cout << "ACMR: " << before.acmr << " -> " << cache_optimized.acmr
+            << " -> " << after.acmr << " after sorting " << clusters
+            << " clusters for overdraw, ATVR: " << before.atvr << " -> "
+            << after.atvr << '\n';
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "fbx_loading.h"
+#include "includes.h"
+
+typedef struct {
+  // Average cache miss ratio: transformed vertices per triangle.
+  float acmr;
+  // Average transformed vertex ratio: transformed vertices per unique vertex.
+  float atvr;
+} VertexCacheStats;
+
+// Merge identical vertices and build an index list for them.
+fn weld_vertices(lava::mesh_template_data<skin_vertex>& data)->void;
+
+// Simulate a FIFO post-transform cache over an index list.
+fn analyze_vertex_cache(std::vector<lava::index> const& indices,
+                        size_t vertex_count, size_t cache_size = 16)
+    ->VertexCacheStats;
+
+// Reorder triangles for post-transform cache hits (Forsyth's algorithm).
+fn optimize_vertex_cache(std::vector<lava::index>& indices,
+                         size_t vertex_count)->void;
+
+// Reorder the clusters of a cache-optimized index list so that triangles
+// facing away from the mesh center come first, which draws outer surfaces
+// before the ones they hide from most views (Sander et al., "Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw"). The list is split
+// where the cache restarts, and where a cluster's ACMR drops to threshold
+// times the ACMR of the run it is in, so larger thresholds trade vertex
+// cache hits for finer sorting. Returns the cluster count.
+fn optimize_overdraw(std::vector<lava::index>& indices,
+                     std::vector<skin_vertex> const& vertices,
+                     float threshold = 1.05f)->size_t;
+
+// Reorder vertices into first-use order, dropping unreferenced ones.
+fn optimize_vertex_fetch(lava::mesh_template_data<skin_vertex>& data)->void;
+
+// Weld, then run the cache, overdraw and fetch reorderings and print cache
+// stats before and after.
+fn optimize_mesh(lava::mesh_template_data<skin_vertex>& data)->void;
@@ -0,0 +1,172 @@
+#include "meshlets.h"
+
+#include "trace.h"
+
+namespace {
+
+fn compute_meshlet_bounds(lava::mesh_template_data<skin_vertex> const& data,
+                          MeshletData const& output, Meshlet& meshlet)->void {
+  lava::v3 min_pos(std::numeric_limits<float>::max());
+  lava::v3 max_pos(std::numeric_limits<float>::lowest());
+  for (size_t i = 0; i < meshlet.vertex_count; i++) {
+    lava::v3 const position =
+        data.vertices[output.vertices[meshlet.vertex_offset + i]].position;
+    min_pos = glm::min(min_pos, position);
+    max_pos = glm::max(max_pos, position);
+  }
+  lava::v3 const center = (min_pos + max_pos) * 0.5f;
+  float radius = 0;
+  for (size_t i = 0; i < meshlet.vertex_count; i++) {
+    lava::v3 const position =
+        data.vertices[output.vertices[meshlet.vertex_offset + i]].position;
+    radius = std::max(radius, glm::length(position - center));
+  }
+  meshlet.sphere = lava::v4(center, radius);
+
+  // The cone axis is the average face normal, and its spread is bounded by
+  // the face normal furthest from it.
+  std::vector<lava::v3> normals;
+  normals.reserve(meshlet.index_count / 3);
+  lava::v3 axis(0);
+  for (size_t i = 0; i < meshlet.index_count; i += 3) {
+    lava::index const* tri = &data.indices[meshlet.index_offset + i];
+    lava::v3 const edge_a =
+        data.vertices[tri[1]].position - data.vertices[tri[0]].position;
+    lava::v3 const edge_b =
+        data.vertices[tri[2]].position - data.vertices[tri[0]].position;
+    lava::v3 const normal = glm::cross(edge_a, edge_b);
+    float const area = glm::length(normal);
+    if (area > 0) {
+      normals.push_back(normal / area);
+      axis += normals.back();
+    }
+  }
+  float const axis_length = glm::length(axis);
+  if (normals.empty() || axis_length == 0) {
+    meshlet.cone = lava::v4(0, 0, 1, 1);
+    return;
+  }
+  axis /= axis_length;
+  float min_dot = 1;
+  for (auto const& normal : normals) {
+    min_dot = std::min(min_dot, glm::dot(axis, normal));
+  }
+  // Cones wider than ~85 degrees practically never cull.
+  float const cutoff =
+      min_dot <= 0.1f ? 1.0f : std::sqrt(1.0f - min_dot * min_dot);
+  meshlet.cone = lava::v4(axis, cutoff);
+}
+
+// Bound the meshlet's vertices per influencing joint, in the bind pose.
+// Every nonzero weight counts, since skinning renormalizes the weights.
+fn compute_meshlet_joints(lava::mesh_template_data<skin_vertex> const& data,
+                          MeshletData& output, Meshlet& meshlet)->void {
+  meshlet.joint_offset = output.joints.size();
+  std::vector<Aabb> boxes;
+  auto for_each_influence = [&](auto&& callback) {
+    for (size_t i = 0; i < meshlet.vertex_count; i++) {
+      skin_vertex const& vertex =
+          data.vertices[output.vertices[meshlet.vertex_offset + i]];
+      for (size_t j = 0; j < 4; j++) {
+        if (vertex.bone_weights[j] <= 0) {
+          continue;
+        }
+        uint32_t const joint = vertex.weight_indices[j];
+        size_t k = meshlet.joint_offset;
+        while (k < output.joints.size() && output.joints[k].joint != joint) {
+          k++;
+        }
+        callback(k - meshlet.joint_offset, joint, vertex.position);
+      }
+    }
+  };
+
+  for_each_influence([&](size_t slot, uint32_t joint, lava::v3 position) {
+    if (slot == boxes.size()) {
+      output.joints.push_back({.joint = joint});
+      boxes.push_back(empty_aabb());
+    }
+    boxes[slot].min = glm::min(boxes[slot].min, position);
+    boxes[slot].max = glm::max(boxes[slot].max, position);
+  });
+  for (size_t slot = 0; slot < boxes.size(); slot++) {
+    output.joints[meshlet.joint_offset + slot].sphere =
+        lava::v4((boxes[slot].min + boxes[slot].max) * 0.5f, 0);
+  }
+  for_each_influence([&](size_t slot, uint32_t, lava::v3 position) {
+    lava::v4& sphere = output.joints[meshlet.joint_offset + slot].sphere;
+    sphere.w = std::max(sphere.w, glm::length(position - lava::v3(sphere)));
+  });
+  meshlet.joint_count = boxes.size();
+}
+
+}  // namespace
+
+fn build_meshlets(lava::mesh_template_data<skin_vertex> const& data,
+                  size_t max_vertices, size_t max_triangles)->MeshletData {
+  TRACE_SCOPE("build_meshlets");
+  MeshletData output;
+  output.triangles.resize(data.indices.size());
+  // Meshlet-local index of every mesh vertex in the current meshlet.
+  constexpr uint8_t unused = std::numeric_limits<uint8_t>::max();
+  std::vector<uint8_t> local_indices(data.vertices.size(), unused);
+  Meshlet current{};
+
+  auto finish_meshlet = [&]() {
+    if (current.index_count == 0) {
+      return;
+    }
+    compute_meshlet_bounds(data, output, current);
+    compute_meshlet_joints(data, output, current);
+    for (size_t i = 0; i < current.vertex_count; i++) {
+      local_indices[output.vertices[current.vertex_offset + i]] = unused;
+    }
+    output.meshlets.push_back(current);
+    current = Meshlet{
+        .index_offset = current.index_offset + current.index_count,
+        .vertex_offset = static_cast<lava::index>(output.vertices.size()),
+    };
+  };
+
+  for (size_t i = 0; i + 2 < data.indices.size(); i += 3) {
+    lava::index const* tri = &data.indices[i];
+    size_t new_vertices = 0;
+    for (size_t j = 0; j < 3; j++) {
+      bool const repeated = (j > 0 && tri[j] == tri[0]) ||
+                            (j > 1 && tri[j] == tri[1]);
+      if (local_indices[tri[j]] == unused && !repeated) {
+        new_vertices++;
+      }
+    }
+    if (current.vertex_count + new_vertices > max_vertices ||
+        current.index_count / 3 + 1 > max_triangles) {
+      finish_meshlet();
+    }
+    for (size_t j = 0; j < 3; j++) {
+      if (local_indices[tri[j]] == unused) {
+        local_indices[tri[j]] = current.vertex_count++;
+        output.vertices.push_back(tri[j]);
+      }
+      output.triangles[i + j] = local_indices[tri[j]];
+    }
+    current.index_count += 3;
+  }
+  finish_meshlet();
+  return output;
+}
+
+fn pad_meshlet_joints(MeshletData& data, std::vector<float> const& offsets)
+    ->void {
+  for (auto const& meshlet : data.meshlets) {
+    float padding = 0;
+    for (size_t i = 0; i < meshlet.vertex_count; i++) {
+      lava::index const vertex = data.vertices[meshlet.vertex_offset + i];
+      if (vertex < offsets.size()) {
+        padding = std::max(padding, offsets[vertex]);
+      }
+    }
+    for (size_t i = 0; i < meshlet.joint_count; i++) {
+      data.joints[meshlet.joint_offset + i].sphere.w += padding;
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "culling.h"
+#include "fbx_loading.h"
+#include "includes.h"
+
+constexpr size_t meshlet_max_vertices = 64;
+constexpr size_t meshlet_max_triangles = 124;
+
+// Matches Meshlet in meshlet_cull.comp (std430).
+typedef struct {
+  // Bounding sphere: xyz center, w radius.
+  lava::v4 sphere;
+  // Normal cone: xyz axis, w sine of the cone spread. A cutoff of 1 disables
+  // cone culling for the meshlet.
+  lava::v4 cone;
+  // Range of the mesh index buffer covered by this meshlet.
+  lava::index index_offset;
+  lava::index index_count;
+  // Range of MeshletData::vertices used by this meshlet.
+  lava::index vertex_offset;
+  uint32_t vertex_count;
+  // Range of MeshletData::joints bounding this meshlet when skinned.
+  uint32_t joint_offset;
+  uint32_t joint_count;
+  // Pads the stride to the shader's 16-byte alignment.
+  std::array<uint32_t, 2> padding;
+} Meshlet;
+
+// Matches MeshletJoint in meshlet_cull.comp (std430): the bind-pose sphere
+// of a meshlet's vertices influenced by one joint. Linear blend skinning
+// keeps every vertex inside the hull of its joints' transforms of it, so
+// the skinned meshlet lies within these spheres, each moved by its joint's
+// skinning matrix.
+typedef struct {
+  lava::v4 sphere;
+  uint32_t joint;
+  std::array<uint32_t, 3> padding;
+} MeshletJoint;
+
+typedef struct {
+  std::vector<Meshlet> meshlets;
+  // Mesh vertex indices referenced by each meshlet.
+  std::vector<lava::index> vertices;
+  // Meshlet-local triangle corners, parallel to the mesh index buffer. Only
+  // needed by mesh shaders.
+  std::vector<uint8_t> triangles;
+  std::vector<MeshletJoint> joints;
+} MeshletData;
+
+// Matches Ubo_Cull in meshlet_cull.comp (std140).
+typedef struct {
+  lava::mat4 model;
+  std::array<lava::v4, 6> frustum_planes;
+  lava::v4 camera_pos;
+  uint32_t meshlet_count;
+  float radius_scale;
+  // Offset of the culled instance's palette in the palette buffer, in
+  // matrices.
+  uint32_t palette_offset;
+  uint32_t cone_culling;
+} MeshletCullData;
+
+// Split an indexed mesh into clusters in index buffer order. Run this after
+// optimize_mesh() so that clusters are spatially coherent.
+fn build_meshlets(lava::mesh_template_data<skin_vertex> const& data,
+                  size_t max_vertices = meshlet_max_vertices,
+                  size_t max_triangles = meshlet_max_triangles)
+    ->MeshletData;
+
+// Grow every meshlet's joint spheres by the furthest any of its vertices
+// moves away from the base mesh, such as by blend shapes. Offsets are
+// indexed by mesh vertex.
+fn pad_meshlet_joints(MeshletData& data, std::vector<float> const& offsets)
+    ->void;
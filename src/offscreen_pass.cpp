@@ -0,0 +1,194 @@
+#include "offscreen_pass.h"
+
+namespace {
+
+fn create_render_pass(OffscreenPass& pass, VkFormat color_format,
+                      VkFormat depth_format)->bool {
+  std::array<VkAttachmentDescription, 2> const attachments = {{
+      {
+          .format = color_format,
+          .samples = VK_SAMPLE_COUNT_1_BIT,
+          .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+          .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+          .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+          .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+          .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      },
+      {
+          .format = depth_format,
+          .samples = VK_SAMPLE_COUNT_1_BIT,
+          .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+          .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+          .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+          .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+          .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      },
+  }};
+  VkAttachmentReference const color_reference{
+      .attachment = 0,
+      .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+  VkAttachmentReference const depth_reference{
+      .attachment = 1,
+      .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+  };
+  VkSubpassDescription const subpass{
+      .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &color_reference,
+      .pDepthStencilAttachment = &depth_reference,
+  };
+  // The previous frame's composite must have read the color target, and its
+  // depth tests finished, before this frame clears them.
+  std::array<VkSubpassDependency, 2> const dependencies = {{
+      {
+          .srcSubpass = VK_SUBPASS_EXTERNAL,
+          .dstSubpass = 0,
+          .srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                          VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+          .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                          VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+          .srcAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                           VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                           VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      },
+      {
+          .srcSubpass = 0,
+          .dstSubpass = VK_SUBPASS_EXTERNAL,
+          .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+          .dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+          .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+      },
+  }};
+  VkRenderPassCreateInfo const render_pass_info{
+      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+      .attachmentCount = static_cast<uint32_t>(attachments.size()),
+      .pAttachments = attachments.data(),
+      .subpassCount = 1,
+      .pSubpasses = &subpass,
+      .dependencyCount = static_cast<uint32_t>(dependencies.size()),
+      .pDependencies = dependencies.data(),
+  };
+  return vkCreateRenderPass(pass.device->get(), &render_pass_info, nullptr,
+                            &pass.render_pass) == VK_SUCCESS;
+}
+
+}  // namespace
+
+fn create_offscreen_pass(OffscreenPass& pass, lava::device_ptr device,
+                         VkFormat color_format, VkImageView color_view,
+                         VkFormat depth_format, VkImageView depth_view,
+                         lava::uv2 size)->bool {
+  pass.device = device;
+  pass.color_view = color_view;
+  pass.size = size;
+  if (!create_render_pass(pass, color_format, depth_format)) {
+    std::cout << "Failed to create the offscreen pass." << std::endl;
+    destroy_offscreen_pass(pass);
+    return false;
+  }
+
+  std::array<VkImageView, 2> const views = {color_view, depth_view};
+  VkFramebufferCreateInfo const framebuffer_info{
+      .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+      .renderPass = pass.render_pass,
+      .attachmentCount = static_cast<uint32_t>(views.size()),
+      .pAttachments = views.data(),
+      .width = size.x,
+      .height = size.y,
+      .layers = 1,
+  };
+  VkSamplerCreateInfo const sampler_info{
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+      .magFilter = VK_FILTER_NEAREST,
+      .minFilter = VK_FILTER_NEAREST,
+      .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+      .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+  };
+  if (vkCreateFramebuffer(device->get(), &framebuffer_info, nullptr,
+                          &pass.framebuffer) != VK_SUCCESS ||
+      vkCreateSampler(device->get(), &sampler_info, nullptr,
+                      &pass.sampler) != VK_SUCCESS) {
+    std::cout << "Failed to create the offscreen pass." << std::endl;
+    destroy_offscreen_pass(pass);
+    return false;
+  }
+  return true;
+}
+
+fn destroy_offscreen_pass(OffscreenPass& pass)->void {
+  if (!pass.device) {
+    return;
+  }
+  VkDevice const device = pass.device->get();
+  vkDestroySampler(device, pass.sampler, nullptr);
+  vkDestroyFramebuffer(device, pass.framebuffer, nullptr);
+  vkDestroyRenderPass(device, pass.render_pass, nullptr);
+  pass = {};
+}
+
+fn offscreen_pass_inheritance(OffscreenPass const& pass)
+    ->VkCommandBufferInheritanceInfo {
+  return {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+      .renderPass = pass.render_pass,
+      .subpass = 0,
+      .framebuffer = pass.framebuffer,
+  };
+}
+
+fn set_offscreen_viewport(OffscreenPass const& pass, VkCommandBuffer cmd_buf)
+    ->void {
+  VkViewport const viewport{0,
+                            0,
+                            static_cast<float>(pass.size.x),
+                            static_cast<float>(pass.size.y),
+                            0,
+                            1};
+  VkRect2D const scissor{{0, 0}, {pass.size.x, pass.size.y}};
+  vkCmdSetViewport(cmd_buf, 0, 1, &viewport);
+  vkCmdSetScissor(cmd_buf, 0, 1, &scissor);
+}
+
+fn begin_offscreen_pass(OffscreenPass const& pass, VkCommandBuffer cmd_buf,
+                        VkSubpassContents contents)->void {
+  std::array<VkClearValue, 2> clear_values{};
+  clear_values[1].depthStencil = {1, 0};
+  VkRenderPassBeginInfo const begin_info{
+      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+      .renderPass = pass.render_pass,
+      .framebuffer = pass.framebuffer,
+      .renderArea = {{0, 0}, {pass.size.x, pass.size.y}},
+      .clearValueCount = static_cast<uint32_t>(clear_values.size()),
+      .pClearValues = clear_values.data(),
+  };
+  vkCmdBeginRenderPass(cmd_buf, &begin_info, contents);
+  if (contents == VK_SUBPASS_CONTENTS_INLINE) {
+    set_offscreen_viewport(pass, cmd_buf);
+  }
+}
+
+fn execute_offscreen_pass(OffscreenPass const& pass, VkCommandBuffer cmd_buf,
+                          std::vector<VkCommandBuffer> const& secondaries)
+    ->void {
+  begin_offscreen_pass(pass, cmd_buf,
+                       VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  if (!secondaries.empty()) {
+    vkCmdExecuteCommands(cmd_buf, secondaries.size(), secondaries.data());
+  }
+  vkCmdEndRenderPass(cmd_buf);
+}
+
+fn offscreen_color_info(OffscreenPass const& pass)->VkDescriptorImageInfo {
+  return {
+      .sampler = pass.sampler,
+      .imageView = pass.color_view,
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+
+// A render pass over an offscreen color and depth target, which draws
+// recorded inline or on job threads render into, to be composited into the
+// shading pass. The shading pass records its subpass inline, so it can't
+// execute secondary command buffers itself. The formats match the shading
+// pass's, so its pipelines draw here unchanged. The targets belong to the
+// caller.
+typedef struct {
+  lava::device_ptr device;
+  VkImageView color_view;
+  VkRenderPass render_pass;
+  VkFramebuffer framebuffer;
+  VkSampler sampler;
+  lava::uv2 size;
+} OffscreenPass;
+
+// Recreate it whenever the targets are.
+fn create_offscreen_pass(OffscreenPass& pass, lava::device_ptr device,
+                         VkFormat color_format, VkImageView color_view,
+                         VkFormat depth_format, VkImageView depth_view,
+                         lava::uv2 size)->bool;
+
+fn destroy_offscreen_pass(OffscreenPass& pass)->void;
+
+// For secondary command buffers executed by execute_offscreen_pass().
+fn offscreen_pass_inheritance(OffscreenPass const& pass)
+    ->VkCommandBufferInheritanceInfo;
+
+// The pipelines leave the viewport and scissor dynamic, and secondaries
+// don't inherit them.
+fn set_offscreen_viewport(OffscreenPass const& pass, VkCommandBuffer cmd_buf)
+    ->void;
+
+// Begin the pass, clearing the target to transparent. Inline draws follow,
+// then vkCmdEndRenderPass(). Afterwards, fragment shaders can sample the
+// color target.
+fn begin_offscreen_pass(OffscreenPass const& pass, VkCommandBuffer cmd_buf,
+                        VkSubpassContents contents)->void;
+
+// Run the whole pass over the secondaries.
+fn execute_offscreen_pass(OffscreenPass const& pass, VkCommandBuffer cmd_buf,
+                          std::vector<VkCommandBuffer> const& secondaries)
+    ->void;
+
+fn offscreen_color_info(OffscreenPass const& pass)->VkDescriptorImageInfo;
@@ -0,0 +1,103 @@
+#include "parallel_recording.h"
+
+#include "trace.h"
+
+namespace {
+
+fn next_buffer(VkDevice device, RecordingPool& pool)->VkCommandBuffer {
+  if (pool.used == pool.buffers.size()) {
+    VkCommandBufferAllocateInfo const alloc_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = pool.pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+        .commandBufferCount = 1,
+    };
+    VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+    if (vkAllocateCommandBuffers(device, &alloc_info, &cmd_buf) !=
+        VK_SUCCESS) {
+      return VK_NULL_HANDLE;
+    }
+    pool.buffers.push_back(cmd_buf);
+  }
+  return pool.buffers[pool.used++];
+}
+
+}  // namespace
+
+fn create_parallel_recorder(ParallelRecorder& recorder, VkDevice device,
+                            uint32_t queue_family, size_t frame_count,
+                            size_t thread_count)->bool {
+  recorder.device = device;
+  recorder.pools.resize(frame_count);
+  for (auto& frame_pools : recorder.pools) {
+    frame_pools.resize(thread_count);
+    for (auto& pool : frame_pools) {
+      // Reset as a whole every frame, rather than per buffer.
+      VkCommandPoolCreateInfo const pool_info{
+          .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+          .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+          .queueFamilyIndex = queue_family,
+      };
+      if (vkCreateCommandPool(device, &pool_info, nullptr, &pool.pool) !=
+          VK_SUCCESS) {
+        std::cout << "Failed to create a recording command pool."
+                  << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+fn destroy_parallel_recorder(ParallelRecorder& recorder)->void {
+  for (auto& frame_pools : recorder.pools) {
+    for (auto& pool : frame_pools) {
+      if (pool.pool) {
+        vkDestroyCommandPool(recorder.device, pool.pool, nullptr);
+      }
+    }
+  }
+  recorder.pools.clear();
+}
+
+fn begin_parallel_recording(ParallelRecorder& recorder, size_t frame)->void {
+  for (auto& pool : recorder.pools[frame]) {
+    vkResetCommandPool(recorder.device, pool.pool, 0);
+    pool.used = 0;
+  }
+}
+
+fn record_parallel(
+    ParallelRecorder& recorder, JobSystem& jobs, size_t frame,
+    VkCommandBufferInheritanceInfo const& inheritance, size_t count,
+    size_t chunk_size,
+    std::function<void(VkCommandBuffer, size_t, size_t)> const& record)
+    ->std::vector<VkCommandBuffer> {
+  TRACE_SCOPE("record_parallel");
+  chunk_size = std::max<size_t>(chunk_size, 1);
+  std::vector<VkCommandBuffer> buffers((count + chunk_size - 1) / chunk_size,
+                                       VK_NULL_HANDLE);
+  std::vector<RecordingPool>& frame_pools = recorder.pools[frame];
+  parallel_for(jobs, count, chunk_size, [&](size_t first, size_t last) {
+    TRACE_SCOPE("record chunk");
+    RecordingPool& pool = frame_pools[current_job_thread(jobs)];
+    VkCommandBuffer cmd_buf = next_buffer(recorder.device, pool);
+    if (!cmd_buf) {
+      return;
+    }
+    VkCommandBufferBeginInfo const begin_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                 VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance,
+    };
+    vkBeginCommandBuffer(cmd_buf, &begin_info);
+    record(cmd_buf, first, last);
+    vkEndCommandBuffer(cmd_buf);
+    buffers[first / chunk_size] = cmd_buf;
+  });
+  // Chunks that failed to allocate are dropped.
+  buffers.erase(std::remove(buffers.begin(), buffers.end(), VK_NULL_HANDLE),
+                buffers.end());
+  return buffers;
+}
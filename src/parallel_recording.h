@@ -0,0 +1,45 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+#include "job_system.h"
+
+// Draws recorded per secondary command buffer. Small chunks balance better
+// across threads, large ones cost fewer vkCmdExecuteCommands entries.
+constexpr size_t default_recording_chunk_size = 256;
+
+// Secondary command buffers of one job thread for one frame in flight. The
+// pool is only touched by its thread, so recording takes no locks.
+typedef struct {
+  VkCommandPool pool;
+  std::vector<VkCommandBuffer> buffers;
+  // Buffers handed out since the last reset.
+  size_t used;
+} RecordingPool;
+
+typedef struct {
+  VkDevice device;
+  // Indexed by frame in flight, then by job thread.
+  std::vector<std::vector<RecordingPool>> pools;
+} ParallelRecorder;
+
+fn create_parallel_recorder(ParallelRecorder& recorder, VkDevice device,
+                            uint32_t queue_family, size_t frame_count,
+                            size_t thread_count)->bool;
+
+fn destroy_parallel_recorder(ParallelRecorder& recorder)->void;
+
+// Reset a frame's pools, once the GPU is done with its command buffers.
+fn begin_parallel_recording(ParallelRecorder& recorder, size_t frame)->void;
+
+// Split [0, count) into chunks and record each into its own secondary
+// command buffer on the job system, with record(cmd_buf, first, last).
+// Returns the buffers in chunk order, for vkCmdExecuteCommands() in a
+// subpass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+fn record_parallel(
+    ParallelRecorder& recorder, JobSystem& jobs, size_t frame,
+    VkCommandBufferInheritanceInfo const& inheritance, size_t count,
+    size_t chunk_size,
+    std::function<void(VkCommandBuffer, size_t, size_t)> const& record)
+    ->std::vector<VkCommandBuffer>;
@@ -0,0 +1,97 @@
+#include "pipeline_cache.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+constexpr uint32_t pipeline_cache_magic = 0x4843504c;  // "LPCH"
+
+fn make_header(lava::device_ptr device)->PipelineCacheHeader {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device->get_vk_physical_device(), &properties);
+  PipelineCacheHeader header{
+      .magic = pipeline_cache_magic,
+      .vendor_id = properties.vendorID,
+      .device_id = properties.deviceID,
+      .driver_version = properties.driverVersion,
+      .data_size = 0,
+  };
+  std::memcpy(header.cache_uuid.data(), properties.pipelineCacheUUID,
+              VK_UUID_SIZE);
+  return header;
+}
+
+fn matches(PipelineCacheHeader const& a, PipelineCacheHeader const& b)->bool {
+  return a.magic == b.magic && a.vendor_id == b.vendor_id &&
+         a.device_id == b.device_id && a.driver_version == b.driver_version &&
+         a.cache_uuid == b.cache_uuid;
+}
+
+}  // namespace
+
+fn load_pipeline_cache(lava::device_ptr device, std::string const& path)
+    ->VkPipelineCache {
+  PipelineCacheHeader const expected = make_header(device);
+  std::vector<char> data;
+  std::ifstream file(path, std::ios::binary);
+  if (file) {
+    PipelineCacheHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (file && matches(header, expected)) {
+      data.resize(header.data_size);
+      file.read(data.data(), data.size());
+      if (!file) {
+        data.clear();
+      }
+    } else {
+      std::cout << "Discarding pipeline cache from another device or driver."
+                << std::endl;
+    }
+  }
+
+  VkPipelineCacheCreateInfo const create_info{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = data.size(),
+      .pInitialData = data.empty() ? nullptr : data.data(),
+  };
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  if (vkCreatePipelineCache(device->get(), &create_info, nullptr, &cache) !=
+      VK_SUCCESS) {
+    std::cout << "Failed to create pipeline cache." << std::endl;
+    return VK_NULL_HANDLE;
+  }
+  std::cout << "Pipeline cache: " << data.size() / 1024 << " KiB loaded\n";
+  return cache;
+}
+
+fn save_pipeline_cache(lava::device_ptr device, VkPipelineCache cache,
+                       std::string const& path)->bool {
+  if (!cache) {
+    return false;
+  }
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device->get(), cache, &size, nullptr) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device->get(), cache, &size, data.data()) !=
+      VK_SUCCESS) {
+    return false;
+  }
+
+  // Write to a temporary file first, so a crash never leaves a torn cache.
+  std::string const temp_path = path + ".tmp";
+  {
+    PipelineCacheHeader header = make_header(device);
+    header.data_size = size;
+    std::ofstream file(temp_path, std::ios::binary);
+    file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    file.write(data.data(), size);
+    if (!file) {
+      return false;
+    }
+  }
+  return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+
+// Written in front of the driver's cache data. A cache is only reused on the
+// device and driver that wrote it.
+typedef struct {
+  uint32_t magic;
+  uint32_t vendor_id;
+  uint32_t device_id;
+  uint32_t driver_version;
+  std::array<uint8_t, VK_UUID_SIZE> cache_uuid;
+  uint64_t data_size;
+} PipelineCacheHeader;
+
+// Starts empty when the file is missing or was written by another device or
+// driver.
+fn load_pipeline_cache(lava::device_ptr device, std::string const& path)
+    ->VkPipelineCache;
+
+fn save_pipeline_cache(lava::device_ptr device, VkPipelineCache cache,
+                       std::string const& path)->bool;
@@ -2,7 +2,7 @@
 
 #include <iostream>
 
-fn create_mesh_descriptor_layout(lava::app& app)
+fn create_mesh_descriptor_layout(lava::app& app, uint32_t texture_count)
     ->std::tuple<lava::descriptor::ptr, lava::descriptor::ptr,
                  lava::descriptor::ptr, lava::descriptor::ptr> {
   lava::descriptor::ptr descriptor_layout_global = lava::make_descriptor();
@@ -18,17 +18,24 @@ fn create_mesh_descriptor_layout(lava::app& app)
                                   VK_SHADER_STAGE_FRAGMENT_BIT);
   global_binding->set_count(1);
 
-  // Diffuse, emissive, normal, and specular maps.
+  // Every texture of every material, indexed through the material buffer,
+  // or just one material's slots on devices without bindless textures.
   lava::descriptor::binding::ptr textures_binding =
       lava::make_descriptor_binding(0);
   textures_binding->set_type(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
   textures_binding->set_stage_flags(VK_SHADER_STAGE_FRAGMENT_BIT);
-  textures_binding->set_count(4);
+  textures_binding->set_count(texture_count);
 
-  // Model matrix.
+  lava::descriptor::binding::ptr materials_binding =
+      lava::make_descriptor_binding(1);
+  materials_binding->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  materials_binding->set_stage_flags(VK_SHADER_STAGE_FRAGMENT_BIT);
+  materials_binding->set_count(1);
+
+  // Per-instance model matrices.
   lava::descriptor::binding::ptr object_binding =
       lava::make_descriptor_binding(0);
-  object_binding->set_type(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+  object_binding->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
   object_binding->set_stage_flags(VK_SHADER_STAGE_VERTEX_BIT);
   object_binding->set_count(1);
 
@@ -39,31 +46,32 @@ fn create_mesh_descriptor_layout(lava::app& app)
   invbind_binding->set_stage_flags(VK_SHADER_STAGE_VERTEX_BIT);
   invbind_binding->set_count(1);
 
-  lava::descriptor::binding::ptr keyframe_trans_cur_binding =
+  // Skinning palettes of every instance.
+  lava::descriptor::binding::ptr palettes_binding =
       lava::make_descriptor_binding(1);
-  keyframe_trans_cur_binding->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  keyframe_trans_cur_binding->set_stage_flags(VK_SHADER_STAGE_VERTEX_BIT);
-  keyframe_trans_cur_binding->set_count(1);
-
-  lava::descriptor::binding::ptr keyframe_trans_next_binding =
-      lava::make_descriptor_binding(2);
-  keyframe_trans_next_binding->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  keyframe_trans_next_binding->set_stage_flags(VK_SHADER_STAGE_VERTEX_BIT);
-  keyframe_trans_next_binding->set_count(1);
-
-  lava::descriptor::binding::ptr keyframe_binding =
-      lava::make_descriptor_binding(3);
-  keyframe_binding->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  keyframe_binding->set_stage_flags(VK_SHADER_STAGE_VERTEX_BIT);
-  keyframe_binding->set_count(1);
+  palettes_binding->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  palettes_binding->set_stage_flags(VK_SHADER_STAGE_VERTEX_BIT);
+  palettes_binding->set_count(1);
+
+  // Blend shapes: each vertex's range of deltas, the deltas, and the
+  // channel weights of every instance.
+  std::array<lava::descriptor::binding::ptr, 3> morph_bindings;
+  for (uint32_t i = 0; i < morph_bindings.size(); i++) {
+    morph_bindings[i] = lava::make_descriptor_binding(2 + i);
+    morph_bindings[i]->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    morph_bindings[i]->set_stage_flags(VK_SHADER_STAGE_VERTEX_BIT);
+    morph_bindings[i]->set_count(1);
+  }
 
   descriptor_layout_global->add(global_binding);
   descriptor_layout_textures->add(textures_binding);
+  descriptor_layout_textures->add(materials_binding);
   descriptor_layout_object->add(object_binding);
   descriptor_layout_animation->add(invbind_binding);
-  descriptor_layout_animation->add(keyframe_trans_cur_binding);
-  descriptor_layout_animation->add(keyframe_trans_next_binding);
-  descriptor_layout_animation->add(keyframe_binding);
+  descriptor_layout_animation->add(palettes_binding);
+  for (auto& binding : morph_bindings) {
+    descriptor_layout_animation->add(binding);
+  }
 
   descriptor_layout_global->create(app.device);
   descriptor_layout_textures->create(app.device);
@@ -128,3 +136,108 @@ fn create_bone_descriptors_layout(lava::app& app)
   descriptor_layout_object->create(app.device);
   return {descriptor_layout_global, descriptor_layout_object};
 }
+
+fn create_meshlet_cull_descriptor_layout(lava::app& app)
+    ->lava::descriptor::ptr {
+  lava::descriptor::ptr descriptor_layout = lava::make_descriptor();
+
+  // Model matrix, frustum planes, and culling parameters.
+  lava::descriptor::binding::ptr cull_binding =
+      lava::make_descriptor_binding(0);
+  cull_binding->set_type(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+  cull_binding->set_stage_flags(VK_SHADER_STAGE_COMPUTE_BIT);
+  cull_binding->set_count(1);
+
+  // Meshlet bounds.
+  lava::descriptor::binding::ptr meshlets_binding =
+      lava::make_descriptor_binding(1);
+  meshlets_binding->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  meshlets_binding->set_stage_flags(VK_SHADER_STAGE_COMPUTE_BIT);
+  meshlets_binding->set_count(1);
+
+  // One indirect draw per meshlet.
+  lava::descriptor::binding::ptr draws_binding =
+      lava::make_descriptor_binding(2);
+  draws_binding->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  draws_binding->set_stage_flags(VK_SHADER_STAGE_COMPUTE_BIT);
+  draws_binding->set_count(1);
+
+  // Joint spheres of every meshlet, and the palettes that pose them.
+  std::array<lava::descriptor::binding::ptr, 2> skin_bindings;
+  for (uint32_t i = 0; i < skin_bindings.size(); i++) {
+    skin_bindings[i] = lava::make_descriptor_binding(3 + i);
+    skin_bindings[i]->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    skin_bindings[i]->set_stage_flags(VK_SHADER_STAGE_COMPUTE_BIT);
+    skin_bindings[i]->set_count(1);
+  }
+
+  descriptor_layout->add(cull_binding);
+  descriptor_layout->add(meshlets_binding);
+  descriptor_layout->add(draws_binding);
+  for (auto& binding : skin_bindings) {
+    descriptor_layout->add(binding);
+  }
+  descriptor_layout->create(app.device);
+  return descriptor_layout;
+}
+
+fn create_instance_cull_descriptor_layout(lava::app& app)
+    ->lava::descriptor::ptr {
+  lava::descriptor::ptr descriptor_layout = lava::make_descriptor();
+
+  // Frustum planes, pose bounds, and LOD parameters.
+  lava::descriptor::binding::ptr cull_binding =
+      lava::make_descriptor_binding(0);
+  cull_binding->set_type(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+  cull_binding->set_stage_flags(VK_SHADER_STAGE_COMPUTE_BIT);
+  cull_binding->set_count(1);
+
+  // Instances, LOD ranges, compacted indirect draws, and their count.
+  descriptor_layout->add(cull_binding);
+  for (uint32_t i = 1; i <= 4; i++) {
+    lava::descriptor::binding::ptr storage_binding =
+        lava::make_descriptor_binding(i);
+    storage_binding->set_type(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    storage_binding->set_stage_flags(VK_SHADER_STAGE_COMPUTE_BIT);
+    storage_binding->set_count(1);
+    descriptor_layout->add(storage_binding);
+  }
+  descriptor_layout->create(app.device);
+  return descriptor_layout;
+}
+
+fn create_composite_descriptor_layout(lava::app& app)
+    ->lava::descriptor::ptr {
+  lava::descriptor::ptr descriptor_layout = lava::make_descriptor();
+
+  // The offscreen color target.
+  lava::descriptor::binding::ptr color_binding =
+      lava::make_descriptor_binding(0);
+  color_binding->set_type(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+  color_binding->set_stage_flags(VK_SHADER_STAGE_FRAGMENT_BIT);
+  color_binding->set_count(1);
+
+  descriptor_layout->add(color_binding);
+  descriptor_layout->create(app.device);
+  return descriptor_layout;
+}
+
+fn create_compute_pipeline(lava::app& app,
+                           lava::pipeline_layout::ptr pipeline_layout,
+                           lava::cdata const& shader_code,
+                           VkPipelineCache pipeline_cache)
+    ->lava::compute_pipeline::ptr {
+  TRACE_SCOPE("create_compute_pipeline");
+  lava::compute_pipeline::ptr pipeline =
+      lava::make_compute_pipeline(app.device, pipeline_cache);
+  if (!pipeline->set_shader_stage(shader_code, VK_SHADER_STAGE_COMPUTE_BIT)) {
+    std::cout << "Failed to create shader module." << std::endl;
+    return nullptr;
+  }
+  pipeline->set_layout(pipeline_layout);
+  if (!pipeline->create()) {
+    std::cout << "Failed to create compute pipeline." << std::endl;
+    return nullptr;
+  }
+  return pipeline;
+}
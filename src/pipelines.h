@@ -3,20 +3,41 @@
 #include <liblava/lava.hpp>
 
 #include "includes.h"
+#include "shader_permutations.h"
+#include "trace.h"
 
-fn create_mesh_descriptor_layout(lava::app& app)
+fn create_mesh_descriptor_layout(lava::app& app, uint32_t texture_count)
     ->std::tuple<lava::descriptor::ptr, lava::descriptor::ptr,
                  lava::descriptor::ptr, lava::descriptor::ptr>;
 
 fn create_bone_descriptors_layout(lava::app& app)
     ->std::tuple<lava::descriptor::ptr, lava::descriptor::ptr>;
 
+fn create_meshlet_cull_descriptor_layout(lava::app& app)->lava::descriptor::ptr;
+
+fn create_instance_cull_descriptor_layout(lava::app& app)
+    ->lava::descriptor::ptr;
+
+fn create_composite_descriptor_layout(lava::app& app)->lava::descriptor::ptr;
+
+// Pipelines may be created from any thread, and share the cache if given.
+fn create_compute_pipeline(lava::app& app,
+                           lava::pipeline_layout::ptr pipeline_layout,
+                           lava::cdata const& shader_code,
+                           VkPipelineCache pipeline_cache = VK_NULL_HANDLE)
+    ->lava::compute_pipeline::ptr;
+
+// The pipeline is not added to the render pass, since that must happen on
+// the main thread. Shader constants, if given, specialize every stage.
 template <typename T>
 fn create_graphics_pipeline(
     lava::app& app, lava::pipeline_layout::ptr pipeline_layout,
-    std::vector<std::tuple<std::string, VkShaderStageFlagBits>>& shader_modules,
+    std::vector<std::tuple<lava::cdata, VkShaderStageFlagBits>> const&
+        shader_modules,
     lava::VkVertexInputAttributeDescriptions vertex_attributes,
-    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST)
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE,
+    ShaderConstants const* shader_constants = nullptr)
     ->lava::graphics_pipeline::ptr;
 
 #include "pipelines.tpp"
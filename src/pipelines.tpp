@@ -0,0 +1,44 @@
+template <typename T>
+fn create_graphics_pipeline(
+    lava::app& app, lava::pipeline_layout::ptr pipeline_layout,
+    std::vector<std::tuple<lava::cdata, VkShaderStageFlagBits>> const&
+        shader_modules,
+    lava::VkVertexInputAttributeDescriptions vertex_attributes,
+    VkPrimitiveTopology topology, VkPipelineCache pipeline_cache,
+    ShaderConstants const* shader_constants)
+    ->lava::graphics_pipeline::ptr {
+  TRACE_SCOPE("create_graphics_pipeline");
+  lava::graphics_pipeline::ptr pipeline =
+      lava::make_graphics_pipeline(app.device, pipeline_cache);
+  for (auto const& [shader_code, stage] : shader_modules) {
+    lava::shader_stage::ptr shader_stage =
+        lava::make_pipeline_shader_stage(stage);
+    lava::cdata specialization_data;
+    if (shader_constants) {
+      for (auto const& entry : shader_constant_entries()) {
+        shader_stage->add_specialization_entry(entry);
+      }
+      specialization_data =
+          lava::cdata(shader_constants, sizeof(ShaderConstants));
+    }
+    if (!shader_stage->create(app.device, shader_code,
+                              specialization_data)) {
+      std::cout << "Failed to create shader module." << std::endl;
+      return nullptr;
+    }
+    pipeline->add(shader_stage);
+  }
+  pipeline->add_color_blend_attachment();
+  pipeline->set_depth_test_and_write();
+  pipeline->set_depth_compare_op(VK_COMPARE_OP_LESS_OR_EQUAL);
+  pipeline->set_vertex_input_binding(
+      {0, sizeof(T), VK_VERTEX_INPUT_RATE_VERTEX});
+  pipeline->set_vertex_input_attributes(vertex_attributes);
+  pipeline->set_input_topology(topology);
+  pipeline->set_layout(pipeline_layout);
+  if (!pipeline->create(app.shading.get_vk_pass())) {
+    std::cout << "Failed to create graphics pipeline." << std::endl;
+    return nullptr;
+  }
+  return pipeline;
+}
@@ -0,0 +1,550 @@
+// Headless benchmark of recording draws into secondary command buffers on
+// the job system, at every thread count from 1 up to the core count. Needs a
+// Vulkan device but creates no window.
+//
+// Usage: record_bench [--draws N] [--repetitions N] [--out results.json]
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <liblava/lava.hpp>
+#include <thread>
+
+#include "includes.h"
+#include "job_system.h"
+#include "parallel_recording.h"
+#include "record_bench_frag_spv.h"
+#include "record_bench_vert_spv.h"
+
+namespace {
+
+constexpr uint32_t target_size = 256;
+constexpr VkFormat target_format = VK_FORMAT_R8G8B8A8_UNORM;
+
+typedef struct {
+  VkInstance instance;
+  VkPhysicalDevice physical_device;
+  VkDevice device;
+  uint32_t queue_family;
+  VkQueue queue;
+  VkImage image;
+  VkDeviceMemory memory;
+  VkImageView view;
+  VkRenderPass render_pass;
+  VkFramebuffer framebuffer;
+  VkPipelineLayout pipeline_layout;
+  VkPipeline pipeline;
+  VkCommandPool command_pool;
+  VkCommandBuffer cmd_buf;
+  VkFence fence;
+} HeadlessContext;
+
+typedef struct {
+  size_t threads;
+  // Milliseconds per repetition.
+  std::vector<double> samples;
+} RecordResult;
+
+fn elapsed_ms(std::chrono::steady_clock::time_point start)->double {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+template <size_t N>
+fn create_shader_module(VkDevice device, std::array<uint32_t, N> const& code)
+    ->VkShaderModule {
+  VkShaderModuleCreateInfo const create_info{
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .codeSize = N * sizeof(uint32_t),
+      .pCode = code.data(),
+  };
+  VkShaderModule module = VK_NULL_HANDLE;
+  vkCreateShaderModule(device, &create_info, nullptr, &module);
+  return module;
+}
+
+fn create_device(HeadlessContext& context)->bool {
+  if (volkInitialize() != VK_SUCCESS) {
+    std::cout << "No Vulkan loader." << std::endl;
+    return false;
+  }
+  VkApplicationInfo const app_info{
+      .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+      .pApplicationName = "record_bench",
+      .apiVersion = VK_API_VERSION_1_1,
+  };
+  VkInstanceCreateInfo const instance_info{
+      .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+      .pApplicationInfo = &app_info,
+  };
+  if (vkCreateInstance(&instance_info, nullptr, &context.instance) !=
+      VK_SUCCESS) {
+    std::cout << "Failed to create a Vulkan instance." << std::endl;
+    return false;
+  }
+  volkLoadInstance(context.instance);
+
+  uint32_t device_count = 0;
+  vkEnumeratePhysicalDevices(context.instance, &device_count, nullptr);
+  std::vector<VkPhysicalDevice> devices(device_count);
+  vkEnumeratePhysicalDevices(context.instance, &device_count, devices.data());
+  for (VkPhysicalDevice physical_device : devices) {
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                             nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                             families.data());
+    for (uint32_t i = 0; i < family_count; i++) {
+      if (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        context.physical_device = physical_device;
+        context.queue_family = i;
+        break;
+      }
+    }
+    if (context.physical_device) {
+      break;
+    }
+  }
+  if (!context.physical_device) {
+    std::cout << "No device with a graphics queue." << std::endl;
+    return false;
+  }
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(context.physical_device, &properties);
+  std::cout << "Device: " << properties.deviceName << '\n';
+
+  float const priority = 1;
+  VkDeviceQueueCreateInfo const queue_info{
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = context.queue_family,
+      .queueCount = 1,
+      .pQueuePriorities = &priority,
+  };
+  VkDeviceCreateInfo const device_info{
+      .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .queueCreateInfoCount = 1,
+      .pQueueCreateInfos = &queue_info,
+  };
+  if (vkCreateDevice(context.physical_device, &device_info, nullptr,
+                     &context.device) != VK_SUCCESS) {
+    std::cout << "Failed to create a Vulkan device." << std::endl;
+    return false;
+  }
+  volkLoadDevice(context.device);
+  vkGetDeviceQueue(context.device, context.queue_family, 0, &context.queue);
+  return true;
+}
+
+// An offscreen color target and a render pass whose subpass takes its
+// commands from secondary command buffers.
+fn create_target(HeadlessContext& context)->bool {
+  VkDevice const device = context.device;
+  VkImageCreateInfo const image_info{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = target_format,
+      .extent = {target_size, target_size, 1},
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+  };
+  if (vkCreateImage(device, &image_info, nullptr, &context.image) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(device, context.image, &requirements);
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(context.physical_device,
+                                      &memory_properties);
+  uint32_t memory_type = UINT32_MAX;
+  for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+    if (requirements.memoryTypeBits & (1u << i)) {
+      memory_type = i;
+      break;
+    }
+  }
+  VkMemoryAllocateInfo const alloc_info{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = requirements.size,
+      .memoryTypeIndex = memory_type,
+  };
+  if (memory_type == UINT32_MAX ||
+      vkAllocateMemory(device, &alloc_info, nullptr, &context.memory) !=
+          VK_SUCCESS) {
+    return false;
+  }
+  vkBindImageMemory(device, context.image, context.memory, 0);
+  VkImageViewCreateInfo const view_info{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = context.image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = target_format,
+      .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+  };
+  if (vkCreateImageView(device, &view_info, nullptr, &context.view) !=
+      VK_SUCCESS) {
+    return false;
+  }
+
+  VkAttachmentDescription const attachment{
+      .format = target_format,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+  VkAttachmentReference const color_reference{
+      .attachment = 0,
+      .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+  VkSubpassDescription const subpass{
+      .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &color_reference,
+  };
+  VkRenderPassCreateInfo const render_pass_info{
+      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+      .attachmentCount = 1,
+      .pAttachments = &attachment,
+      .subpassCount = 1,
+      .pSubpasses = &subpass,
+  };
+  if (vkCreateRenderPass(device, &render_pass_info, nullptr,
+                         &context.render_pass) != VK_SUCCESS) {
+    return false;
+  }
+  VkFramebufferCreateInfo const framebuffer_info{
+      .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+      .renderPass = context.render_pass,
+      .attachmentCount = 1,
+      .pAttachments = &context.view,
+      .width = target_size,
+      .height = target_size,
+      .layers = 1,
+  };
+  return vkCreateFramebuffer(device, &framebuffer_info, nullptr,
+                             &context.framebuffer) == VK_SUCCESS;
+}
+
+fn create_pipeline(HeadlessContext& context)->bool {
+  VkDevice const device = context.device;
+  VkPushConstantRange const push_range{
+      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+      .offset = 0,
+      .size = sizeof(lava::v2),
+  };
+  VkPipelineLayoutCreateInfo const layout_info{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &push_range,
+  };
+  if (vkCreatePipelineLayout(device, &layout_info, nullptr,
+                             &context.pipeline_layout) != VK_SUCCESS) {
+    return false;
+  }
+
+  VkShaderModule const vert_module =
+      create_shader_module(device, record_bench_vert_spv);
+  VkShaderModule const frag_module =
+      create_shader_module(device, record_bench_frag_spv);
+  std::array<VkPipelineShaderStageCreateInfo, 2> const stages = {{
+      {
+          .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+          .stage = VK_SHADER_STAGE_VERTEX_BIT,
+          .module = vert_module,
+          .pName = "main",
+      },
+      {
+          .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+          .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+          .module = frag_module,
+          .pName = "main",
+      },
+  }};
+  VkPipelineVertexInputStateCreateInfo const vertex_input{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+  };
+  VkPipelineInputAssemblyStateCreateInfo const input_assembly{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+      .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+  };
+  VkViewport const viewport{0, 0, target_size, target_size, 0, 1};
+  VkRect2D const scissor{{0, 0}, {target_size, target_size}};
+  VkPipelineViewportStateCreateInfo const viewport_state{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+      .viewportCount = 1,
+      .pViewports = &viewport,
+      .scissorCount = 1,
+      .pScissors = &scissor,
+  };
+  VkPipelineRasterizationStateCreateInfo const rasterization{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+      .polygonMode = VK_POLYGON_MODE_FILL,
+      .cullMode = VK_CULL_MODE_NONE,
+      .lineWidth = 1,
+  };
+  VkPipelineMultisampleStateCreateInfo const multisample{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+      .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+  };
+  VkPipelineColorBlendAttachmentState const blend_attachment{
+      .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+  };
+  VkPipelineColorBlendStateCreateInfo const color_blend{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+      .attachmentCount = 1,
+      .pAttachments = &blend_attachment,
+  };
+  VkGraphicsPipelineCreateInfo const pipeline_info{
+      .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+      .stageCount = static_cast<uint32_t>(stages.size()),
+      .pStages = stages.data(),
+      .pVertexInputState = &vertex_input,
+      .pInputAssemblyState = &input_assembly,
+      .pViewportState = &viewport_state,
+      .pRasterizationState = &rasterization,
+      .pMultisampleState = &multisample,
+      .pColorBlendState = &color_blend,
+      .layout = context.pipeline_layout,
+      .renderPass = context.render_pass,
+      .subpass = 0,
+  };
+  VkResult const result = vkCreateGraphicsPipelines(
+      device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &context.pipeline);
+  vkDestroyShaderModule(device, vert_module, nullptr);
+  vkDestroyShaderModule(device, frag_module, nullptr);
+  return result == VK_SUCCESS;
+}
+
+fn create_context(HeadlessContext& context)->bool {
+  if (!create_device(context) || !create_target(context) ||
+      !create_pipeline(context)) {
+    return false;
+  }
+  VkCommandPoolCreateInfo const pool_info{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = context.queue_family,
+  };
+  if (vkCreateCommandPool(context.device, &pool_info, nullptr,
+                          &context.command_pool) != VK_SUCCESS) {
+    return false;
+  }
+  VkCommandBufferAllocateInfo const alloc_info{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = context.command_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+  };
+  VkFenceCreateInfo const fence_info{
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+  };
+  return vkAllocateCommandBuffers(context.device, &alloc_info,
+                                  &context.cmd_buf) == VK_SUCCESS &&
+         vkCreateFence(context.device, &fence_info, nullptr,
+                       &context.fence) == VK_SUCCESS;
+}
+
+fn destroy_context(HeadlessContext& context)->void {
+  if (context.device) {
+    vkDeviceWaitIdle(context.device);
+    vkDestroyFence(context.device, context.fence, nullptr);
+    vkDestroyCommandPool(context.device, context.command_pool, nullptr);
+    vkDestroyPipeline(context.device, context.pipeline, nullptr);
+    vkDestroyPipelineLayout(context.device, context.pipeline_layout, nullptr);
+    vkDestroyFramebuffer(context.device, context.framebuffer, nullptr);
+    vkDestroyRenderPass(context.device, context.render_pass, nullptr);
+    vkDestroyImageView(context.device, context.view, nullptr);
+    vkDestroyImage(context.device, context.image, nullptr);
+    vkFreeMemory(context.device, context.memory, nullptr);
+    vkDestroyDevice(context.device, nullptr);
+  }
+  if (context.instance) {
+    vkDestroyInstance(context.instance, nullptr);
+  }
+}
+
+// Execute the recorded draws, so the driver sees every command buffer it
+// would in a real frame. Not part of the timed recording.
+fn submit_secondaries(HeadlessContext& context,
+                      std::vector<VkCommandBuffer> const& secondaries)->void {
+  VkCommandBufferBeginInfo const begin_info{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  vkBeginCommandBuffer(context.cmd_buf, &begin_info);
+  VkClearValue const clear{};
+  VkRenderPassBeginInfo const pass_info{
+      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+      .renderPass = context.render_pass,
+      .framebuffer = context.framebuffer,
+      .renderArea = {{0, 0}, {target_size, target_size}},
+      .clearValueCount = 1,
+      .pClearValues = &clear,
+  };
+  vkCmdBeginRenderPass(context.cmd_buf, &pass_info,
+                       VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  if (!secondaries.empty()) {
+    vkCmdExecuteCommands(context.cmd_buf, secondaries.size(),
+                         secondaries.data());
+  }
+  vkCmdEndRenderPass(context.cmd_buf);
+  vkEndCommandBuffer(context.cmd_buf);
+  VkSubmitInfo const submit_info{
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &context.cmd_buf,
+  };
+  vkQueueSubmit(context.queue, 1, &submit_info, context.fence);
+  vkWaitForFences(context.device, 1, &context.fence, VK_TRUE, UINT64_MAX);
+  vkResetFences(context.device, 1, &context.fence);
+}
+
+fn run_thread_count(HeadlessContext& context, size_t thread_count,
+                    size_t draw_count, size_t repetitions)->RecordResult {
+  JobSystem jobs;
+  start_job_system(jobs, thread_count - 1);
+  ParallelRecorder recorder{};
+  RecordResult result{thread_count, {}};
+  if (!create_parallel_recorder(recorder, context.device,
+                                context.queue_family, 1,
+                                job_thread_count(jobs))) {
+    stop_job_system(jobs);
+    return result;
+  }
+  VkCommandBufferInheritanceInfo const inheritance{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+      .renderPass = context.render_pass,
+      .subpass = 0,
+      .framebuffer = context.framebuffer,
+  };
+  // Enough chunks to keep every thread busy, without tiny buffers.
+  size_t const chunk_size = std::clamp<size_t>(
+      draw_count / (thread_count * 4), 64, default_recording_chunk_size);
+  auto record = [&](VkCommandBuffer cmd_buf, size_t first, size_t last) {
+    // Secondary command buffers inherit no state, so every chunk binds.
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      context.pipeline);
+    size_t const side = std::ceil(std::sqrt(static_cast<float>(draw_count)));
+    for (size_t i = first; i < last; i++) {
+      lava::v2 const offset(
+          static_cast<float>(i % side) / side * 2 - 1,
+          static_cast<float>(i / side) / side * 2 - 1);
+      vkCmdPushConstants(cmd_buf, context.pipeline_layout,
+                         VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(offset),
+                         &offset);
+      vkCmdDraw(cmd_buf, 3, 1, 0, 0);
+    }
+  };
+
+  // The first pass allocates the command buffers and warms the driver.
+  for (size_t i = 0; i <= repetitions; i++) {
+    begin_parallel_recording(recorder, 0);
+    auto const start = std::chrono::steady_clock::now();
+    std::vector<VkCommandBuffer> const secondaries = record_parallel(
+        recorder, jobs, 0, inheritance, draw_count, chunk_size, record);
+    double const ms = elapsed_ms(start);
+    if (i > 0) {
+      result.samples.push_back(ms);
+    }
+    submit_secondaries(context, secondaries);
+  }
+  destroy_parallel_recorder(recorder);
+  stop_job_system(jobs);
+  return result;
+}
+
+fn median(std::vector<double> samples)->double {
+  if (samples.empty()) {
+    return 0;
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+fn write_json(std::string const& path, std::vector<RecordResult> const& results,
+              size_t draw_count, size_t repetitions)->bool {
+  std::ofstream file(path);
+  file << std::fixed << std::setprecision(4);
+  file << "{\n  \"draws\": " << draw_count << ",\n  \"repetitions\": "
+       << repetitions << ",\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    std::vector<double> const& samples = results[i].samples;
+    file << (i ? ",\n" : "\n") << "    {\"threads\": " << results[i].threads
+         << ", \"ms\": {\"min\": "
+         << *std::min_element(samples.begin(), samples.end())
+         << ", \"p50\": " << median(samples) << ", \"max\": "
+         << *std::max_element(samples.begin(), samples.end()) << "}}";
+  }
+  file << "\n  ]\n}\n";
+  return static_cast<bool>(file);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t draw_count = 10000;
+  size_t repetitions = 20;
+  std::string out_path = "record_bench.json";
+  for (int i = 1; i < argc; i++) {
+    std::string const arg = argv[i];
+    if (arg == "--draws" && i + 1 < argc) {
+      draw_count = std::max(std::stoi(argv[++i]), 1);
+    } else if (arg == "--repetitions" && i + 1 < argc) {
+      repetitions = std::max(std::stoi(argv[++i]), 1);
+    } else if (arg == "--out" && i + 1 < argc) {
+      out_path = argv[++i];
+    }
+  }
+
+  HeadlessContext context{};
+  if (!create_context(context)) {
+    destroy_context(context);
+    return 1;
+  }
+
+  // Powers of two up to the core count, and the core count itself.
+  size_t const core_count =
+      std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  std::vector<size_t> thread_counts;
+  for (size_t threads = 1; threads < core_count; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(core_count);
+
+  std::vector<RecordResult> results;
+  std::cout << std::setw(8) << "threads" << std::setw(10) << "p50 ms"
+            << std::setw(10) << "speedup" << '\n'
+            << std::fixed << std::setprecision(3);
+  for (size_t threads : thread_counts) {
+    RecordResult result =
+        run_thread_count(context, threads, draw_count, repetitions);
+    if (result.samples.empty()) {
+      break;
+    }
+    results.push_back(std::move(result));
+    double const p50 = median(results.back().samples);
+    std::cout << std::setw(8) << threads << std::setw(10) << p50
+              << std::setw(10) << median(results[0].samples) / p50 << '\n';
+  }
+  destroy_context(context);
+  if (results.empty()) {
+    return 1;
+  }
+  if (!write_json(out_path, results, draw_count, repetitions)) {
+    std::cout << "Failed to write " << out_path << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << out_path << '\n';
+  return 0;
+}
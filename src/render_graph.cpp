@@ -0,0 +1,515 @@
+#include "render_graph.h"
+
+#include "trace.h"
+
+namespace {
+
+fn touches(GraphPass const& pass, uint32_t resource)->bool {
+  auto matches = [&](GraphAccess const& access) {
+    return access.resource == resource;
+  };
+  return std::any_of(pass.reads.begin(), pass.reads.end(), matches) ||
+         std::any_of(pass.writes.begin(), pass.writes.end(), matches);
+}
+
+fn writes(GraphPass const& pass, uint32_t resource)->bool {
+  return std::any_of(
+      pass.writes.begin(), pass.writes.end(),
+      [&](GraphAccess const& access) { return access.resource == resource; });
+}
+
+// Passes that must run before each pass: earlier passes that write what it
+// touches, or touch what it writes.
+fn find_dependencies(RenderGraph const& graph)
+    ->std::vector<std::vector<uint32_t>> {
+  std::vector<std::vector<uint32_t>> dependencies(graph.passes.size());
+  for (uint32_t later = 0; later < graph.passes.size(); later++) {
+    for (uint32_t earlier = 0; earlier < later; earlier++) {
+      for (uint32_t resource = 0; resource < graph.resources.size();
+           resource++) {
+        bool const hazard =
+            (writes(graph.passes[earlier], resource) &&
+             touches(graph.passes[later], resource)) ||
+            (writes(graph.passes[later], resource) &&
+             touches(graph.passes[earlier], resource));
+        if (hazard) {
+          dependencies[later].push_back(earlier);
+          break;
+        }
+      }
+    }
+  }
+  return dependencies;
+}
+
+fn find_memory_type(VkPhysicalDevice physical_device, uint32_t type_bits)
+    ->std::optional<uint32_t> {
+  VkPhysicalDeviceMemoryProperties properties;
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &properties);
+  for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+    if ((type_bits & (1u << i)) &&
+        (properties.memoryTypes[i].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+fn image_aspect(VkFormat format)->VkImageAspectFlags {
+  switch (format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:
+      return VK_IMAGE_ASPECT_DEPTH_BIT;
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+      return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    case VK_FORMAT_S8_UINT:
+      return VK_IMAGE_ASPECT_STENCIL_BIT;
+    default:
+      return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+fn align_up(VkDeviceSize size, VkDeviceSize alignment)->VkDeviceSize {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// Create the buffer or image, without memory.
+fn create_transient_resource(RenderGraph const& graph,
+                             GraphResource& resource,
+                             VkMemoryRequirements& requirements)->bool {
+  VkDevice const device = graph.device->get();
+  if (resource.kind == GraphResourceKind::buffer) {
+    VkBufferCreateInfo const buffer_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = resource.size,
+        .usage = resource.usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    if (vkCreateBuffer(device, &buffer_info, nullptr, &resource.buffer) !=
+        VK_SUCCESS) {
+      return false;
+    }
+    vkGetBufferMemoryRequirements(device, resource.buffer, &requirements);
+    return true;
+  }
+  VkImageCreateInfo const image_info{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = resource.format,
+      .extent = {graph.size.x, graph.size.y, 1},
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = resource.image_usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  if (vkCreateImage(device, &image_info, nullptr, &resource.image) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  vkGetImageMemoryRequirements(device, resource.image, &requirements);
+  return true;
+}
+
+// Bind the resource to its memory, and give images a view.
+fn bind_transient_resource(RenderGraph const& graph, GraphResource& resource)
+    ->bool {
+  VkDevice const device = graph.device->get();
+  VkDeviceMemory const memory = graph.heaps[resource.memory_heap].memory;
+  if (resource.kind == GraphResourceKind::buffer) {
+    return vkBindBufferMemory(device, resource.buffer, memory,
+                              resource.memory_offset) == VK_SUCCESS;
+  }
+  if (vkBindImageMemory(device, resource.image, memory,
+                        resource.memory_offset) != VK_SUCCESS) {
+    return false;
+  }
+  VkImageViewCreateInfo const view_info{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = resource.image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = resource.format,
+      .subresourceRange = {image_aspect(resource.format), 0, 1, 0, 1},
+  };
+  return vkCreateImageView(device, &view_info, nullptr, &resource.view) ==
+         VK_SUCCESS;
+}
+
+typedef struct {
+  uint32_t heap;
+  VkDeviceSize offset;
+  VkDeviceSize size;
+  // Position in the order of the last pass using the block.
+  size_t last_use;
+  uint32_t slot;
+} MemoryBlock;
+
+// Create the transient resources, and bind resources with disjoint
+// lifetimes to the same memory.
+fn create_transient_resources(RenderGraph& graph)->bool {
+  std::vector<uint32_t> transients;
+  uint32_t persistent_count = 0;
+  for (uint32_t i = 0; i < graph.resources.size(); i++) {
+    if (graph.resources[i].transient) {
+      transients.push_back(i);
+    } else {
+      persistent_count++;
+    }
+  }
+  // The slots after the persistent resources' belong to transient memory.
+  // Their state is gone with the old memory.
+  graph.slots.assign(persistent_count, {});
+  if (transients.empty()) {
+    return true;
+  }
+
+  // Lifetimes as positions in the execution order. Outputs live past the
+  // last pass.
+  std::vector<size_t> first_use(graph.resources.size(), SIZE_MAX);
+  std::vector<size_t> last_use(graph.resources.size(), 0);
+  for (size_t position = 0; position < graph.order.size(); position++) {
+    GraphPass const& pass = graph.passes[graph.order[position]];
+    for (uint32_t resource : transients) {
+      if (touches(pass, resource)) {
+        first_use[resource] = std::min(first_use[resource], position);
+        last_use[resource] = position;
+      }
+    }
+  }
+  for (auto const& output : graph.outputs) {
+    last_use[output.resource] = graph.order.size();
+  }
+  std::stable_sort(transients.begin(), transients.end(),
+                   [&](uint32_t a, uint32_t b) {
+                     return first_use[a] < first_use[b];
+                   });
+
+  VkPhysicalDevice const physical_device =
+      graph.device->get_vk_physical_device();
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  // Buffers and images closer than this in the same memory alias.
+  VkDeviceSize const granularity = properties.limits.bufferImageGranularity;
+
+  std::vector<MemoryBlock> blocks;
+  VkDeviceSize unaliased_size = 0;
+  for (uint32_t index : transients) {
+    GraphResource& resource = graph.resources[index];
+    VkMemoryRequirements requirements;
+    if (!create_transient_resource(graph, resource, requirements)) {
+      return false;
+    }
+    std::optional<uint32_t> const memory_type =
+        find_memory_type(physical_device, requirements.memoryTypeBits);
+    if (!memory_type) {
+      return false;
+    }
+    VkDeviceSize const alignment =
+        std::max(requirements.alignment, granularity);
+    VkDeviceSize const size = align_up(requirements.size, granularity);
+    unaliased_size = align_up(unaliased_size, alignment) + size;
+
+    // Reuse the first block of the memory type that is free by now, else
+    // grow the type's heap.
+    auto block = std::find_if(
+        blocks.begin(), blocks.end(), [&](MemoryBlock const& candidate) {
+          return graph.heaps[candidate.heap].memory_type == *memory_type &&
+                 candidate.last_use < first_use[index] &&
+                 candidate.size >= size && candidate.offset % alignment == 0;
+        });
+    if (block == blocks.end()) {
+      auto heap = std::find_if(graph.heaps.begin(), graph.heaps.end(),
+                               [&](GraphHeap const& candidate) {
+                                 return candidate.memory_type == *memory_type;
+                               });
+      if (heap == graph.heaps.end()) {
+        graph.heaps.push_back({*memory_type, 0, VK_NULL_HANDLE});
+        heap = graph.heaps.end() - 1;
+      }
+      VkDeviceSize const offset = align_up(heap->size, alignment);
+      heap->size = offset + size;
+      blocks.push_back({static_cast<uint32_t>(heap - graph.heaps.begin()),
+                        offset, size, 0,
+                        static_cast<uint32_t>(graph.slots.size())});
+      graph.slots.push_back({});
+      block = blocks.end() - 1;
+    }
+    block->last_use = last_use[index];
+    resource.memory_heap = block->heap;
+    resource.memory_offset = block->offset;
+    resource.memory_slot = block->slot;
+  }
+
+  VkDeviceSize allocated_size = 0;
+  for (GraphHeap& heap : graph.heaps) {
+    VkMemoryAllocateInfo const alloc_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = heap.size,
+        .memoryTypeIndex = heap.memory_type,
+    };
+    if (vkAllocateMemory(graph.device->get(), &alloc_info, nullptr,
+                         &heap.memory) != VK_SUCCESS) {
+      return false;
+    }
+    allocated_size += heap.size;
+  }
+  for (uint32_t index : transients) {
+    if (!bind_transient_resource(graph, graph.resources[index])) {
+      return false;
+    }
+  }
+  VkDeviceSize const saved_size =
+      unaliased_size > allocated_size ? unaliased_size - allocated_size : 0;
+  std::cout << "Render graph: " << transients.size()
+            << " transient resources in " << blocks.size() << " blocks, "
+            << allocated_size / 1024 << " KiB, " << saved_size / 1024
+            << " KiB saved by aliasing\n";
+  return true;
+}
+
+fn destroy_transient_resources(RenderGraph& graph)->void {
+  VkDevice const device = graph.device->get();
+  for (auto& resource : graph.resources) {
+    if (!resource.transient) {
+      continue;
+    }
+    vkDestroyImageView(device, resource.view, nullptr);
+    vkDestroyImage(device, resource.image, nullptr);
+    vkDestroyBuffer(device, resource.buffer, nullptr);
+    resource.view = VK_NULL_HANDLE;
+    resource.image = VK_NULL_HANDLE;
+    resource.buffer = VK_NULL_HANDLE;
+  }
+  for (auto const& heap : graph.heaps) {
+    vkFreeMemory(device, heap.memory, nullptr);
+  }
+  graph.heaps.clear();
+}
+
+// Whether each pass runs this frame. Walks the order backwards, keeping
+// passes that write an output or what a kept pass reads.
+fn find_live_passes(RenderGraph const& graph)->std::vector<bool> {
+  std::vector<bool> live(graph.passes.size(), false);
+  std::vector<bool> wanted(graph.resources.size(), false);
+  for (auto const& output : graph.outputs) {
+    wanted[output.resource] = true;
+  }
+  for (auto position = graph.order.rbegin(); position != graph.order.rend();
+       position++) {
+    GraphPass const& pass = graph.passes[*position];
+    if (!pass.enabled) {
+      continue;
+    }
+    bool const needed =
+        pass.has_side_effects ||
+        std::any_of(pass.writes.begin(), pass.writes.end(),
+                    [&](GraphAccess const& access) {
+                      return wanted[access.resource];
+                    });
+    if (!needed) {
+      continue;
+    }
+    live[*position] = true;
+    for (auto const& access : pass.reads) {
+      wanted[access.resource] = true;
+    }
+  }
+  return live;
+}
+
+// Record one barrier covering every hazard of the accesses, and update the
+// state of the slots they touch.
+fn insert_barrier(RenderGraph& graph, std::vector<GraphAccess> const& reads,
+                  std::vector<GraphAccess> const& writes,
+                  VkCommandBuffer cmd_buf)->void {
+  VkPipelineStageFlags src_stages = 0;
+  VkPipelineStageFlags dst_stages = 0;
+  VkMemoryBarrier barrier{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+  for (auto const& access : reads) {
+    GraphSlotState const& slot =
+        graph.slots[graph.resources[access.resource].memory_slot];
+    // Read after write.
+    if (slot.write_stages && (access.stages & ~slot.visible_stages)) {
+      src_stages |= slot.write_stages;
+      barrier.srcAccessMask |= slot.write_access;
+      dst_stages |= access.stages;
+      barrier.dstAccessMask |= access.access;
+    }
+  }
+  for (auto const& access : writes) {
+    GraphSlotState const& slot =
+        graph.slots[graph.resources[access.resource].memory_slot];
+    // Write after read only needs the reads to have executed.
+    if (slot.read_stages) {
+      src_stages |= slot.read_stages;
+      dst_stages |= access.stages;
+    }
+    // Write after write.
+    if (slot.write_stages) {
+      src_stages |= slot.write_stages;
+      barrier.srcAccessMask |= slot.write_access;
+      dst_stages |= access.stages;
+      barrier.dstAccessMask |= access.access;
+    }
+  }
+
+  for (auto const& access : reads) {
+    GraphSlotState& slot =
+        graph.slots[graph.resources[access.resource].memory_slot];
+    if (slot.write_stages) {
+      slot.visible_stages |= access.stages;
+    }
+    slot.read_stages |= access.stages;
+  }
+  for (auto const& access : writes) {
+    graph.slots[graph.resources[access.resource].memory_slot] = {
+        .write_stages = access.stages,
+        .write_access = access.access,
+    };
+  }
+
+  if (src_stages) {
+    vkCmdPipelineBarrier(cmd_buf, src_stages, dst_stages, 0, 1, &barrier, 0,
+                         nullptr, 0, nullptr);
+    graph.stats.barriers++;
+  }
+}
+
+}  // namespace
+
+fn add_graph_buffer(RenderGraph& graph, char const* name, VkBuffer buffer)
+    ->uint32_t {
+  graph.resources.push_back({
+      .name = name,
+      .kind = GraphResourceKind::buffer,
+      .buffer = buffer,
+      .memory_slot = static_cast<uint32_t>(graph.slots.size()),
+  });
+  graph.slots.push_back({});
+  return graph.resources.size() - 1;
+}
+
+fn add_transient_graph_buffer(RenderGraph& graph, char const* name,
+                              VkDeviceSize size, VkBufferUsageFlags usage)
+    ->uint32_t {
+  graph.resources.push_back({
+      .name = name,
+      .kind = GraphResourceKind::buffer,
+      .transient = true,
+      .size = size,
+      .usage = usage,
+  });
+  return graph.resources.size() - 1;
+}
+
+fn add_transient_graph_image(RenderGraph& graph, char const* name,
+                             VkFormat format, VkImageUsageFlags usage)
+    ->uint32_t {
+  graph.resources.push_back({
+      .name = name,
+      .kind = GraphResourceKind::image,
+      .transient = true,
+      .format = format,
+      .image_usage = usage,
+  });
+  return graph.resources.size() - 1;
+}
+
+fn add_graph_pass(RenderGraph& graph, GraphPass pass)->uint32_t {
+  graph.passes.push_back(std::move(pass));
+  return graph.passes.size() - 1;
+}
+
+fn add_graph_output(RenderGraph& graph, GraphAccess access)->void {
+  graph.outputs.push_back(access);
+}
+
+fn compile_render_graph(RenderGraph& graph, lava::device_ptr device,
+                        lava::uv2 size)->bool {
+  TRACE_SCOPE("compile_render_graph");
+  graph.device = device;
+  graph.size = size;
+  std::vector<std::vector<uint32_t>> const dependencies =
+      find_dependencies(graph);
+  std::vector<bool> done(graph.passes.size(), false);
+  auto ready = [&](uint32_t pass) {
+    return !done[pass] &&
+           std::all_of(dependencies[pass].begin(), dependencies[pass].end(),
+                       [&](uint32_t dependency) { return done[dependency]; });
+  };
+  // Each time, the earliest declared pass that is ready.
+  graph.order.clear();
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (uint32_t pass = 0; pass < graph.passes.size(); pass++) {
+      if (ready(pass)) {
+        graph.order.push_back(pass);
+        done[pass] = true;
+        progress = true;
+        break;
+      }
+    }
+  }
+  if (!create_transient_resources(graph)) {
+    std::cout << "Failed to create the render graph's transient resources."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+fn resize_render_graph(RenderGraph& graph, lava::uv2 size)->bool {
+  destroy_transient_resources(graph);
+  graph.size = size;
+  if (!create_transient_resources(graph)) {
+    std::cout << "Failed to create the render graph's transient resources."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+fn destroy_render_graph(RenderGraph& graph)->void {
+  if (!graph.device) {
+    return;
+  }
+  destroy_transient_resources(graph);
+}
+
+fn graph_buffer(RenderGraph const& graph, uint32_t resource)->VkBuffer {
+  return graph.resources[resource].buffer;
+}
+
+fn graph_image_view(RenderGraph const& graph, uint32_t resource)
+    ->VkImageView {
+  return graph.resources[resource].view;
+}
+
+fn set_graph_pass_enabled(RenderGraph& graph, uint32_t pass, bool enabled)
+    ->void {
+  graph.passes[pass].enabled = enabled;
+}
+
+fn execute_render_graph(RenderGraph& graph, VkCommandBuffer cmd_buf)->void {
+  TRACE_SCOPE("execute_render_graph");
+  std::vector<bool> const live = find_live_passes(graph);
+  graph.stats = {};
+  for (uint32_t pass : graph.order) {
+    if (!live[pass]) {
+      graph.stats.passes_culled++;
+      continue;
+    }
+    GraphPass const& graph_pass = graph.passes[pass];
+    insert_barrier(graph, graph_pass.reads, graph_pass.writes, cmd_buf);
+    graph_pass.record(cmd_buf);
+    graph.stats.passes_run++;
+  }
+  insert_barrier(graph, graph.outputs, {}, cmd_buf);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+
+// How a pass uses a resource.
+typedef struct {
+  uint32_t resource;
+  VkPipelineStageFlags stages;
+  VkAccessFlags access;
+} GraphAccess;
+
+typedef struct {
+  char const* name;
+  std::vector<GraphAccess> reads;
+  std::vector<GraphAccess> writes;
+  std::function<void(VkCommandBuffer)> record;
+  // Kept even when no pass reads what it writes.
+  bool has_side_effects;
+  bool enabled;
+} GraphPass;
+
+enum class GraphResourceKind { buffer, image };
+
+typedef struct {
+  char const* name;
+  GraphResourceKind kind;
+  VkBuffer buffer;
+  VkImage image;
+  VkImageView view;
+  // Transient resources are created by the graph, and may share memory with
+  // transient resources whose lifetimes don't overlap.
+  bool transient;
+  VkDeviceSize size;
+  VkBufferUsageFlags usage;
+  // Images are sized like the graph.
+  VkFormat format;
+  VkImageUsageFlags image_usage;
+  uint32_t memory_heap;
+  VkDeviceSize memory_offset;
+  // Resources sharing memory share their hazard tracking.
+  uint32_t memory_slot;
+} GraphResource;
+
+// Memory of one type, shared by the transient resources that can use it.
+typedef struct {
+  uint32_t memory_type;
+  VkDeviceSize size;
+  VkDeviceMemory memory;
+} GraphHeap;
+
+// Accesses since the last write to a memory slot. Carried across frames, so
+// the first pass of a frame waits for the last one of the previous frame.
+typedef struct {
+  VkPipelineStageFlags write_stages;
+  VkAccessFlags write_access;
+  // Stages that already waited for the last write.
+  VkPipelineStageFlags visible_stages;
+  VkPipelineStageFlags read_stages;
+} GraphSlotState;
+
+typedef struct {
+  size_t passes_run;
+  size_t passes_culled;
+  size_t barriers;
+} GraphFrameStats;
+
+// Passes declare the resources they read and write. Each frame, the graph
+// culls passes whose results go unread, runs the rest in dependency order,
+// and inserts one merged barrier before each pass that has a hazard.
+typedef struct {
+  lava::device_ptr device;
+  lava::uv2 size;
+  std::vector<GraphResource> resources;
+  std::vector<GraphPass> passes;
+  // Reads after the last pass, such as the render pass that follows
+  // sampling an image the graph drew.
+  std::vector<GraphAccess> outputs;
+  // Pass indices in execution order, set by compile_render_graph().
+  std::vector<uint32_t> order;
+  std::vector<GraphSlotState> slots;
+  std::vector<GraphHeap> heaps;
+  GraphFrameStats stats;
+} RenderGraph;
+
+fn add_graph_buffer(RenderGraph& graph, char const* name, VkBuffer buffer)
+    ->uint32_t;
+
+fn add_transient_graph_buffer(RenderGraph& graph, char const* name,
+                              VkDeviceSize size, VkBufferUsageFlags usage)
+    ->uint32_t;
+
+// A single-sample 2D image the size of the graph.
+fn add_transient_graph_image(RenderGraph& graph, char const* name,
+                             VkFormat format, VkImageUsageFlags usage)
+    ->uint32_t;
+
+// Passes run in the order they are declared in, where their accesses
+// allow nothing else.
+fn add_graph_pass(RenderGraph& graph, GraphPass pass)->uint32_t;
+
+// Keeps the resource alive to the end of the graph, with the passes writing
+// it, and inserts the barrier for the access after the last pass.
+fn add_graph_output(RenderGraph& graph, GraphAccess access)->void;
+
+// Order the passes and create the transient resources.
+fn compile_render_graph(RenderGraph& graph, lava::device_ptr device,
+                        lava::uv2 size)->bool;
+
+// Recreate the transient resources at a new size, once the device is idle.
+// Their handles change, so descriptors of them must be written again.
+fn resize_render_graph(RenderGraph& graph, lava::uv2 size)->bool;
+
+fn destroy_render_graph(RenderGraph& graph)->void;
+
+fn graph_buffer(RenderGraph const& graph, uint32_t resource)->VkBuffer;
+
+fn graph_image_view(RenderGraph const& graph, uint32_t resource)
+    ->VkImageView;
+
+fn set_graph_pass_enabled(RenderGraph& graph, uint32_t pass, bool enabled)
+    ->void;
+
+// Record the frame's live passes with their barriers.
+fn execute_render_graph(RenderGraph& graph, VkCommandBuffer cmd_buf)->void;
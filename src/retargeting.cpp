@@ -0,0 +1,234 @@
+#include "retargeting.h"
+
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+
+#include "joint_curves.h"
+#include "root_motion.h"
+#include "trace.h"
+
+namespace {
+
+// The joint's global transform in the bind pose. Joints the pose leaves out
+// fall back to their transform at the default time.
+fn bind_transform(Joint const& joint, FbxPose* bind_pose)->Transform {
+  FbxAMatrix bind = joint.transform;
+  int const index = bind_pose ? bind_pose->Find(joint.node) : -1;
+  if (index >= 0 && !bind_pose->IsLocalMatrix(index)) {
+    // Pose matrices aren't affine in type, so take them apart.
+    FbxVector4 translation, shearing, scaling;
+    FbxQuaternion rotation;
+    double sign;
+    bind_pose->GetMatrix(index).GetElements(translation, rotation, shearing,
+                                            scaling, sign);
+    bind.SetTQS(translation, rotation, scaling);
+  }
+  lava::mat4 const global = fbxmat_to_lavamat(bind);
+  return Transform{lava::v3(global[3]),
+                   glm::normalize(glm::quat_cast(global))};
+}
+
+// Ratio of two bind offsets' lengths, or 1 where either is too short to
+// measure.
+fn length_ratio(lava::v3 target, lava::v3 source)->float {
+  float const target_length = glm::length(target);
+  float const source_length = glm::length(source);
+  if (target_length < 1e-5f || source_length < 1e-5f) {
+    return 1;
+  }
+  return target_length / source_length;
+}
+
+}  // namespace
+
+fn joint_name_hash(char const* name)->uint64_t {
+  if (char const* colon = std::strrchr(name, ':')) {
+    name = colon + 1;
+  }
+  // FNV-1a.
+  uint64_t hash = 14695981039346656037ull;
+  for (; *name; name++) {
+    hash ^= static_cast<unsigned char>(
+        std::tolower(static_cast<unsigned char>(*name)));
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+fn build_retarget_map(std::vector<Joint> const& source,
+                      FbxPose* source_bind_pose,
+                      std::vector<Joint> const& target,
+                      FbxPose* target_bind_pose)->RetargetMap {
+  TRACE_SCOPE("build_retarget_map");
+  std::unordered_map<uint64_t, int> source_by_name;
+  for (size_t i = 0; i < source.size(); i++) {
+    // The first of any joints sharing a name wins.
+    source_by_name.emplace(joint_name_hash(source[i].node->GetName()), i);
+  }
+
+  RetargetMap map{};
+  size_t const count = target.size();
+  map.source_joint.assign(count, -1);
+  map.parent.resize(count);
+  map.target_bind.resize(count);
+  map.source_bind.resize(count);
+  map.translation_scale.assign(count, 1);
+  for (size_t joint = 0; joint < count; joint++) {
+    map.parent[joint] = target[joint].parent_index;
+    map.target_bind[joint] = bind_transform(target[joint], target_bind_pose);
+    auto const match =
+        source_by_name.find(joint_name_hash(target[joint].node->GetName()));
+    if (match == source_by_name.end()) {
+      continue;
+    }
+    map.source_joint[joint] = match->second;
+    map.source_bind[joint] =
+        bind_transform(source[match->second], source_bind_pose);
+    map.matched++;
+  }
+
+  // Parents come before children, so a parent's mapping is known here.
+  for (size_t joint = 0; joint < count; joint++) {
+    if (map.source_joint[joint] < 0) {
+      continue;
+    }
+    int const parent = map.parent[joint];
+    if (parent >= 0 && map.source_joint[parent] >= 0) {
+      map.translation_scale[joint] = length_ratio(
+          map.target_bind[joint].translation -
+              map.target_bind[parent].translation,
+          map.source_bind[joint].translation -
+              map.source_bind[parent].translation);
+    } else {
+      // A mapped root moves relative to the origin, so its offset from the
+      // origin stands in for a bone, such as hip height for the hips.
+      map.translation_scale[joint] =
+          length_ratio(map.target_bind[joint].translation,
+                       map.source_bind[joint].translation);
+    }
+  }
+  return map;
+}
+
+fn retarget_pose(RetargetMap const& map,
+                 std::vector<Transform> const& source_pose,
+                 std::vector<Transform>& target_pose)->void {
+  size_t const count = map.source_joint.size();
+  target_pose.resize(count);
+  for (size_t joint = 0; joint < count; joint++) {
+    Transform const& bind = map.target_bind[joint];
+    int const parent = map.parent[joint];
+    // How far the parent turned from its bind pose.
+    glm::quat parent_delta(1, 0, 0, 0);
+    lava::v3 bind_offset = bind.translation;
+    if (parent >= 0) {
+      parent_delta = target_pose[parent].orientation *
+                     glm::conjugate(map.target_bind[parent].orientation);
+      bind_offset -= map.target_bind[parent].translation;
+    }
+    lava::v3 const parent_translation =
+        parent >= 0 ? target_pose[parent].translation : lava::v3(0);
+
+    int const source_joint = map.source_joint[joint];
+    if (source_joint < 0 ||
+        static_cast<size_t>(source_joint) >= source_pose.size()) {
+      target_pose[joint] = {parent_translation + parent_delta * bind_offset,
+                            glm::normalize(parent_delta * bind.orientation)};
+      continue;
+    }
+
+    Transform const& source = source_pose[source_joint];
+    Transform const& source_bind = map.source_bind[joint];
+    target_pose[joint].orientation =
+        glm::normalize(source.orientation *
+                       glm::conjugate(source_bind.orientation) *
+                       bind.orientation);
+
+    int const source_parent = parent >= 0 ? map.source_joint[parent] : -1;
+    if (source_parent < 0 ||
+        static_cast<size_t>(source_parent) >= source_pose.size()) {
+      target_pose[joint].translation =
+          parent_translation + parent_delta * bind_offset +
+          (source.translation - source_bind.translation) *
+              map.translation_scale[joint];
+      continue;
+    }
+    // The source joint's offset from its parent, in the parent's bind
+    // orientation, compared with its bind offset.
+    Transform const& source_parent_pose = source_pose[source_parent];
+    Transform const& source_parent_bind = map.source_bind[parent];
+    glm::quat const source_parent_delta =
+        source_parent_pose.orientation *
+        glm::conjugate(source_parent_bind.orientation);
+    lava::v3 const source_offset =
+        glm::conjugate(source_parent_delta) *
+        (source.translation - source_parent_pose.translation);
+    lava::v3 const source_bind_offset =
+        source_bind.translation - source_parent_bind.translation;
+    lava::v3 const offset =
+        bind_offset +
+        (source_offset - source_bind_offset) * map.translation_scale[joint];
+    target_pose[joint].translation =
+        parent_translation + parent_delta * offset;
+  }
+}
+
+fn load_retargeted_clip(FbxManager* manager, std::string const& path,
+                        std::vector<Joint> const& target,
+                        FbxPose* target_bind_pose,
+                        size_t thread_count)->std::optional<RetargetedClip> {
+  TRACE_SCOPE("load_retargeted_clip");
+  FbxImporter* importer = FbxImporter::Create(manager, "");
+  FbxScene* scene = FbxScene::Create(manager, "");
+  bool const imported =
+      importer->Initialize(path.c_str(), -1, manager->GetIOSettings()) &&
+      importer->Import(scene);
+  importer->Destroy();
+  FbxPose* bind_pose = imported ? find_fbx_bind_pose(scene) : nullptr;
+  FbxSkeleton* root_skeleton =
+      bind_pose ? find_fbx_root_skeleton(bind_pose) : nullptr;
+  if (!root_skeleton) {
+    std::cout << "Failed to load a skeleton from " << path << std::endl;
+    scene->Destroy();
+    return std::nullopt;
+  }
+  std::vector<Joint> const source = read_joints(root_skeleton);
+
+  std::optional<AnimationClip> clip;
+  if (std::optional<SkeletonCurves> curves =
+          read_skeleton_curves(scene, source)) {
+    clip = sample_animation_clip_curves(scene, *curves);
+    if (!curve_validation_passed(validate_animation_clip(*clip, source, 8),
+                                 *clip)) {
+      clip.reset();
+    }
+  }
+  if (!clip) {
+    clip = sample_animation_clip_parallel(scene, source, path, thread_count);
+  }
+  size_t const root_joint = find_root_motion_joint(source);
+  extract_root_motion(*clip, root_joint);
+
+  RetargetedClip retargeted{
+      .name = std::filesystem::path(path).stem().string(),
+      .clip = std::move(*clip),
+      .map = build_retarget_map(source, bind_pose, target, target_bind_pose),
+  };
+  // Strides scale with the rig, like the root's translation does.
+  auto const root = std::find(retargeted.map.source_joint.begin(),
+                              retargeted.map.source_joint.end(),
+                              static_cast<int>(root_joint));
+  if (root != retargeted.map.source_joint.end()) {
+    float const scale = retargeted.map.translation_scale
+        [root - retargeted.map.source_joint.begin()];
+    for (RootMotion& motion : retargeted.clip.root_motion) {
+      motion.translation *= scale;
+    }
+  }
+  std::cout << "Retargeted " << retargeted.name << ": "
+            << retargeted.map.matched << " of " << target.size()
+            << " joints matched\n";
+  scene->Destroy();
+  return retargeted;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <fbxsdk.h>
+
+#include "fbx_loading.h"
+#include "includes.h"
+
+// Maps the joints of a source skeleton onto a target skeleton by name, so
+// clips sampled on one rig play on the other. Everything per joint is
+// indexed by target joint.
+typedef struct {
+  // The source joint driving each target joint, or -1 where no source joint
+  // shares its name. Unmatched joints keep their bind pose relative to their
+  // parent.
+  std::vector<int> source_joint;
+  std::vector<int> parent;
+  // Global bind transforms of the target joints, and of the source joints
+  // driving them, from each skeleton's bind pose.
+  std::vector<Transform> target_bind;
+  std::vector<Transform> source_bind;
+  // Source translations away from the bind pose are scaled by the ratio of
+  // the two rigs' bone lengths, so longer legs take longer strides.
+  std::vector<float> translation_scale;
+  size_t matched;
+} RetargetMap;
+
+// A clip from another file, and the map playing it on a target skeleton.
+typedef struct {
+  std::string name;
+  AnimationClip clip;
+  RetargetMap map;
+} RetargetedClip;
+
+// Hash of a joint's name, ignoring case and any namespace before a colon,
+// so "mixamorig:Hips" and "Hips" match.
+fn joint_name_hash(char const* name)->uint64_t;
+
+// Bind transforms come from the bind poses the skins were bound in, not the
+// joints' transforms at the default time, which animated files may leave
+// mid-clip. Joints missing from a pose, or a null pose, fall back to those.
+fn build_retarget_map(std::vector<Joint> const& source,
+                      FbxPose* source_bind_pose,
+                      std::vector<Joint> const& target,
+                      FbxPose* target_bind_pose)->RetargetMap;
+
+// Pose the target skeleton like a pose sampled on the source skeleton.
+// Rotations carry over as deltas from each rig's bind pose, and offsets
+// from the parent as scaled deltas from the bind offsets. The target pose is
+// resized to the target joint count, so reusing it doesn't allocate.
+fn retarget_pose(RetargetMap const& map,
+                 std::vector<Transform> const& source_pose,
+                 std::vector<Transform>& target_pose)->void;
+
+// Import the clip of another FBX file with its own skeleton, bake it with
+// its root motion extracted, and map it onto the target skeleton, whose
+// bind pose is given.
+fn load_retargeted_clip(FbxManager* manager, std::string const& path,
+                        std::vector<Joint> const& target,
+                        FbxPose* target_bind_pose,
+                        size_t thread_count)->std::optional<RetargetedClip>;
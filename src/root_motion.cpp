@@ -0,0 +1,113 @@
+#include "root_motion.h"
+
+#include <numbers>
+
+#include "trace.h"
+
+namespace {
+
+fn yaw_rotation(float yaw)->glm::quat {
+  return glm::angleAxis(yaw, lava::v3(0, 1, 0));
+}
+
+// Where the root stands: its position without height, turned as far as its
+// forward axis is about the up axis.
+fn ground_placement(Transform const& root)->lava::mat4 {
+  lava::v3 const forward = root.orientation * lava::v3(0, 0, 1);
+  lava::mat4 placement =
+      glm::mat4_cast(yaw_rotation(std::atan2(forward.x, forward.z)));
+  placement[3] = lava::v4(root.translation.x, 0, root.translation.z, 1);
+  return placement;
+}
+
+// Root motion from one time to a later one, within a single loop. Motion
+// into part of a frame is scaled down to that part.
+fn accumulate_root_motion(AnimationClip const& clip, double from, double to)
+    ->RootMotion {
+  RootMotion motion{};
+  double time = std::max(from, 0.0);
+  while (time < to) {
+    size_t const frame = static_cast<size_t>(time);
+    double const end = std::min(to, frame + 1.0);
+    if (frame + 1 < clip.root_motion.size()) {
+      RootMotion const& delta = clip.root_motion[frame + 1];
+      float const fraction = static_cast<float>(end - time);
+      motion = combine_root_motion(
+          motion, {delta.translation * fraction, delta.yaw * fraction});
+    }
+    time = end;
+  }
+  return motion;
+}
+
+}  // namespace
+
+fn find_root_motion_joint(std::vector<Joint> const& joints)->size_t {
+  for (size_t i = 0; i < joints.size(); i++) {
+    std::string name = joints[i].node->GetName();
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (name.find("hips") != std::string::npos) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+fn extract_root_motion(AnimationClip& clip, size_t root_joint)->void {
+  TRACE_SCOPE("extract_root_motion");
+  clip.root_motion.assign(clip.frames.size(), RootMotion{});
+  if (clip.frames.empty() ||
+      root_joint >= clip.frames[0].transforms.size()) {
+    return;
+  }
+  lava::mat4 const first_inverse =
+      glm::inverse(ground_placement(clip.frames[0].transforms[root_joint]));
+  lava::mat4 previous_motion(1);
+  for (size_t i = 0; i < clip.frames.size(); i++) {
+    std::vector<Transform>& transforms = clip.frames[i].transforms;
+    // Model-space motion of the root since the first frame.
+    lava::mat4 const motion =
+        ground_placement(transforms[root_joint]) * first_inverse;
+    if (i > 0) {
+      lava::mat4 const delta = glm::inverse(previous_motion) * motion;
+      clip.root_motion[i] = {lava::v3(delta[3]),
+                             std::atan2(delta[2][0], delta[2][2])};
+    }
+    previous_motion = motion;
+
+    lava::mat4 const in_place = glm::inverse(motion);
+    glm::quat const turn = glm::quat_cast(in_place);
+    for (auto& transform : transforms) {
+      transform.translation =
+          lava::v3(in_place * lava::v4(transform.translation, 1));
+      transform.orientation = glm::normalize(turn * transform.orientation);
+    }
+  }
+}
+
+fn combine_root_motion(RootMotion const& motion, RootMotion const& delta)
+    ->RootMotion {
+  return {
+      .translation =
+          motion.translation + yaw_rotation(motion.yaw) * delta.translation,
+      .yaw = std::remainder(motion.yaw + delta.yaw,
+                            2 * std::numbers::pi_v<float>),
+  };
+}
+
+fn root_motion_between(AnimationClip const& clip, double from, double to)
+    ->RootMotion {
+  if (to >= from) {
+    return accumulate_root_motion(clip, from, to);
+  }
+  return combine_root_motion(
+      accumulate_root_motion(clip, from, clip.root_motion.size()),
+      accumulate_root_motion(clip, 0, to));
+}
+
+fn root_motion_matrix(RootMotion const& motion)->lava::mat4 {
+  lava::mat4 matrix = glm::mat4_cast(yaw_rotation(motion.yaw));
+  matrix[3] = lava::v4(motion.translation, 1);
+  return matrix;
+}
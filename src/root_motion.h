@@ -0,0 +1,26 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "fbx_loading.h"
+#include "includes.h"
+
+// The joint whose motion moves the character: the hips, or the root joint
+// if no joint is named so.
+fn find_root_motion_joint(std::vector<Joint> const& joints)->size_t;
+
+// Move the root joint's ground-plane translation and yaw out of every frame
+// and into clip.root_motion, so the clip plays in place where its first
+// frame stands. Transforms are global, so every joint moves with the root.
+fn extract_root_motion(AnimationClip& clip, size_t root_joint)->void;
+
+// Motion followed by delta, which is in the heading motion ends at.
+fn combine_root_motion(RootMotion const& motion, RootMotion const& delta)
+    ->RootMotion;
+
+// Root motion from one clip time in frames to another. A to time before the
+// from time wraps around the end of the clip.
+fn root_motion_between(AnimationClip const& clip, double from, double to)
+    ->RootMotion;
+
+fn root_motion_matrix(RootMotion const& motion)->lava::mat4;
@@ -0,0 +1,80 @@
+#include "shader_permutations.h"
+
+fn make_shader_constants(ShaderPermutation const& permutation)
+    ->ShaderConstants {
+  return {
+      .skinned = permutation.skinned,
+      .max_influences = permutation.max_influences,
+      .dual_quaternion =
+          permutation.skinning == SkinningMethod::dual_quaternion,
+      .flip_y = VK_TRUE,
+      .normal_map = permutation.normal_map,
+      .light_intensity = 0.12f,
+      // Higher makes a smaller highlight.
+      .shininess = 1.32f,
+  };
+}
+
+fn shader_constant_entries()
+    ->std::vector<VkSpecializationMapEntry> const& {
+  static std::vector<VkSpecializationMapEntry> const entries = {
+      {0, offsetof(ShaderConstants, skinned), sizeof(VkBool32)},
+      {1, offsetof(ShaderConstants, max_influences), sizeof(uint32_t)},
+      {2, offsetof(ShaderConstants, dual_quaternion), sizeof(VkBool32)},
+      {3, offsetof(ShaderConstants, flip_y), sizeof(VkBool32)},
+      {4, offsetof(ShaderConstants, normal_map), sizeof(VkBool32)},
+      {5, offsetof(ShaderConstants, light_intensity), sizeof(float)},
+      {6, offsetof(ShaderConstants, shininess), sizeof(float)},
+  };
+  return entries;
+}
+
+fn permutation_key(ShaderPermutation const& permutation)->uint32_t {
+  // Static permutations ignore the skinning options.
+  if (!permutation.skinned) {
+    return permutation.normal_map;
+  }
+  return 1 << 1 | permutation.normal_map |
+         (permutation.skinning == SkinningMethod::dual_quaternion) << 2 |
+         permutation.max_influences << 3;
+}
+
+fn permutation_name(ShaderPermutation const& permutation)->std::string {
+  std::string name = "static";
+  if (permutation.skinned) {
+    name = permutation.skinning == SkinningMethod::dual_quaternion ? "dq"
+                                                                   : "lbs";
+    name += std::to_string(permutation.max_influences);
+  }
+  if (permutation.normal_map) {
+    name += "+normal";
+  }
+  return name;
+}
+
+fn all_shader_permutations()->std::vector<ShaderPermutation> {
+  std::vector<ShaderPermutation> permutations;
+  for (bool normal_map : {false, true}) {
+    permutations.push_back(
+        {false, 0, SkinningMethod::linear, normal_map});
+    for (uint32_t influences : {1u, 2u, 4u}) {
+      for (SkinningMethod skinning :
+           {SkinningMethod::linear, SkinningMethod::dual_quaternion}) {
+        permutations.push_back({true, influences, skinning, normal_map});
+      }
+    }
+  }
+  return permutations;
+}
+
+fn select_shader_permutation(uint32_t max_influences, SkinningMethod skinning,
+                             bool normal_map)->ShaderPermutation {
+  if (max_influences == 0) {
+    return {false, 0, SkinningMethod::linear, normal_map};
+  }
+  uint32_t influences = 1;
+  while (influences < std::min(max_influences, 4u)) {
+    influences *= 2;
+  }
+  return {true, influences, skinning, normal_map};
+}
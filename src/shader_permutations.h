@@ -0,0 +1,47 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+
+enum class SkinningMethod { linear, dual_quaternion };
+
+// Compile-time options of the mesh shaders. Each one is a separate pipeline,
+// so the shaders drop the work a mesh doesn't need.
+typedef struct {
+  bool skinned;
+  // Joint influences blended per vertex: 1, 2 or 4.
+  uint32_t max_influences;
+  SkinningMethod skinning;
+  bool normal_map;
+} ShaderPermutation;
+
+// Specialization data, in constant_id order of vert.glsl and frag.glsl.
+typedef struct {
+  VkBool32 skinned;
+  uint32_t max_influences;
+  VkBool32 dual_quaternion;
+  VkBool32 flip_y;
+  VkBool32 normal_map;
+  float light_intensity;
+  float shininess;
+} ShaderConstants;
+
+fn make_shader_constants(ShaderPermutation const& permutation)
+    ->ShaderConstants;
+
+fn shader_constant_entries()
+    ->std::vector<VkSpecializationMapEntry> const&;
+
+// Unique per permutation, for keying pipeline maps.
+fn permutation_key(ShaderPermutation const& permutation)->uint32_t;
+
+fn permutation_name(ShaderPermutation const& permutation)->std::string;
+
+// Every permutation worth building up front.
+fn all_shader_permutations()->std::vector<ShaderPermutation>;
+
+// The cheapest permutation that covers a mesh with up to max_influences
+// joints per vertex. No influences selects the static permutation.
+fn select_shader_permutation(uint32_t max_influences, SkinningMethod skinning,
+                             bool normal_map)->ShaderPermutation;
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+
+// Compiled from res/ and embedded at build time (see CMakeLists.txt).
+#include "composite_frag_spv.h"
+#include "composite_vert_spv.h"
+#include "frag_material_spv.h"
+#include "frag_spv.h"
+#include "instance_cull_spv.h"
+#include "line_frag_spv.h"
+#include "line_vert_spv.h"
+#include "meshlet_cull_spv.h"
+#include "vert_spv.h"
+
+template <size_t N>
+fn shader_code(std::array<uint32_t, N> const& spirv)->lava::cdata {
+  return lava::cdata(spirv.data(), N * sizeof(uint32_t));
+}
@@ -0,0 +1,500 @@
+#include "texture_baking.h"
+
+#include <stb_image.h>
+
+#include <chrono>
+#include <filesystem>
+
+#include "trace.h"
+
+namespace {
+
+fn srgb_to_linear(uint8_t value)->float {
+  float const c = value / 255.0f;
+  return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+fn linear_to_srgb(float value)->uint8_t {
+  float const c = value <= 0.0031308f
+                      ? value * 12.92f
+                      : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+  return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+fn to_unorm8(float value)->uint8_t {
+  return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+fn downsample(TextureImage const& image, TextureUsage usage)->TextureImage {
+  TextureImage output{std::max(image.width / 2, 1u),
+                      std::max(image.height / 2, 1u), {}};
+  output.pixels.resize(output.width * output.height * 4);
+  for (uint32_t y = 0; y < output.height; y++) {
+    for (uint32_t x = 0; x < output.width; x++) {
+      // Average the 2x2 footprint, clamped for odd sizes.
+      lava::v4 sum(0);
+      for (uint32_t dy = 0; dy < 2; dy++) {
+        for (uint32_t dx = 0; dx < 2; dx++) {
+          uint32_t const sx = std::min(x * 2 + dx, image.width - 1);
+          uint32_t const sy = std::min(y * 2 + dy, image.height - 1);
+          uint8_t const* pixel = &image.pixels[(sy * image.width + sx) * 4];
+          if (usage == TextureUsage::normal) {
+            sum += lava::v4(pixel[0] / 127.5f - 1, pixel[1] / 127.5f - 1,
+                            pixel[2] / 127.5f - 1, pixel[3] / 255.0f);
+          } else {
+            sum += lava::v4(srgb_to_linear(pixel[0]), srgb_to_linear(pixel[1]),
+                            srgb_to_linear(pixel[2]), pixel[3] / 255.0f);
+          }
+        }
+      }
+      sum /= 4.0f;
+      uint8_t* pixel = &output.pixels[(y * output.width + x) * 4];
+      if (usage == TextureUsage::normal) {
+        lava::v3 normal = lava::v3(sum);
+        float const length = glm::length(normal);
+        normal = length > 0 ? normal / length : lava::v3(0, 0, 1);
+        for (size_t i = 0; i < 3; i++) {
+          pixel[i] = to_unorm8(normal[i] * 0.5f + 0.5f);
+        }
+      } else {
+        for (size_t i = 0; i < 3; i++) {
+          pixel[i] = linear_to_srgb(sum[i]);
+        }
+      }
+      pixel[3] = to_unorm8(sum.w);
+    }
+  }
+  return output;
+}
+
+// Gather a 4x4 block of RGBA pixels, repeating edge pixels past the border.
+fn read_block(TextureImage const& image, uint32_t block_x, uint32_t block_y,
+              std::array<std::array<uint8_t, 4>, 16>& block)->void {
+  for (uint32_t y = 0; y < 4; y++) {
+    for (uint32_t x = 0; x < 4; x++) {
+      uint32_t const sx = std::min(block_x * 4 + x, image.width - 1);
+      uint32_t const sy = std::min(block_y * 4 + y, image.height - 1);
+      std::memcpy(block[y * 4 + x].data(),
+                  &image.pixels[(sy * image.width + sx) * 4], 4);
+    }
+  }
+}
+
+template <typename Encode>
+fn encode_blocks(TextureImage const& image, size_t block_size, Encode encode)
+    ->std::vector<uint8_t> {
+  uint32_t const blocks_x = (image.width + 3) / 4;
+  uint32_t const blocks_y = (image.height + 3) / 4;
+  std::vector<uint8_t> output(blocks_x * blocks_y * block_size);
+  std::array<std::array<uint8_t, 4>, 16> block;
+  for (uint32_t y = 0; y < blocks_y; y++) {
+    for (uint32_t x = 0; x < blocks_x; x++) {
+      read_block(image, x, y, block);
+      encode(block, &output[(y * blocks_x + x) * block_size]);
+    }
+  }
+  return output;
+}
+
+// Principal axis of the block's colors over the first channel_count
+// channels, by power iteration on their covariance.
+fn principal_axis(std::array<std::array<uint8_t, 4>, 16> const& block,
+                  size_t channel_count, lava::v4& mean)->lava::v4 {
+  mean = lava::v4(0);
+  for (auto const& pixel : block) {
+    for (size_t c = 0; c < channel_count; c++) {
+      mean[c] += pixel[c] / 16.0f;
+    }
+  }
+  std::array<std::array<float, 4>, 4> covariance{};
+  for (auto const& pixel : block) {
+    lava::v4 d(0);
+    for (size_t c = 0; c < channel_count; c++) {
+      d[c] = pixel[c] - mean[c];
+    }
+    for (size_t i = 0; i < 4; i++) {
+      for (size_t j = 0; j < 4; j++) {
+        covariance[i][j] += d[i] * d[j];
+      }
+    }
+  }
+  lava::v4 axis(1, 1, 1, channel_count == 4 ? 1 : 0);
+  for (size_t iteration = 0; iteration < 8; iteration++) {
+    lava::v4 next(0);
+    for (size_t i = 0; i < 4; i++) {
+      for (size_t j = 0; j < 4; j++) {
+        next[i] += covariance[i][j] * axis[j];
+      }
+    }
+    float const length = glm::length(next);
+    if (length < 1e-6f) {
+      break;
+    }
+    axis = next / length;
+  }
+  return axis;
+}
+
+// Project the block onto its principal axis and return the extreme points.
+fn fit_endpoints(std::array<std::array<uint8_t, 4>, 16> const& block,
+                 size_t channel_count, lava::v4& low, lava::v4& high)->void {
+  lava::v4 mean;
+  lava::v4 const axis = principal_axis(block, channel_count, mean);
+  float min_t = std::numeric_limits<float>::max();
+  float max_t = std::numeric_limits<float>::lowest();
+  for (auto const& pixel : block) {
+    float t = 0;
+    for (size_t c = 0; c < channel_count; c++) {
+      t += (pixel[c] - mean[c]) * axis[c];
+    }
+    min_t = std::min(min_t, t);
+    max_t = std::max(max_t, t);
+  }
+  low = glm::clamp(mean + axis * min_t, lava::v4(0), lava::v4(255));
+  high = glm::clamp(mean + axis * max_t, lava::v4(0), lava::v4(255));
+}
+
+fn pixel_error(std::array<uint8_t, 4> const& pixel, lava::v4 color,
+               size_t channel_count)->float {
+  float error = 0;
+  for (size_t c = 0; c < channel_count; c++) {
+    float const d = pixel[c] - color[c];
+    error += d * d;
+  }
+  return error;
+}
+
+fn pack_565(lava::v4 color)->uint16_t {
+  uint16_t const r = static_cast<uint16_t>(color.x * 31.0f / 255.0f + 0.5f);
+  uint16_t const g = static_cast<uint16_t>(color.y * 63.0f / 255.0f + 0.5f);
+  uint16_t const b = static_cast<uint16_t>(color.z * 31.0f / 255.0f + 0.5f);
+  return (r << 11) | (g << 5) | b;
+}
+
+fn unpack_565(uint16_t color)->lava::v4 {
+  uint32_t const r = (color >> 11) & 31;
+  uint32_t const g = (color >> 5) & 63;
+  uint32_t const b = color & 31;
+  return lava::v4((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2),
+                  255);
+}
+
+fn encode_bc1_block(std::array<std::array<uint8_t, 4>, 16> const& block,
+                    uint8_t* output)->void {
+  lava::v4 low;
+  lava::v4 high;
+  fit_endpoints(block, 3, low, high);
+  uint16_t color0 = pack_565(high);
+  uint16_t color1 = pack_565(low);
+  // color0 > color1 selects the four color mode.
+  if (color0 < color1) {
+    std::swap(color0, color1);
+  }
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    lava::v4 const c0 = unpack_565(color0);
+    lava::v4 const c1 = unpack_565(color1);
+    std::array<lava::v4, 4> const palette = {
+        c0, c1, (c0 * 2.0f + c1) / 3.0f, (c0 + c1 * 2.0f) / 3.0f};
+    for (size_t i = 0; i < 16; i++) {
+      uint32_t best = 0;
+      float best_error = std::numeric_limits<float>::max();
+      for (uint32_t j = 0; j < 4; j++) {
+        float const error = pixel_error(block[i], palette[j], 3);
+        if (error < best_error) {
+          best_error = error;
+          best = j;
+        }
+      }
+      indices |= best << (i * 2);
+    }
+  }
+  std::memcpy(output, &color0, 2);
+  std::memcpy(output + 2, &color1, 2);
+  std::memcpy(output + 4, &indices, 4);
+}
+
+fn encode_bc4_block(std::array<std::array<uint8_t, 4>, 16> const& block,
+                    size_t channel, uint8_t* output)->void {
+  uint8_t low = 255;
+  uint8_t high = 0;
+  for (auto const& pixel : block) {
+    low = std::min(low, pixel[channel]);
+    high = std::max(high, pixel[channel]);
+  }
+  // high > low selects the eight value mode.
+  std::array<float, 8> palette = {static_cast<float>(high),
+                                  static_cast<float>(low)};
+  for (size_t i = 2; i < 8; i++) {
+    palette[i] = ((8 - i) * high + (i - 1) * low) / 7.0f;
+  }
+  uint64_t indices = 0;
+  if (high != low) {
+    for (size_t i = 0; i < 16; i++) {
+      uint64_t best = 0;
+      float best_error = std::numeric_limits<float>::max();
+      for (uint64_t j = 0; j < 8; j++) {
+        float const error = std::abs(block[i][channel] - palette[j]);
+        if (error < best_error) {
+          best_error = error;
+          best = j;
+        }
+      }
+      indices |= best << (i * 3);
+    }
+  }
+  output[0] = high;
+  output[1] = low;
+  std::memcpy(output + 2, &indices, 6);
+}
+
+// Little-endian bit writer for one 128-bit block.
+typedef struct {
+  std::array<uint8_t, 16> bytes;
+  size_t offset;
+} BlockWriter;
+
+fn write_bits(BlockWriter& writer, uint32_t value, size_t count)->void {
+  for (size_t i = 0; i < count; i++, writer.offset++) {
+    if (value & (1u << i)) {
+      writer.bytes[writer.offset / 8] |= 1 << (writer.offset % 8);
+    }
+  }
+}
+
+constexpr std::array<uint32_t, 16> bc7_weights = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Quantize an endpoint to 7 bits per channel plus a shared p-bit, picking
+// the p-bit that loses the least.
+fn quantize_bc7_endpoint(lava::v4 color, std::array<uint32_t, 4>& quantized)
+    ->uint32_t {
+  uint32_t best_pbit = 0;
+  float best_error = std::numeric_limits<float>::max();
+  for (uint32_t pbit = 0; pbit < 2; pbit++) {
+    std::array<uint32_t, 4> candidate;
+    float error = 0;
+    for (size_t c = 0; c < 4; c++) {
+      candidate[c] = std::clamp(
+          static_cast<int>(std::round((color[c] - pbit) / 2.0f)), 0, 127);
+      float const d = static_cast<float>((candidate[c] << 1) | pbit) - color[c];
+      error += d * d;
+    }
+    if (error < best_error) {
+      best_error = error;
+      best_pbit = pbit;
+      quantized = candidate;
+    }
+  }
+  return best_pbit;
+}
+
+// Mode 6: one subset, RGBA 7.7.7.7 endpoints with p-bits, 4-bit indices.
+fn encode_bc7_block(std::array<std::array<uint8_t, 4>, 16> const& block,
+                    uint8_t* output)->void {
+  lava::v4 low;
+  lava::v4 high;
+  fit_endpoints(block, 4, low, high);
+  std::array<std::array<uint32_t, 4>, 2> endpoints;
+  std::array<uint32_t, 2> pbits = {quantize_bc7_endpoint(low, endpoints[0]),
+                                   quantize_bc7_endpoint(high, endpoints[1])};
+  std::array<lava::v4, 2> colors;
+  for (size_t e = 0; e < 2; e++) {
+    for (size_t c = 0; c < 4; c++) {
+      colors[e][c] = static_cast<float>((endpoints[e][c] << 1) | pbits[e]);
+    }
+  }
+
+  std::array<uint32_t, 16> indices;
+  for (size_t i = 0; i < 16; i++) {
+    float best_error = std::numeric_limits<float>::max();
+    for (uint32_t j = 0; j < 16; j++) {
+      lava::v4 value;
+      for (size_t c = 0; c < 4; c++) {
+        uint32_t const e0 = static_cast<uint32_t>(colors[0][c]);
+        uint32_t const e1 = static_cast<uint32_t>(colors[1][c]);
+        value[c] = static_cast<float>(
+            ((64 - bc7_weights[j]) * e0 + bc7_weights[j] * e1 + 32) >> 6);
+      }
+      float const error = pixel_error(block[i], value, 4);
+      if (error < best_error) {
+        best_error = error;
+        indices[i] = j;
+      }
+    }
+  }
+  // The anchor index drops its top bit, so it must be below 8.
+  if (indices[0] >= 8) {
+    std::swap(endpoints[0], endpoints[1]);
+    std::swap(pbits[0], pbits[1]);
+    for (auto& index : indices) {
+      index = 15 - index;
+    }
+  }
+
+  BlockWriter writer{};
+  write_bits(writer, 1 << 6, 7);
+  for (size_t c = 0; c < 4; c++) {
+    write_bits(writer, endpoints[0][c], 7);
+    write_bits(writer, endpoints[1][c], 7);
+  }
+  write_bits(writer, pbits[0], 1);
+  write_bits(writer, pbits[1], 1);
+  for (size_t i = 0; i < 16; i++) {
+    write_bits(writer, indices[i], i == 0 ? 3 : 4);
+  }
+  std::memcpy(output, writer.bytes.data(), writer.bytes.size());
+}
+
+fn texture_format(TextureUsage usage)->VkFormat {
+  switch (usage) {
+    case TextureUsage::color:
+      return VK_FORMAT_BC7_SRGB_BLOCK;
+    case TextureUsage::normal:
+      return VK_FORMAT_BC5_UNORM_BLOCK;
+    case TextureUsage::specular:
+      return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+  }
+  return VK_FORMAT_UNDEFINED;
+}
+
+fn usage_name(TextureUsage usage)->char const* {
+  switch (usage) {
+    case TextureUsage::color:
+      return "color";
+    case TextureUsage::normal:
+      return "normal";
+    case TextureUsage::specular:
+      return "specular";
+  }
+  return "unknown";
+}
+
+}  // namespace
+
+fn generate_mips(TextureImage const& image, TextureUsage usage)
+    ->std::vector<TextureImage> {
+  std::vector<TextureImage> levels = {image};
+  while (levels.back().width > 1 || levels.back().height > 1) {
+    levels.push_back(downsample(levels.back(), usage));
+  }
+  return levels;
+}
+
+fn encode_bc1(TextureImage const& image)->std::vector<uint8_t> {
+  return encode_blocks(image, 8, encode_bc1_block);
+}
+
+fn encode_bc5(TextureImage const& image)->std::vector<uint8_t> {
+  return encode_blocks(image, 16, [](auto const& block, uint8_t* output) {
+    encode_bc4_block(block, 0, output);
+    encode_bc4_block(block, 1, output + 8);
+  });
+}
+
+fn encode_bc7(TextureImage const& image)->std::vector<uint8_t> {
+  return encode_blocks(image, 16, encode_bc7_block);
+}
+
+fn bake_texture(std::string const& source_path, std::string const& baked_path,
+                TextureUsage usage)->bool {
+  TRACE_SCOPE("bake_texture");
+  auto const start = std::chrono::steady_clock::now();
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  stbi_uc* pixels =
+      stbi_load(source_path.c_str(), &width, &height, &channels, 4);
+  if (!pixels) {
+    return false;
+  }
+  TextureImage image{static_cast<uint32_t>(width),
+                     static_cast<uint32_t>(height), {}};
+  image.pixels.assign(pixels, pixels + width * height * 4);
+  stbi_image_free(pixels);
+
+  std::vector<TextureLevel> levels;
+  std::vector<char> data;
+  for (auto const& level : generate_mips(image, usage)) {
+    std::vector<uint8_t> const blocks =
+        usage == TextureUsage::color    ? encode_bc7(level)
+        : usage == TextureUsage::normal ? encode_bc5(level)
+                                        : encode_bc1(level);
+    levels.push_back({static_cast<uint32_t>(data.size()),
+                      static_cast<uint32_t>(blocks.size()), level.width,
+                      level.height});
+    data.insert(data.end(), blocks.begin(), blocks.end());
+  }
+
+  TextureHeader const header{
+      static_cast<uint32_t>(texture_format(usage)), image.width, image.height,
+      static_cast<uint32_t>(levels.size())};
+  BakedAsset asset;
+  add_asset_chunk(asset, asset_chunk_texture_header,
+                  std::vector<TextureHeader>{header});
+  add_asset_chunk(asset, asset_chunk_texture_levels, levels);
+  asset.chunks.push_back({asset_chunk_texture_data, std::move(data)});
+  if (!write_baked_asset(baked_path, asset)) {
+    return false;
+  }
+
+  auto const elapsed = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start);
+  std::cout << "Baked " << source_path << ": " << levels.size()
+            << " levels, " << width * height * 4 / 1024 << " KiB -> "
+            << (levels.back().offset + levels.back().size) / 1024 << " KiB in "
+            << elapsed.count() << " ms\n";
+  return true;
+}
+
+fn load_baked_texture(lava::device_ptr device, std::string const& baked_path)
+    ->lava::texture::ptr {
+  std::optional<BakedAsset> asset = read_baked_asset(baked_path);
+  if (!asset) {
+    return nullptr;
+  }
+  auto header = get_asset_chunk<TextureHeader>(*asset,
+                                               asset_chunk_texture_header);
+  auto levels = get_asset_chunk<TextureLevel>(*asset,
+                                              asset_chunk_texture_levels);
+  auto data = get_asset_chunk<char>(*asset, asset_chunk_texture_data);
+  if (!header || header->size() != 1 || !levels || !data ||
+      levels->size() != header->front().level_count) {
+    return nullptr;
+  }
+
+  lava::layer layer;
+  for (auto const& level : *levels) {
+    layer.levels.push_back({{level.width, level.height}, level.size});
+  }
+  lava::texture::ptr texture = lava::make_texture();
+  if (!texture->create(device,
+                       {header->front().width, header->front().height},
+                       static_cast<VkFormat>(header->front().format), {layer},
+                       lava::texture_type::tex_2d) ||
+      !texture->upload(data->data(), data->size())) {
+    return nullptr;
+  }
+  return texture;
+}
+
+fn load_or_bake_texture(lava::device_ptr device, std::string const& path,
+                        TextureUsage usage)->lava::texture::ptr {
+  TRACE_SCOPE("load_or_bake_texture");
+  namespace fs = std::filesystem;
+  // One bake per usage, since an image may be used as more than one.
+  std::string const baked_path =
+      fs::path(path)
+          .replace_extension(std::string(".") + usage_name(usage) + ".bake")
+          .string();
+  std::error_code error;
+  bool const stale =
+      !fs::exists(baked_path, error) ||
+      fs::last_write_time(baked_path, error) < fs::last_write_time(path, error);
+  if (stale && !bake_texture(path, baked_path, usage)) {
+    std::cout << "Failed to bake " << path << std::endl;
+    return lava::load_texture(device, path);
+  }
+  lava::texture::ptr texture = load_baked_texture(device, baked_path);
+  return texture ? texture : lava::load_texture(device, path);
+}
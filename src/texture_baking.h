@@ -0,0 +1,61 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "baked_asset.h"
+#include "includes.h"
+
+constexpr uint32_t asset_chunk_texture_header = make_asset_tag("TXHD");
+constexpr uint32_t asset_chunk_texture_levels = make_asset_tag("TXLV");
+constexpr uint32_t asset_chunk_texture_data = make_asset_tag("TXDT");
+
+// Decides the block format and how mips are filtered.
+enum class TextureUsage {
+  // BC7, sRGB. Mips are averaged in linear space.
+  color,
+  // BC5, two channels. Mips are renormalized, and z is rebuilt in frag.glsl.
+  normal,
+  // BC1, sRGB, for maps without useful alpha.
+  specular,
+};
+
+typedef struct {
+  uint32_t format;  // VkFormat
+  uint32_t width;
+  uint32_t height;
+  uint32_t level_count;
+} TextureHeader;
+
+// Levels are stored largest first and back to back, in the order
+// lava::texture::stage() copies them, so the data chunk is uploaded as is.
+typedef struct {
+  uint32_t offset;
+  uint32_t size;
+  uint32_t width;
+  uint32_t height;
+} TextureLevel;
+
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  std::vector<uint8_t> pixels;  // RGBA8
+} TextureImage;
+
+fn generate_mips(TextureImage const& image, TextureUsage usage)
+    ->std::vector<TextureImage>;
+
+// Encode 4x4 blocks, padding partial blocks by repeating edge pixels.
+fn encode_bc1(TextureImage const& image)->std::vector<uint8_t>;
+fn encode_bc5(TextureImage const& image)->std::vector<uint8_t>;
+fn encode_bc7(TextureImage const& image)->std::vector<uint8_t>;
+
+fn bake_texture(std::string const& source_path, std::string const& baked_path,
+                TextureUsage usage)->bool;
+
+fn load_baked_texture(lava::device_ptr device, std::string const& baked_path)
+    ->lava::texture::ptr;
+
+// Load the baked copy next to the source, baking it first if it is missing
+// or older than the source. Falls back to the source image.
+fn load_or_bake_texture(lava::device_ptr device, std::string const& path,
+                        TextureUsage usage)->lava::texture::ptr;
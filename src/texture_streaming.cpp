@@ -0,0 +1,345 @@
+#include "texture_streaming.h"
+
+#include "trace.h"
+
+namespace {
+
+fn make_ownership_barrier(VkImage image, VkAccessFlags src_access,
+                          VkAccessFlags dst_access, uint32_t src_family,
+                          uint32_t dst_family)->VkImageMemoryBarrier {
+  return {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = src_access,
+      .dstAccessMask = dst_access,
+      .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      .srcQueueFamilyIndex = src_family,
+      .dstQueueFamilyIndex = dst_family,
+      .image = image,
+      .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+                           VK_REMAINING_MIP_LEVELS, 0,
+                           VK_REMAINING_ARRAY_LAYERS},
+  };
+}
+
+// Record the copy and release the image to the graphics queue family.
+fn record_upload(TextureStreamer& streamer, StreamedTexture& texture)
+    ->VkCommandBuffer {
+  VkDevice const device = streamer.device->get();
+  VkCommandPoolCreateInfo const pool_info{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+      .queueFamilyIndex = streamer.transfer_family,
+  };
+  if (vkCreateCommandPool(device, &pool_info, nullptr,
+                          &texture.command_pool) != VK_SUCCESS) {
+    return VK_NULL_HANDLE;
+  }
+  VkCommandBufferAllocateInfo const alloc_info{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = texture.command_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+  };
+  VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+  if (vkAllocateCommandBuffers(device, &alloc_info, &cmd_buf) != VK_SUCCESS) {
+    return VK_NULL_HANDLE;
+  }
+  VkCommandBufferBeginInfo const begin_info{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  vkBeginCommandBuffer(cmd_buf, &begin_info);
+  texture.texture->stage(cmd_buf);
+  if (streamer.transfer_family != streamer.graphics_family) {
+    VkImageMemoryBarrier const release = make_ownership_barrier(
+        texture.texture->get_image()->get(), VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+        streamer.transfer_family, streamer.graphics_family);
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &release);
+  }
+  vkEndCommandBuffer(cmd_buf);
+  return cmd_buf;
+}
+
+fn run_worker(TextureStreamer& streamer)->void {
+  set_trace_thread_name("texture streamer");
+  while (true) {
+    StreamedTexture* texture = nullptr;
+    std::string path;
+    TextureUsage usage;
+    {
+      std::unique_lock lock(streamer.mutex);
+      streamer.wake.wait(lock, [&]() {
+        return streamer.stopping || !streamer.queue.empty();
+      });
+      if (streamer.stopping) {
+        return;
+      }
+      texture = streamer.queue.front();
+      streamer.queue.pop_front();
+      path = texture->path;
+      usage = texture->usage;
+    }
+
+    // Loading (and baking, the first time) is the slow part, so it happens
+    // outside the lock.
+    lava::texture::ptr loaded =
+        load_or_bake_texture(streamer.device, path, usage);
+    if (!loaded) {
+      std::cout << "Failed to load texture " << path << std::endl;
+      std::lock_guard lock(streamer.mutex);
+      texture->status = TextureStatus::failed;
+      continue;
+    }
+    texture->texture = loaded;
+    if (!streamer.transfer_queue) {
+      std::lock_guard lock(streamer.mutex);
+      texture->status = TextureStatus::uploading;
+      continue;
+    }
+
+    VkCommandBuffer const cmd_buf = record_upload(streamer, *texture);
+    std::lock_guard lock(streamer.mutex);
+    if (!cmd_buf) {
+      texture->status = TextureStatus::failed;
+      continue;
+    }
+    texture->upload_value = ++streamer.next_value;
+    VkTimelineSemaphoreSubmitInfoKHR const timeline_info{
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &texture->upload_value,
+    };
+    VkSubmitInfo const submit_info{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd_buf,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &streamer.timeline,
+    };
+    if (vkQueueSubmit(streamer.transfer_queue, 1, &submit_info,
+                      VK_NULL_HANDLE) != VK_SUCCESS) {
+      // Keep the timeline contiguous, so later uploads are still observed.
+      texture->status = TextureStatus::failed;
+      VkSemaphoreSignalInfoKHR const signal_info{
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO_KHR,
+          .semaphore = streamer.timeline,
+          .value = texture->upload_value,
+      };
+      vkSignalSemaphoreKHR(streamer.device->get(), &signal_info);
+      continue;
+    }
+    texture->status = TextureStatus::uploading;
+  }
+}
+
+}  // namespace
+
+fn add_texture_streaming_features(lava::device::create_param& param)->bool {
+  VkPhysicalDevice const physical_device = param.physical_device->get();
+  VkPhysicalDeviceTimelineSemaphoreFeaturesKHR supported_timeline{
+      .sType =
+          VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+  };
+  VkPhysicalDeviceFeatures2 supported{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &supported_timeline,
+  };
+  vkGetPhysicalDeviceFeatures2(physical_device, &supported);
+  if (!param.physical_device->supported(
+          VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) ||
+      !supported_timeline.timelineSemaphore) {
+    std::cout << "Timeline semaphores are unsupported, so textures upload "
+                 "on the graphics queue.\n";
+    return false;
+  }
+
+  static VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features{
+      .sType =
+          VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+      .timelineSemaphore = VK_TRUE,
+  };
+  timeline_features.pNext = const_cast<void*>(param.next);
+  param.next = &timeline_features;
+  param.extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+
+  // Ask for a transfer-only queue family, where the device has one.
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           families.data());
+  if (std::any_of(families.begin(), families.end(),
+                  [](VkQueueFamilyProperties const& family) {
+                    return (family.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+                           !(family.queueFlags & (VK_QUEUE_GRAPHICS_BIT |
+                                                  VK_QUEUE_COMPUTE_BIT));
+                  })) {
+    param.add_dedicated_queues();
+  }
+  return true;
+}
+
+fn start_texture_streamer(TextureStreamer& streamer, lava::device_ptr device,
+                          lava::queue const* transfer_queue,
+                          uint32_t graphics_family, size_t worker_count)
+    ->bool {
+  streamer.device = device;
+  streamer.graphics_family = graphics_family;
+  streamer.transfer_queue =
+      transfer_queue ? transfer_queue->vk_queue : VK_NULL_HANDLE;
+  streamer.transfer_family =
+      transfer_queue ? transfer_queue->family : graphics_family;
+  streamer.next_value = 0;
+  streamer.stopping = false;
+  streamer.timeline = VK_NULL_HANDLE;
+
+  VkSemaphoreTypeCreateInfoKHR const type_info{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+      .initialValue = 0,
+  };
+  VkSemaphoreCreateInfo const semaphore_info{
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &type_info,
+  };
+  if (streamer.transfer_queue &&
+      vkCreateSemaphore(device->get(), &semaphore_info, nullptr,
+                        &streamer.timeline) != VK_SUCCESS) {
+    std::cout << "Failed to create the texture upload semaphore." << std::endl;
+    return false;
+  }
+
+  worker_count = std::max<size_t>(worker_count, 1);
+  for (size_t i = 0; i < worker_count; i++) {
+    streamer.workers.emplace_back(run_worker, std::ref(streamer));
+  }
+  std::cout << "Streaming textures on " << worker_count << " threads, "
+            << (streamer.transfer_queue ? "with" : "without")
+            << " a transfer queue.\n";
+  return true;
+}
+
+fn request_texture(TextureStreamer& streamer, std::string const& path,
+                   TextureUsage usage)->size_t {
+  std::lock_guard lock(streamer.mutex);
+  streamer.textures.push_back({
+      .path = path,
+      .usage = usage,
+      .texture = nullptr,
+      .status = TextureStatus::queued,
+      .upload_value = 0,
+      .command_pool = VK_NULL_HANDLE,
+  });
+  streamer.queue.push_back(&streamer.textures.back());
+  streamer.wake.notify_one();
+  return streamer.textures.size() - 1;
+}
+
+fn acquire_streamed_textures(TextureStreamer& streamer,
+                             VkCommandBuffer cmd_buf)->size_t {
+  uint64_t completed = 0;
+  if (streamer.transfer_queue) {
+    vkGetSemaphoreCounterValueKHR(streamer.device->get(), streamer.timeline,
+                                  &completed);
+  }
+
+  size_t acquired = 0;
+  std::lock_guard lock(streamer.mutex);
+  for (auto& texture : streamer.textures) {
+    if (texture.status != TextureStatus::uploading ||
+        texture.upload_value > completed) {
+      continue;
+    }
+    if (!streamer.transfer_queue) {
+      texture.texture->stage(cmd_buf);
+    } else if (streamer.transfer_family != streamer.graphics_family) {
+      VkImageMemoryBarrier const acquire = make_ownership_barrier(
+          texture.texture->get_image()->get(), 0, VK_ACCESS_SHADER_READ_BIT,
+          streamer.transfer_family, streamer.graphics_family);
+      vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
+                           nullptr, 0, nullptr, 1, &acquire);
+    }
+    // The transfer queue already finished with these, so they can go now.
+    if (texture.command_pool) {
+      vkDestroyCommandPool(streamer.device->get(), texture.command_pool,
+                           nullptr);
+      texture.command_pool = VK_NULL_HANDLE;
+      texture.texture->destroy_upload_buffer();
+    }
+    texture.status = TextureStatus::ready;
+    acquired++;
+  }
+  return acquired;
+}
+
+fn get_streamed_texture(TextureStreamer& streamer, size_t handle)
+    ->lava::texture::ptr {
+  std::lock_guard lock(streamer.mutex);
+  StreamedTexture const& texture = streamer.textures[handle];
+  return texture.status == TextureStatus::ready ? texture.texture : nullptr;
+}
+
+fn all_textures_settled(TextureStreamer& streamer)->bool {
+  std::lock_guard lock(streamer.mutex);
+  return std::all_of(streamer.textures.begin(), streamer.textures.end(),
+                     [](StreamedTexture const& texture) {
+                       return texture.status == TextureStatus::ready ||
+                              texture.status == TextureStatus::failed;
+                     });
+}
+
+fn stop_texture_streamer(TextureStreamer& streamer)->void {
+  {
+    std::lock_guard lock(streamer.mutex);
+    streamer.stopping = true;
+  }
+  streamer.wake.notify_all();
+  for (auto& worker : streamer.workers) {
+    worker.join();
+  }
+  streamer.workers.clear();
+  if (!streamer.device) {
+    return;
+  }
+
+  VkDevice const device = streamer.device->get();
+  if (streamer.timeline) {
+    VkSemaphoreWaitInfoKHR const wait_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+        .semaphoreCount = 1,
+        .pSemaphores = &streamer.timeline,
+        .pValues = &streamer.next_value,
+    };
+    vkWaitSemaphoresKHR(device, &wait_info, UINT64_MAX);
+  }
+  for (auto& texture : streamer.textures) {
+    if (texture.command_pool) {
+      vkDestroyCommandPool(device, texture.command_pool, nullptr);
+    }
+    if (texture.texture) {
+      texture.texture->destroy();
+    }
+  }
+  streamer.textures.clear();
+  if (streamer.timeline) {
+    vkDestroySemaphore(device, streamer.timeline, nullptr);
+  }
+  streamer.device = nullptr;
+}
+
+fn make_placeholder_texture(lava::device_ptr device,
+                            std::array<uint8_t, 4> color)
+    ->lava::texture::ptr {
+  lava::texture::ptr texture = lava::make_texture();
+  if (!texture->create(device, {1, 1}, VK_FORMAT_R8G8B8A8_UNORM) ||
+      !texture->upload(color.data(), color.size())) {
+    return nullptr;
+  }
+  return texture;
+}
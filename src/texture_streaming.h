@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <liblava/lava.hpp>
+#include <mutex>
+#include <thread>
+
+#include "includes.h"
+#include "texture_baking.h"
+
+enum class TextureStatus { queued, uploading, ready, failed };
+
+typedef struct {
+  std::string path;
+  TextureUsage usage;
+  lava::texture::ptr texture;
+  TextureStatus status;
+  // Timeline value the transfer queue signals once the upload is done.
+  uint64_t upload_value;
+  // Owned by this upload alone, so it can be freed from the main thread.
+  VkCommandPool command_pool;
+} StreamedTexture;
+
+// Decodes textures on worker threads and uploads them on a dedicated
+// transfer queue. Without one, uploads are recorded on the graphics queue
+// by acquire_streamed_textures() instead.
+typedef struct {
+  lava::device_ptr device;
+  VkQueue transfer_queue;
+  uint32_t transfer_family;
+  uint32_t graphics_family;
+  VkSemaphore timeline;
+  uint64_t next_value;
+  // Guards every member below, and submissions to the transfer queue.
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<StreamedTexture> textures;
+  std::deque<StreamedTexture*> queue;
+  std::vector<std::thread> workers;
+  bool stopping;
+} TextureStreamer;
+
+// Enables timeline semaphores, and a dedicated transfer queue where the
+// device has one. Call from on_create_param. Returns false when timeline
+// semaphores aren't supported, and streaming must use the graphics queue.
+fn add_texture_streaming_features(lava::device::create_param& param)->bool;
+
+// transfer_queue may be null to upload on the graphics queue instead. Only
+// uploads on a transfer queue need timeline semaphores.
+fn start_texture_streamer(TextureStreamer& streamer, lava::device_ptr device,
+                          lava::queue const* transfer_queue,
+                          uint32_t graphics_family, size_t worker_count)
+    ->bool;
+
+fn request_texture(TextureStreamer& streamer, std::string const& path,
+                   TextureUsage usage)->size_t;
+
+// Take ownership of finished uploads on the graphics queue. Returns how many
+// textures became ready.
+fn acquire_streamed_textures(TextureStreamer& streamer,
+                             VkCommandBuffer cmd_buf)->size_t;
+
+// Null until the texture is ready.
+fn get_streamed_texture(TextureStreamer& streamer, size_t handle)
+    ->lava::texture::ptr;
+
+fn all_textures_settled(TextureStreamer& streamer)->bool;
+
+fn stop_texture_streamer(TextureStreamer& streamer)->void;
+
+// A 1x1 texture to bind while the real one streams in.
+fn make_placeholder_texture(lava::device_ptr device,
+                            std::array<uint8_t, 4> color)
+    ->lava::texture::ptr;
@@ -0,0 +1,152 @@
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+typedef struct {
+  uint32_t thread_id;
+  std::string thread_name;
+  // A ring of the latest events. Event i is at i % trace_buffer_capacity.
+  std::unique_ptr<TraceEvent[]> events;
+  // Events recorded, including overwritten ones. Events below this are
+  // complete. Only the owning thread stores it.
+  std::atomic<size_t> count;
+} TraceBuffer;
+
+// Buffers outlive their threads, so short-lived workers still show up.
+std::mutex buffers_mutex;
+std::vector<std::unique_ptr<TraceBuffer>> buffers;
+
+fn trace_epoch()->std::chrono::steady_clock::time_point {
+  static std::chrono::steady_clock::time_point const epoch =
+      std::chrono::steady_clock::now();
+  return epoch;
+}
+
+fn thread_buffer()->TraceBuffer&  {
+  thread_local TraceBuffer* buffer = nullptr;
+  if (!buffer) {
+    auto new_buffer = std::make_unique<TraceBuffer>();
+    new_buffer->events =
+        std::make_unique<TraceEvent[]>(trace_buffer_capacity);
+    new_buffer->count = 0;
+    std::lock_guard lock(buffers_mutex);
+    new_buffer->thread_id = buffers.size();
+    buffer = new_buffer.get();
+    buffers.push_back(std::move(new_buffer));
+  }
+  return *buffer;
+}
+
+fn record_event(char const* name, uint64_t start_ns, uint64_t end_ns)
+    ->void {
+  TraceBuffer& buffer = thread_buffer();
+  size_t const index = buffer.count.load(std::memory_order_relaxed);
+  buffer.events[index % trace_buffer_capacity] = {name, start_ns,
+                                                  end_ns - start_ns};
+  buffer.count.store(index + 1, std::memory_order_release);
+}
+
+// The first event still in a buffer holding count events.
+fn first_buffered(size_t count)->size_t {
+  return count > trace_buffer_capacity ? count - trace_buffer_capacity : 0;
+}
+
+fn write_json_string(std::ostream& out, std::string const& text)->void {
+  out << '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out << '\\';
+    }
+    out << c;
+  }
+  out << '"';
+}
+
+}  // namespace
+
+TraceZone::TraceZone(char const* name)
+    : name(name), start_ns(trace_now_ns()), open(true) {
+}
+
+TraceZone::~TraceZone() {
+  end();
+}
+
+fn TraceZone::end()->void {
+  if (open) {
+    record_event(name, start_ns, trace_now_ns());
+    open = false;
+  }
+}
+
+fn trace_now_ns()->uint64_t {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - trace_epoch())
+      .count();
+}
+
+fn set_trace_thread_name(char const* name)->void {
+  TraceBuffer& buffer = thread_buffer();
+  std::lock_guard lock(buffers_mutex);
+  buffer.thread_name = name;
+}
+
+fn write_chrome_trace(std::string const& path)->bool {
+  std::ofstream file(path);
+  if (!file) {
+    std::cout << "Failed to open " << path << std::endl;
+    return false;
+  }
+  std::lock_guard lock(buffers_mutex);
+  size_t event_count = 0;
+  size_t overwritten_count = 0;
+  std::vector<TraceEvent> events;
+  char const* separator = "\n";
+  // Trace timestamps are in microseconds.
+  file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  for (auto const& buffer : buffers) {
+    if (!buffer->thread_name.empty()) {
+      file << separator << R"({"ph":"M","name":"thread_name","pid":1,"tid":)"
+           << buffer->thread_id << R"(,"args":{"name":)";
+      write_json_string(file, buffer->thread_name);
+      file << "}}";
+      separator = ",\n";
+    }
+    // Copy the ring, then skip whatever its thread overwrote meanwhile.
+    size_t const count = buffer->count.load(std::memory_order_acquire);
+    events.clear();
+    for (size_t i = first_buffered(count); i < count; i++) {
+      events.push_back(buffer->events[i % trace_buffer_capacity]);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    size_t const first = std::max(
+        first_buffered(count),
+        first_buffered(buffer->count.load(std::memory_order_relaxed)));
+    for (size_t i = first; i < count; i++) {
+      TraceEvent const& event = events[i + events.size() - count];
+      file << separator << R"({"ph":"X","pid":1,"tid":)" << buffer->thread_id
+           << ",\"ts\":" << event.start_ns / 1000.0
+           << ",\"dur\":" << event.duration_ns / 1000.0 << ",\"name\":";
+      write_json_string(file, event.name);
+      file << '}';
+      separator = ",\n";
+    }
+    event_count += count - first;
+    overwritten_count += first;
+  }
+  file << "\n]}\n";
+  std::cout << "Wrote " << event_count << " trace events to " << path;
+  if (overwritten_count > 0) {
+    std::cout << ", after " << overwritten_count
+              << " older events were overwritten";
+  }
+  std::cout << '\n';
+  return static_cast<bool>(file);
+}
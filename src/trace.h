@@ -0,0 +1,48 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+
+#include "includes.h"
+
+// Events each thread keeps. Once a thread's buffer is full, its new events
+// overwrite its oldest, so a trace always covers the latest frames.
+constexpr size_t trace_buffer_capacity = 1 << 15;
+
+typedef struct {
+  // Must outlive the trace, so use string literals.
+  char const* name;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+} TraceEvent;
+
+// Times a scope on the calling thread. Recording only touches the thread's
+// own buffer, so zones are safe on any thread and take no locks.
+struct TraceZone {
+  explicit TraceZone(char const* name);
+  ~TraceZone();
+  TraceZone(TraceZone const&) = delete;
+  TraceZone& operator=(TraceZone const&) = delete;
+
+  // Close the zone before the end of its scope.
+  fn end()->void;
+
+  char const* name;
+  uint64_t start_ns;
+  bool open;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+  TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+
+// Nanoseconds since the first trace call.
+fn trace_now_ns()->uint64_t;
+
+// Shown in place of the thread id in trace viewers.
+fn set_trace_thread_name(char const* name)->void;
+
+// Write every event still buffered in Chrome's trace event format, for
+// chrome://tracing or Perfetto, and log how many were overwritten. Threads
+// may keep recording meanwhile.
+fn write_chrome_trace(std::string const& path)->bool;